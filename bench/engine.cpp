@@ -0,0 +1,384 @@
+/** Engine throughput benchmark
+
+Steps the engine on the calling thread, without the window, plugins, or audio devices, and prints the results as JSON.
+Patches are either generated (`-n` modules, `-w` wires) or taken from a .vcv file (`-p`).
+Modules of a .vcv file are replaced by synthetic modules with the same ports, so only the patch topology is measured, not the plugins' DSP.
+
+Usage: engine-bench [options]
+	-n <modules>    number of generated modules (default 100)
+	-w <wires>      number of generated wires (default 200)
+	-f <fanout>     maximum number of inputs driven by one output (default 4)
+	-b <feedback>   fraction of generated wires going backward in module order (default 0.1)
+	-p <patch.vcv>  use the topology of a patch instead of generating one
+	-t <frames>     frames to step per run (default 441000)
+	-r <runs>       number of runs, the fastest of which is reported (default 5)
+	-s <seed>       random seed for generated patches (default 1)
+	-o <file.json>  write the JSON to a file rather than stdout
+*/
+
+#include "engine.hpp"
+#include <getopt.h>
+#include <random>
+#include <chrono>
+#include <xmmintrin.h>
+#include <pmmintrin.h>
+
+#ifdef ARCH_LIN
+	#include <linux/perf_event.h>
+	#include <sys/ioctl.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+#endif
+
+
+using namespace rack;
+
+
+/** Does roughly the work of a simple oscillator and filter per output, so the benchmark isn't only measuring wire copies */
+struct BenchModule : Module {
+	std::vector<float> phases;
+	std::vector<float> states;
+
+	BenchModule(int numInputs, int numOutputs) : Module(1, numInputs, numOutputs, numOutputs) {
+		phases.resize(numOutputs);
+		states.resize(numOutputs);
+		params[0].value = 0.5f;
+	}
+
+	void step() override {
+		float sampleTime = engineGetSampleTime();
+		float in = 0.f;
+		for (Input &input : inputs) {
+			in += input.value;
+		}
+		for (int i = 0; i < (int) outputs.size(); i++) {
+			phases[i] += (110.f + 10.f * i) * sampleTime;
+			if (phases[i] >= 1.f)
+				phases[i] -= 1.f;
+			float x = 2.f * phases[i] - 1.f + 0.1f * in;
+			states[i] += (x - states[i]) * params[0].value;
+			outputs[i].value = 5.f * states[i];
+			lights[i].setBrightnessSmooth(states[i]);
+		}
+	}
+};
+
+
+struct BenchConfig {
+	int modules = 100;
+	int wires = 200;
+	int fanout = 4;
+	float feedback = 0.1f;
+	std::string patch;
+	int frames = 441000;
+	int runs = 5;
+	uint32_t seed = 1;
+	std::string output;
+};
+
+static const int GENERATED_PORTS = 4;
+
+
+/** Adds wires between random ports, with up to `fanout` inputs per output and `feedback` of them going to earlier modules */
+static void generatePatch(const BenchConfig &config) {
+	std::mt19937 rng(config.seed);
+	for (int i = 0; i < config.modules; i++) {
+		engineAddModule(new BenchModule(GENERATED_PORTS, GENERATED_PORTS));
+	}
+	if (config.modules < 2)
+		return;
+
+	std::uniform_int_distribution<int> moduleDist(0, config.modules - 1);
+	std::uniform_int_distribution<int> portDist(0, GENERATED_PORTS - 1);
+	std::uniform_real_distribution<float> unitDist(0.f, 1.f);
+	std::vector<bool> inputUsed(config.modules * GENERATED_PORTS);
+	int maxWires = std::min(config.wires, config.modules * GENERATED_PORTS);
+	int attempts = 0;
+
+	while ((int) gWires.size() < maxWires && attempts < 100 * maxWires) {
+		int outputModule = moduleDist(rng);
+		int outputId = portDist(rng);
+		std::uniform_int_distribution<int> fanoutDist(1, std::max(config.fanout, 1));
+		int fanout = fanoutDist(rng);
+		for (int j = 0; j < fanout && (int) gWires.size() < maxWires; j++) {
+			attempts++;
+			// Pick an input module after the output module, or before it for feedback
+			bool backward = unitDist(rng) < config.feedback;
+			int inputModule;
+			if (backward) {
+				inputModule = std::uniform_int_distribution<int>(0, outputModule)(rng);
+			}
+			else {
+				if (outputModule == config.modules - 1)
+					continue;
+				inputModule = std::uniform_int_distribution<int>(outputModule + 1, config.modules - 1)(rng);
+			}
+			int inputId = portDist(rng);
+			if (inputUsed[inputModule * GENERATED_PORTS + inputId])
+				continue;
+			inputUsed[inputModule * GENERATED_PORTS + inputId] = true;
+
+			Wire *wire = new Wire();
+			wire->outputModule = gModules[outputModule];
+			wire->outputId = outputId;
+			wire->inputModule = gModules[inputModule];
+			wire->inputId = inputId;
+			engineAddWire(wire);
+		}
+	}
+}
+
+
+/** Creates a BenchModule for each module of the patch, with enough ports for its wires, and connects them
+Returns false if the patch can't be read.
+*/
+static bool loadPatch(const std::string &filename) {
+	json_error_t error;
+	json_t *rootJ = json_load_file(filename.c_str(), 0, &error);
+	if (!rootJ) {
+		fprintf(stderr, "Could not read %s: %s line %d\n", filename.c_str(), error.text, error.line);
+		return false;
+	}
+
+	json_t *modulesJ = json_object_get(rootJ, "modules");
+	json_t *wiresJ = json_object_get(rootJ, "wires");
+	int numModules = json_array_size(modulesJ);
+	std::vector<int> numInputs(numModules, 0);
+	std::vector<int> numOutputs(numModules, 0);
+
+	// Module IDs are indices into the modules array
+	struct WireIds {
+		int outputModuleId, outputId, inputModuleId, inputId;
+	};
+	std::vector<WireIds> wireIds;
+	size_t i;
+	json_t *wireJ;
+	json_array_foreach(wiresJ, i, wireJ) {
+		WireIds ids;
+		ids.outputModuleId = json_integer_value(json_object_get(wireJ, "outputModuleId"));
+		ids.outputId = json_integer_value(json_object_get(wireJ, "outputId"));
+		ids.inputModuleId = json_integer_value(json_object_get(wireJ, "inputModuleId"));
+		ids.inputId = json_integer_value(json_object_get(wireJ, "inputId"));
+		if (!(0 <= ids.outputModuleId && ids.outputModuleId < numModules && 0 <= ids.inputModuleId && ids.inputModuleId < numModules))
+			continue;
+		if (ids.outputId < 0 || ids.inputId < 0)
+			continue;
+		numOutputs[ids.outputModuleId] = std::max(numOutputs[ids.outputModuleId], ids.outputId + 1);
+		numInputs[ids.inputModuleId] = std::max(numInputs[ids.inputModuleId], ids.inputId + 1);
+		wireIds.push_back(ids);
+	}
+	json_decref(rootJ);
+
+	for (int id = 0; id < numModules; id++) {
+		engineAddModule(new BenchModule(numInputs[id], numOutputs[id]));
+	}
+	for (const WireIds &ids : wireIds) {
+		Wire *wire = new Wire();
+		wire->outputModule = gModules[ids.outputModuleId];
+		wire->outputId = ids.outputId;
+		wire->inputModule = gModules[ids.inputModuleId];
+		wire->inputId = ids.inputId;
+		engineAddWire(wire);
+	}
+	return true;
+}
+
+
+static void clearPatch() {
+	while (!gWires.empty()) {
+		Wire *wire = gWires.back();
+		engineRemoveWire(wire);
+		delete wire;
+	}
+	while (!gModules.empty()) {
+		Module *module = gModules.back();
+		engineRemoveModule(module);
+		delete module;
+	}
+}
+
+
+/** Hardware counters read with perf_event_open(), if the kernel allows it */
+struct PerfCounters {
+	enum {
+		CYCLES,
+		INSTRUCTIONS,
+		CACHE_REFERENCES,
+		CACHE_MISSES,
+		NUM_COUNTERS
+	};
+	int fds[NUM_COUNTERS];
+	uint64_t values[NUM_COUNTERS] = {};
+
+	PerfCounters() {
+		const uint64_t configs[NUM_COUNTERS] = {
+#ifdef ARCH_LIN
+			PERF_COUNT_HW_CPU_CYCLES,
+			PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_REFERENCES,
+			PERF_COUNT_HW_CACHE_MISSES,
+#endif
+		};
+		for (int i = 0; i < NUM_COUNTERS; i++) {
+			fds[i] = -1;
+#ifdef ARCH_LIN
+			struct perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = configs[i];
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+		}
+	}
+	~PerfCounters() {
+#ifdef ARCH_LIN
+		for (int i = 0; i < NUM_COUNTERS; i++) {
+			if (fds[i] >= 0)
+				close(fds[i]);
+		}
+#endif
+	}
+	bool isAvailable(int i) {
+		return fds[i] >= 0;
+	}
+	void start() {
+#ifdef ARCH_LIN
+		for (int i = 0; i < NUM_COUNTERS; i++) {
+			if (fds[i] >= 0) {
+				ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+				ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+			}
+		}
+#endif
+	}
+	void stop() {
+#ifdef ARCH_LIN
+		for (int i = 0; i < NUM_COUNTERS; i++) {
+			if (fds[i] >= 0) {
+				ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+				if (read(fds[i], &values[i], sizeof(values[i])) != sizeof(values[i]))
+					values[i] = 0;
+			}
+		}
+#endif
+	}
+};
+
+
+int main(int argc, char *argv[]) {
+	BenchConfig config;
+	int c;
+	opterr = 0;
+	while ((c = getopt(argc, argv, "n:w:f:b:p:t:r:s:o:")) != -1) {
+		switch (c) {
+			case 'n': config.modules = atoi(optarg); break;
+			case 'w': config.wires = atoi(optarg); break;
+			case 'f': config.fanout = atoi(optarg); break;
+			case 'b': config.feedback = atof(optarg); break;
+			case 'p': config.patch = optarg; break;
+			case 't': config.frames = atoi(optarg); break;
+			case 'r': config.runs = atoi(optarg); break;
+			case 's': config.seed = strtoul(optarg, NULL, 10); break;
+			case 'o': config.output = optarg; break;
+			default: {
+				fprintf(stderr, "Unknown option -%c. See bench/engine.cpp for usage.\n", optopt);
+				return 1;
+			} break;
+		}
+	}
+
+	// Match the engine thread's floating point mode
+	_MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
+	_MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
+
+	engineInit();
+	if (!config.patch.empty()) {
+		if (!loadPatch(config.patch))
+			return 1;
+	}
+	else {
+		generatePatch(config);
+	}
+	int numModules = gModules.size();
+	int numWires = gWires.size();
+
+	// Warm up caches and branch predictors
+	engineStepFrames(std::min(config.frames, 4096));
+
+	PerfCounters perf;
+	double bestTime = INFINITY;
+	uint64_t bestValues[PerfCounters::NUM_COUNTERS] = {};
+	for (int run = 0; run < config.runs; run++) {
+		perf.start();
+		auto startTime = std::chrono::high_resolution_clock::now();
+		engineStepFrames(config.frames);
+		auto stopTime = std::chrono::high_resolution_clock::now();
+		perf.stop();
+		double time = std::chrono::duration<double>(stopTime - startTime).count();
+		if (time < bestTime) {
+			bestTime = time;
+			memcpy(bestValues, perf.values, sizeof(bestValues));
+		}
+	}
+
+	clearPatch();
+	engineDestroy();
+
+	// Report
+	json_t *rootJ = json_object();
+	json_object_set_new(rootJ, "version", json_string(TOSTRING(VERSION)));
+
+	json_t *configJ = json_object();
+	if (config.patch.empty()) {
+		json_object_set_new(configJ, "seed", json_integer(config.seed));
+		json_object_set_new(configJ, "fanout", json_integer(config.fanout));
+		json_object_set_new(configJ, "feedback", json_real(config.feedback));
+	}
+	else {
+		json_object_set_new(configJ, "patch", json_string(config.patch.c_str()));
+	}
+	json_object_set_new(configJ, "modules", json_integer(numModules));
+	json_object_set_new(configJ, "wires", json_integer(numWires));
+	json_object_set_new(configJ, "frames", json_integer(config.frames));
+	json_object_set_new(configJ, "runs", json_integer(config.runs));
+	json_object_set_new(configJ, "sampleRate", json_real(engineGetSampleRate()));
+	// The engine steps all modules on one thread
+	json_object_set_new(configJ, "threads", json_integer(1));
+	json_object_set_new(rootJ, "config", configJ);
+
+	json_t *resultJ = json_object();
+	double frames = config.frames;
+	json_object_set_new(resultJ, "seconds", json_real(bestTime));
+	json_object_set_new(resultJ, "nsPerFrame", json_real(bestTime / frames * 1e9));
+	if (numModules > 0)
+		json_object_set_new(resultJ, "nsPerModuleFrame", json_real(bestTime / frames / numModules * 1e9));
+	// How many times faster than real time at the engine's sample rate
+	json_object_set_new(resultJ, "realtimeFactor", json_real(frames / engineGetSampleRate() / bestTime));
+
+	const char *counterNames[PerfCounters::NUM_COUNTERS] = {"cyclesPerFrame", "instructionsPerFrame", "cacheReferencesPerFrame", "cacheMissesPerFrame"};
+	for (int i = 0; i < PerfCounters::NUM_COUNTERS; i++) {
+		if (perf.isAvailable(i))
+			json_object_set_new(resultJ, counterNames[i], json_real(bestValues[i] / frames));
+		else
+			json_object_set_new(resultJ, counterNames[i], json_null());
+	}
+	json_object_set_new(rootJ, "result", resultJ);
+
+	if (config.output.empty()) {
+		json_dumpf(rootJ, stdout, JSON_INDENT(2) | JSON_REAL_PRECISION(6));
+		printf("\n");
+	}
+	else {
+		if (json_dump_file(rootJ, config.output.c_str(), JSON_INDENT(2) | JSON_REAL_PRECISION(6)) < 0) {
+			fprintf(stderr, "Could not write %s\n", config.output.c_str());
+			json_decref(rootJ);
+			return 1;
+		}
+	}
+	json_decref(rootJ);
+	return 0;
+}
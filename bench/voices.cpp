@@ -0,0 +1,57 @@
+/** Voice allocation benchmark
+
+Plays random note presses and releases, with occasional sustain pedal changes, through the Core MIDI modules' VoiceAllocator in each poly mode, and prints the time per event.
+
+Usage: voices-bench [events]
+*/
+
+#include "../src/Core/VoiceAllocator.hpp"
+#include <random>
+#include <chrono>
+
+
+int main(int argc, char *argv[]) {
+	int numEvents = (argc >= 2) ? atoi(argv[1]) : 10000000;
+	if (numEvents <= 0) {
+		fprintf(stderr, "Number of events must be positive\n");
+		return 1;
+	}
+
+	// Generate the events once, so the random number generator isn't measured
+	struct Event {
+		uint8_t type;
+		uint8_t note;
+	};
+	std::vector<Event> events(numEvents);
+	std::mt19937 rng(1);
+	for (Event &event : events) {
+		int r = rng() % 100;
+		// Press, release, press pedal, release pedal
+		event.type = (r < 48) ? 0 : (r < 96) ? 1 : (r < 98) ? 2 : 3;
+		event.note = 48 + rng() % 24;
+	}
+
+	const char *modeNames[VoiceAllocator::NUM_MODES] = {"rotate", "reuse", "reset", "reassign", "unison"};
+	for (int channels : {4, 16}) {
+		for (int mode = 0; mode < VoiceAllocator::NUM_MODES; mode++) {
+			VoiceAllocator voices(channels);
+			voices.polyMode = (VoiceAllocator::PolyMode) mode;
+			int gates = 0;
+			auto startTime = std::chrono::high_resolution_clock::now();
+			for (const Event &event : events) {
+				switch (event.type) {
+					case 0: voices.pressNote(event.note); break;
+					case 1: voices.releaseNote(event.note); break;
+					case 2: voices.pressPedal(); break;
+					case 3: voices.releasePedal(); break;
+				}
+				gates += voices.getGate(0);
+			}
+			auto stopTime = std::chrono::high_resolution_clock::now();
+			double time = std::chrono::duration<double>(stopTime - startTime).count();
+			// Print the gate count so the loop can't be optimized away
+			printf("%2d voices, %-8s %6.1f ns/event (%d gates)\n", channels, modeNames[mode], time / numEvents * 1e9, gates);
+		}
+	}
+	return 0;
+}
@@ -47,7 +47,7 @@ static const float RACK_GRID_WIDTH = 15;
 static const float RACK_GRID_HEIGHT = 380;
 static const Vec RACK_GRID_SIZE = Vec(RACK_GRID_WIDTH, RACK_GRID_HEIGHT);
 static const std::string PRESET_FILTERS = "VCV Rack module preset (.vcvm):vcvm";
-static const std::string PATCH_FILTERS = "VCV Rack patch (.vcv):vcv";
+static const std::string PATCH_FILTERS = "VCV Rack patch (.vcv):vcv;VCV Rack binary patch (.vcvb):vcvb";
 
 
 struct ModuleWidget : OpaqueWidget {
@@ -119,6 +119,14 @@ struct WireWidget : OpaqueWidget {
 	Port *hoveredInputPort = NULL;
 	Wire *wire = NULL;
 	NVGcolor color;
+	/** Tessellated curve of the wire and its shadow, in WireContainer coordinates */
+	std::vector<Vec> curvePoints;
+	std::vector<Vec> shadowPoints;
+	/** State the curve was tessellated with */
+	Vec curveOutputPos;
+	Vec curveInputPos;
+	float curveTension = 0.f;
+	float curveZoom = 0.f;
 
 	WireWidget();
 	~WireWidget();
@@ -126,8 +134,23 @@ struct WireWidget : OpaqueWidget {
 	void updateWire();
 	Vec getOutputPos();
 	Vec getInputPos();
+	/** Returns the area covered by the wire and its plugs, in WireContainer coordinates */
+	Rect getBoundingBox();
 	json_t *toJson();
 	void fromJson(json_t *rootJ);
+	float getOpacity();
+	/** Re-tessellates the curve if its endpoints, the cable tension, or the zoom have changed */
+	void updateCurve();
+	/** Adds the shadow curve to the current path, so WireContainer can stroke all shadows at once */
+	void drawShadowPath(NVGcontext *vg);
+	/** Strokes the current path in the style of wire shadows */
+	static void strokeShadowPath(NVGcontext *vg);
+	/** Adds the wire curve to the current path, so WireContainer can stroke all wires of a color at once */
+	void drawCurvePath(NVGcontext *vg);
+	/** Strokes the current path in the style of the outline of wires of `color` */
+	static void strokeOutlinePath(NVGcontext *vg, NVGcolor color);
+	/** Strokes the current path in the style of the inside of wires of `color` */
+	static void strokeSolidPath(NVGcontext *vg, NVGcolor color);
 	void draw(NVGcontext *vg) override;
 	void drawPlugs(NVGcontext *vg);
 };
@@ -152,6 +175,8 @@ struct RackWidget : OpaqueWidget {
 	// Only put WireWidgets in here
 	WireContainer *wireContainer;
 	std::string lastPath;
+	/** Patch loaded by step() once pluginIsExtracting() is false, since it may use plugins which are still being extracted */
+	std::string pendingPath;
 	Vec lastMousePos;
 	bool lockModules = false;
 
@@ -171,6 +196,8 @@ struct RackWidget : OpaqueWidget {
 	void disconnect();
 	void save(std::string filename);
 	void load(std::string filename);
+	/** Saves the settings if they changed, and the patch to autosave.vcv in the background if it was edited since the last autosave */
+	void autosave();
 	json_t *toJson();
 	void fromJson(json_t *rootJ);
 	/** Creates a module and adds it to the rack */
@@ -433,6 +460,8 @@ struct MultiLightWidget : LightWidget {
 	void addBaseColor(NVGcolor baseColor);
 	/** Sets the color to a linear combination of the baseColors with the given weights */
 	void setValues(const std::vector<float> &values);
+	/** Same as above, with one value per base color */
+	void setValues(const float *values);
 };
 
 /** A MultiLightWidget that points to a module's Light or a range of lights
@@ -441,6 +470,8 @@ Will access firstLightId, firstLightId + 1, etc. for each added color
 struct ModuleLightWidget : MultiLightWidget {
 	Module *module = NULL;
 	int firstLightId;
+	/** Brightnesses read from the module's snapshot, kept to avoid allocating every frame */
+	std::vector<float> values;
 	void step() override;
 
 	template <typename T = ModuleLightWidget>
@@ -0,0 +1,106 @@
+#pragma once
+#include <string>
+#include <stdint.h>
+#include <jansson.h>
+
+
+namespace rack {
+
+
+/** Compact binary container for patches, an alternative to the JSON .vcv format
+
+Layout, all integers and reals little-endian, swapped on big-endian hosts:
+- BinpatchHeader
+- module table, one BinpatchModule per module
+- wire table, one BinpatchWire per wire
+- chunk table, one BinpatchChunk per chunk
+- chunk data, each chunk aligned to BINPATCH_ALIGN bytes
+
+Modules, wires, and the rest of the root object are stored as compact JSON chunks.
+Large arrays of numbers and long strings inside them are moved into raw chunks and replaced with a {"$binpatchChunk": index} object, so loading them does not require parsing text.
+Object keys of the patch which begin with "$" are stored with another "$" prepended, so they cannot be mistaken for chunk references.
+The file is memory-mapped when loaded, but binpatchLoad() still builds a complete json_t tree, since modules are restored through Module::fromJson().
+The JSON returned by binpatchLoad() is equal to the JSON given to binpatchSave().
+*/
+
+static const char BINPATCH_MAGIC[4] = {'V', 'C', 'V', 'B'};
+/** Version 2 escapes object keys beginning with "$". Version 1 files are still loaded. */
+static const uint32_t BINPATCH_VERSION = 2;
+static const uint64_t BINPATCH_ALIGN = 16;
+
+enum BinpatchFlags {
+	/** The root object has a "modules" array, stored in the module table */
+	BINPATCH_MODULES = 1 << 0,
+	/** The root object has a "wires" array, stored in the wire table */
+	BINPATCH_WIRES = 1 << 1,
+};
+
+struct BinpatchHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t moduleCount;
+	uint32_t wireCount;
+	uint32_t chunkCount;
+	/** Index of the JSON chunk containing the root object without its "modules" and "wires" arrays */
+	uint32_t rootChunk;
+	uint32_t flags;
+	uint32_t reserved;
+	uint64_t moduleTableOffset;
+	uint64_t wireTableOffset;
+	uint64_t chunkTableOffset;
+};
+
+struct BinpatchModule {
+	/** Index of the JSON chunk containing the module object */
+	uint32_t chunk;
+	uint32_t reserved;
+};
+
+enum BinpatchWireFlags {
+	/** The port fields are valid and were removed from the wire object */
+	BINPATCH_WIRE_PORTS = 1 << 0,
+};
+
+struct BinpatchWire {
+	int32_t outputModuleId;
+	int32_t outputId;
+	int32_t inputModuleId;
+	int32_t inputId;
+	/** Index of the JSON chunk containing the remaining wire object, e.g. its color */
+	uint32_t chunk;
+	uint32_t flags;
+};
+
+enum BinpatchChunkType {
+	/** UTF-8 JSON text */
+	BINPATCH_CHUNK_JSON,
+	/** Array of doubles */
+	BINPATCH_CHUNK_REAL,
+	/** Array of int64_t */
+	BINPATCH_CHUNK_INTEGER,
+	/** String bytes */
+	BINPATCH_CHUNK_STRING,
+};
+
+struct BinpatchChunk {
+	uint64_t offset;
+	uint64_t size;
+	uint32_t type;
+	uint32_t reserved;
+};
+
+
+/** Returns whether the file begins with the binary patch magic */
+bool binpatchIsFile(std::string filename);
+/** Writes the patch JSON as a binary patch
+Returns 0 if successful.
+*/
+int binpatchSave(json_t *rootJ, std::string filename);
+/** Reads a binary patch and converts it to patch JSON
+Returns NULL if the file could not be read or is malformed.
+Caller must json_decref().
+*/
+json_t *binpatchLoad(std::string filename);
+
+
+} // namespace rack
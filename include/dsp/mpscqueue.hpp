@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include "util/common.hpp"
+
+
+namespace rack {
+
+/** A bounded queue which any number of threads can push to without locking or waiting, and a single thread consumes.
+Each slot's sequence number says whether it is free for producers or ready for the consumer.
+Pushing fails instead of waiting when the queue is full.
+*/
+template <typename T, size_t S>
+struct MPSCQueue {
+	struct Slot {
+		std::atomic<size_t> sequence;
+		T value;
+	};
+	Slot slots[S];
+	/** Position of the next slot to be claimed by a producer */
+	std::atomic<size_t> head;
+	/** Position of the next slot to be read by the consumer */
+	std::atomic<size_t> tail;
+
+	MPSCQueue() {
+		clear();
+	}
+	/** Not thread-safe */
+	void clear() {
+		for (size_t i = 0; i < S; i++) {
+			slots[i].sequence = i;
+		}
+		head = 0;
+		tail = 0;
+	}
+	/** Claims a slot for writing a value in place, or returns NULL if the queue is full
+	Call publish() with the returned position once the value is written.
+	*/
+	T *claim(size_t *pos) {
+		size_t p = head.load(std::memory_order_relaxed);
+		while (true) {
+			Slot &slot = slots[p % S];
+			size_t sequence = slot.sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t) sequence - (intptr_t) p;
+			if (diff == 0) {
+				if (head.compare_exchange_weak(p, p + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0) {
+				return NULL;
+			}
+			else {
+				p = head.load(std::memory_order_relaxed);
+			}
+		}
+		*pos = p;
+		return &slots[p % S].value;
+	}
+	/** Makes a claimed slot ready for the consumer */
+	void publish(size_t pos) {
+		slots[pos % S].sequence.store(pos + 1, std::memory_order_release);
+	}
+	/** Returns false if the queue is full */
+	bool push(const T &t) {
+		size_t pos;
+		T *value = claim(&pos);
+		if (!value)
+			return false;
+		*value = t;
+		publish(pos);
+		return true;
+	}
+	/** Returns the next ready value, or NULL if there is none. Only called by the consumer.
+	Call pop() when done with it.
+	*/
+	T *front() {
+		size_t t = tail.load(std::memory_order_relaxed);
+		Slot &slot = slots[t % S];
+		if (slot.sequence.load(std::memory_order_acquire) != t + 1)
+			return NULL;
+		return &slot.value;
+	}
+	/** Frees the value returned by front() for the producer which wraps around to it */
+	void pop() {
+		size_t t = tail.load(std::memory_order_relaxed);
+		slots[t % S].sequence.store(t + S, std::memory_order_release);
+		tail.store(t + 1, std::memory_order_release);
+	}
+	/** Returns whether the consumer has popped the value pushed at `pos` */
+	bool isPopped(size_t pos) const {
+		return tail.load(std::memory_order_acquire) > pos;
+	}
+};
+
+} // namespace rack
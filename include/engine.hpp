@@ -1,5 +1,7 @@
 #pragma once
 #include <vector>
+#include <atomic>
+#include <stddef.h>
 #include "util/common.hpp"
 #include <jansson.h>
 
@@ -26,9 +28,27 @@ struct Light {
 };
 
 
+/** Maximum number of polyphonic channels carried by a port
+Input and Output grew from 4 bytes of voltage to PORT_MAX_CHANNELS voltages and a channel count, which changes the layout of Module's `inputs` and `outputs` vectors.
+Plugins compiled against an earlier SDK are not binary compatible and must be rebuilt, although their source compiles unchanged.
+
+Their source compiles because `value` is kept as a field aliasing `voltages[0]` through an anonymous union, instead of becoming an accessor, since plugins assign `outputs[i].value` directly.
+Reading the union member which wasn't last written is undefined in ISO C++, but GCC and Clang, which all Rack builds use, define it for unions, and both members are floats at the same address.
+The engine itself only uses `voltages`.
+*/
+static const int PORT_MAX_CHANNELS = 16;
+
+
 struct Input {
-	/** Voltage of the port, zero if not plugged in. Read-only by Module */
-	float value = 0.0;
+	/** Voltages of the channels, zero if not plugged in. Read-only by Module
+	`value` is the first channel, so monophonic modules can ignore polyphony.
+	*/
+	union {
+		alignas(16) float voltages[PORT_MAX_CHANNELS] = {};
+		float value;
+	};
+	/** Number of channels carried by the wire, copied from the output */
+	int channels = 1;
 	/** Whether a wire is plugged in */
 	bool active = false;
 	Light plugLights[2];
@@ -36,15 +56,85 @@ struct Input {
 	float normalize(float normalValue) {
 		return active ? value : normalValue;
 	}
+	float getVoltage(int channel = 0) {
+		return voltages[channel];
+	}
+	/** Returns the voltage of the channel, or of the first channel if the input is monophonic
+	Use this when a polyphonic module should apply a monophonic input to all of its voices.
+	*/
+	float getPolyVoltage(int channel) {
+		return (channels == 1) ? voltages[0] : voltages[channel];
+	}
 };
 
 
 struct Output {
-	/** Voltage of the port. Write-only by Module */
-	float value = 0.0;
+	/** Voltages of the channels. Write-only by Module
+	`value` is the first channel, so monophonic modules can ignore polyphony.
+	*/
+	union {
+		alignas(16) float voltages[PORT_MAX_CHANNELS] = {};
+		float value;
+	};
+	/** Number of channels carried by the wire */
+	int channels = 1;
 	/** Whether a wire is plugged in */
 	bool active = false;
 	Light plugLights[2];
+	void setVoltage(float voltage, int channel = 0) {
+		voltages[channel] = voltage;
+	}
+	/** Sets the number of channels, between 1 and PORT_MAX_CHANNELS
+	Channels above the new count are zeroed.
+	*/
+	void setChannels(int channels) {
+		channels = clamp(channels, 1, PORT_MAX_CHANNELS);
+		for (int c = channels; c < this->channels; c++) {
+			voltages[c] = 0.f;
+		}
+		this->channels = channels;
+	}
+};
+
+static_assert(offsetof(Input, value) == offsetof(Input, voltages), "Input::value must alias the first channel");
+static_assert(offsetof(Output, value) == offsetof(Output, voltages), "Output::value must alias the first channel");
+
+
+struct Module;
+
+/** Light brightnesses, plug light brightnesses, port voltages, and CPU time of a Module, published by the engine thread for the GUI thread
+The engine writes the buffer which readers aren't using, then bumps the sequence number.
+A reader retries if the sequence number changed while it was copying, so it never blocks the engine and never sees a half-written snapshot.
+*/
+struct ModuleSnapshot {
+	/** Number of snapshots published so far. Buffer `sequence % 2` is the latest. */
+	std::atomic<uint32_t> sequence;
+	std::vector<float> buffers[2];
+	int numLights = 0;
+	int numInputs = 0;
+	int numOutputs = 0;
+
+	ModuleSnapshot() : sequence(0) {}
+	/** Allocates the buffers for the module's current number of lights and ports
+	Must not be called while the engine might call write().
+	*/
+	void resize(Module *module);
+	/** Publishes the current values. Called by the engine thread. */
+	void write(Module *module);
+	/** Copies `count` values starting at `offset` from the latest snapshot
+	Returns false if nothing has been published yet.
+	*/
+	bool read(int offset, float *values, int count);
+
+	// Offsets of the values in a buffer
+	int lightOffset(int lightId) {return lightId;}
+	/** Followed by the negative plug light */
+	int inputPlugLightOffset(int inputId) {return numLights + 2 * inputId;}
+	int outputPlugLightOffset(int outputId) {return numLights + 2 * numInputs + 2 * outputId;}
+	int inputVoltageOffset(int inputId) {return numLights + 2 * numInputs + 2 * numOutputs + inputId;}
+	int outputVoltageOffset(int outputId) {return numLights + 3 * numInputs + 2 * numOutputs + outputId;}
+	int cpuTimeOffset() {return numLights + 3 * numInputs + 3 * numOutputs;}
+	int size() {return cpuTimeOffset() + 1;}
 };
 
 
@@ -55,6 +145,29 @@ struct Module {
 	std::vector<Light> lights;
 	/** For CPU usage meter */
 	float cpuTime = 0.0;
+	/** Values for the GUI, which should read them from here rather than from the lights and ports */
+	ModuleSnapshot snapshot;
+
+	/** Skips step() and silences the outputs. Set by the user from the UI thread and read by the engine thread. */
+	std::atomic<bool> bypassed{false};
+	/** Allows the engine to skip step() while none of the module's inputs and outputs are connected
+	Only set this if step() has no effects besides the outputs, so not if it keeps time like a sequencer or LFO, talks to an audio or MIDI device, or updates a display.
+	Modules without outputs or with lights are never skipped this way, since their step() may be driving something the user can see.
+	*/
+	bool sleepWhenUnused = false;
+	/** Allows the engine to skip step() once the inputs and outputs have been silent for SLEEP_SILENCE_TIME
+	step() resumes as soon as an input becomes non-zero or a param is changed.
+	Only set this if the module outputs silence when its inputs are silent, e.g. filters and VCAs but not oscillators.
+	*/
+	bool sleepWhenSilent = false;
+	/** Whether the engine skipped step() on the last frame */
+	bool sleeping = false;
+	/** Set by the engine when wires change */
+	bool unused = false;
+	/** Seconds the ports have been silent, for sleepWhenSilent */
+	float silentTime = 0.f;
+	/** Set when a param is changed, so a silent module wakes up */
+	bool paramChanged = false;
 
 	/** Constructs a Module with no params, inputs, outputs, and lights */
 	Module() {}
@@ -115,6 +228,10 @@ void engineDestroy();
 /** Launches engine thread */
 void engineStart();
 void engineStop();
+/** Steps the engine on the calling thread as fast as possible, for benchmarks and offline rendering
+The engine thread must not be running.
+*/
+void engineStepFrames(int frames);
 /** Does not transfer pointer ownership */
 void engineAddModule(Module *module);
 void engineRemoveModule(Module *module);
@@ -129,6 +246,10 @@ void engineSetSampleRate(float sampleRate);
 float engineGetSampleRate();
 /** Returns the inverse of the current sample rate */
 float engineGetSampleTime();
+/** Asks the engine to publish each module's snapshot after its next block of frames
+Called once per GUI frame.
+*/
+void engineRequestSnapshot();
 
 
 extern bool gPaused;
@@ -138,6 +259,11 @@ Your plugin needs to have a clear purpose for manipulating other modules and wir
 extern std::vector<Module*> gModules;
 extern std::vector<Wire*> gWires;
 extern bool gPowerMeter;
+/** Incremented by every edit to the patch, so autosave can skip writing an unchanged patch
+The engine increments it when modules and wires are added or removed and when params are set, and the app when modules are moved or bypassed.
+Modules which change their saved state in any other way, e.g. from a context menu item or by learning a MIDI CC in step(), should increment it.
+*/
+extern std::atomic<int> gStateGeneration;
 
 
 } // namespace rack
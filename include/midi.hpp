@@ -4,6 +4,7 @@
 #include <vector>
 #include <queue>
 #include <set>
+#include <atomic>
 #include <jansson.h>
 
 
@@ -14,6 +15,8 @@ struct MidiMessage {
 	uint8_t cmd = 0x00;
 	uint8_t data1 = 0x00;
 	uint8_t data2 = 0x00;
+	/** Seconds on the steady clock when the message was received by the device, set by MidiInputDevice */
+	double timestamp = 0.0;
 
 	uint8_t channel() {
 		return cmd & 0xf;
@@ -46,8 +49,14 @@ struct MidiInputDevice : MidiDevice {
 	void onMessage(MidiMessage message);
 };
 
+struct MidiOutput;
+
 struct MidiOutputDevice : MidiDevice {
-	// TODO
+	std::set<MidiOutput*> subscribed;
+	void subscribe(MidiOutput *midiOutput);
+	void unsubscribe(MidiOutput *midiOutput);
+	/** Called from the MIDI output thread */
+	virtual void sendMessage(MidiMessage message) {}
 };
 
 ////////////////////
@@ -63,10 +72,10 @@ struct MidiDriver {
 	virtual MidiInputDevice *subscribeInputDevice(int deviceId, MidiInput *midiInput) {return NULL;}
 	virtual void unsubscribeInputDevice(int deviceId, MidiInput *midiInput) {}
 
-	// virtual std::vector<int> getOutputDeviceIds() = 0;
-	// virtual std::string getOutputDeviceName(int deviceId) = 0;
-	// virtual MidiOutputDevice *subscribeOutputDevice(int deviceId, MidiOutput *midiOutput) = 0;
-	// virtual void unsubscribeOutputDevice(int deviceId, MidiOutput *midiOutput) = 0;
+	virtual std::vector<int> getOutputDeviceIds() {return {};}
+	virtual std::string getOutputDeviceName(int deviceId) {return "";}
+	virtual MidiOutputDevice *subscribeOutputDevice(int deviceId, MidiOutput *midiOutput) {return NULL;}
+	virtual void unsubscribeOutputDevice(int deviceId, MidiOutput *midiOutput) {}
 };
 
 ////////////////////
@@ -121,10 +130,90 @@ struct MidiInputQueue : MidiInput {
 };
 
 
+/** Sends MIDI messages from a module to a device
+sendMessage() is safe to call from the engine thread, since it never locks or allocates.
+Messages wait in a fixed-size queue until the MIDI output thread sends them to the device, at most about a millisecond later.
+*/
 struct MidiOutput : MidiIO {
+	static const size_t QUEUE_SIZE = 1024;
+	MidiMessage queue[QUEUE_SIZE];
+	/** Written only by the MIDI output thread */
+	std::atomic<size_t> queueStart;
+	/** Written only by the thread calling sendMessage() */
+	std::atomic<size_t> queueEnd;
+	/** Not owned */
+	MidiOutputDevice *device = NULL;
+
 	MidiOutput();
 	~MidiOutput();
+
+	std::vector<int> getDeviceIds() override;
+	std::string getDeviceName(int deviceId) override;
 	void setDeviceId(int deviceId) override;
+	/** Queues a message, setting its channel if a channel is selected
+	Returns false if the message was dropped because the queue is full.
+	Only one thread may call this at a time.
+	*/
+	bool sendMessage(MidiMessage message);
+	/** Sends the queued messages to the device. Called from the MIDI output thread. */
+	void flush();
+};
+
+
+/** Follows incoming MIDI clock ticks (24 per quarter note) and regenerates them at the engine sample rate
+The tick times are filtered from the ticks' timestamps with a delay-locked loop, and the regenerated clock's phase is pulled toward the position the loop predicts, delayed by `latency`.
+So the output ticks run at a steady tempo on exact frames, rather than in bursts whenever step() happens to drain the MIDI queue.
+A tick is never regenerated before it is received, so the output stops when the clock does.
+*/
+struct MidiClock {
+	/** Bandwidth of the delay-locked loop in Hz. Lower values smooth out more jitter but follow tempo changes more slowly. */
+	double bandwidth = 1.0;
+	/** Rate in Hz at which the difference between the predicted and regenerated positions is corrected */
+	double phaseGain = 4.0;
+	/** Rate in seconds per second at which `latency` falls when ticks are handled sooner */
+	double latencyDecay = 0.001;
+
+	/** Whether the transport was started or continued and not stopped since */
+	bool running = false;
+	/** Ticks received since the last start */
+	int64_t receivedTicks = 0;
+	/** Ticks regenerated since the last start, plus the phase of the next one */
+	int64_t outputTicks = 0;
+	double phase = 0.0;
+	/** Predicted position minus regenerated position, in ticks, which is yet to be corrected */
+	double positionError = 0.0;
+	/** Ticks waiting to be returned by process() */
+	int pendingTicks = 0;
+	/** Delay in seconds of the regenerated clock behind the filtered tick times
+	Follows the peak delay with which ticks are handled after their filtered time, so they are received before they are due.
+	*/
+	double latency = 0.0;
+
+	// Delay-locked loop state
+	int dllTicks = 0;
+	/** Predicted time of the next tick */
+	double dllTime = 0.0;
+	/** Estimated tick period in seconds */
+	double dllPeriod = 0.0;
+
+	void reset();
+	/** Handles a clock, start, continue, or stop system message
+	Returns true if the message was one of these.
+	*/
+	bool processMessage(MidiMessage message);
+	/** Same as processMessage(MidiMessage), where `time` is the current time on the steady clock in seconds, like MidiMessage::timestamp */
+	bool processMessage(MidiMessage message, double time);
+	/** Advances by one frame. Returns true if a tick occurs on this frame. */
+	bool process(float deltaTime);
+	/** Returns the estimated tempo in quarter notes per minute, or 0 if unknown */
+	float getTempo();
+	/** Returns the position since the last start in ticks */
+	double getPosition() {
+		return outputTicks + phase;
+	}
+	bool isLocked() {
+		return dllTicks >= 3;
+	}
 };
 
 
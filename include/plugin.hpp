@@ -95,16 +95,26 @@ struct Model {
 };
 
 
+/** Loads the installed plugins, and starts extracting downloaded plugin packages in the background */
 void pluginInit(bool devMode);
+/** Loads the plugins of the extracted packages once extraction finishes. Called by the UI thread every frame. */
+void pluginStep();
+/** Returns whether packages are being extracted, so their plugins are not loaded yet */
+bool pluginIsExtracting();
 void pluginDestroy();
 void pluginLogIn(std::string email, std::string password);
 void pluginLogOut();
 /** Returns whether a new plugin is available, and downloads it unless doing a dry run */
 bool pluginSync(bool dryRun);
+/** Cancels all downloads started by pluginSync() */
 void pluginCancelDownload();
+void pluginCancelDownload(std::string pluginSlug);
 bool pluginIsLoggedIn();
 bool pluginIsDownloading();
+/** Returns the average progress of all downloads */
 float pluginGetDownloadProgress();
+/** Returns the progress of a single plugin's download, or 0 if it is not being downloaded */
+float pluginGetDownloadProgress(std::string pluginSlug);
 std::string pluginGetDownloadName();
 std::string pluginGetLoginStatus();
 Plugin *pluginGetPlugin(std::string pluginSlug);
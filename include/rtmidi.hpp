@@ -22,12 +22,24 @@ struct RtMidiInputDevice : MidiInputDevice {
 };
 
 
+struct RtMidiOutputDevice : MidiOutputDevice {
+	RtMidiOut *rtMidiOut;
+	/** Reused by sendMessage() */
+	std::vector<unsigned char> bytes;
+
+	RtMidiOutputDevice(int driverId, int deviceId);
+	~RtMidiOutputDevice();
+	void sendMessage(MidiMessage message) override;
+};
+
+
 struct RtMidiDriver : MidiDriver {
 	int driverId;
 	/** Just for querying MIDI driver information */
 	RtMidiIn *rtMidiIn;
 	RtMidiOut *rtMidiOut;
 	std::map<int, RtMidiInputDevice*> devices;
+	std::map<int, RtMidiOutputDevice*> outputDevices;
 
 	RtMidiDriver(int driverId);
 	~RtMidiDriver();
@@ -36,6 +48,10 @@ struct RtMidiDriver : MidiDriver {
 	std::string getInputDeviceName(int deviceId) override;
 	MidiInputDevice *subscribeInputDevice(int deviceId, MidiInput *midiInput) override;
 	void unsubscribeInputDevice(int deviceId, MidiInput *midiInput) override;
+	std::vector<int> getOutputDeviceIds() override;
+	std::string getOutputDeviceName(int deviceId) override;
+	MidiOutputDevice *subscribeOutputDevice(int deviceId, MidiOutput *midiOutput) override;
+	void unsubscribeOutputDevice(int deviceId, MidiOutput *midiOutput) override;
 };
 
 
@@ -1,4 +1,6 @@
 #pragma once
+#include <map>
+#include <vector>
 #include "widgets.hpp"
 #include "blendish.h"
 
@@ -35,6 +37,9 @@ struct SequentialLayout : VirtualWidget {
 // Blendish UI elements
 ////////////////////
 
+/** Returns the same width as bndLabelWidth(vg, -1, text), using a cached TextLayout */
+float labelWidth(NVGcontext *vg, const std::string &text);
+
 struct Label : VirtualWidget {
 	std::string text;
 	float fontSize;
@@ -54,6 +59,49 @@ struct List : OpaqueWidget {
 	void step() override;
 };
 
+/** A vertical list which only has widgets for the rows near its visible area
+Subclasses set `rowCount`, override createRow(), and call refresh() when the rows change.
+Widgets of rows which leave the visible area are kept and offered to createRow() for another row of the same type.
+*/
+struct VirtualList : OpaqueWidget {
+	int rowCount = 0;
+	/** Height of every row, unless getRowHeight() is overridden */
+	float rowHeight = BND_WIDGET_HEIGHT;
+	/** Top of each row, followed by the total height */
+	std::vector<float> rowTops;
+	struct RowWidget {
+		Widget *widget;
+		int type;
+	};
+	/** Widgets of the rows which currently exist, by row */
+	std::map<int, RowWidget> rowWidgets;
+	/** Orphaned widgets available for reuse, by row type */
+	std::map<int, std::vector<Widget*>> recycledWidgets;
+
+	~VirtualList();
+	virtual float getRowHeight(int row) {return rowHeight;}
+	/** Widgets are only reused for rows of the same type */
+	virtual int getRowType(int row) {return 0;}
+	/** Returns a widget for the row
+	`recycled` is an orphaned widget of a row with the same type, or NULL.
+	Return it after updating it for the new row to avoid creating a widget, or it will be deleted.
+	*/
+	virtual Widget *createRow(int row, Widget *recycled) = 0;
+	/** Lays out the rows again and recycles all row widgets */
+	void refresh();
+	/** Returns the widget of the row, creating it if necessary */
+	Widget *getRowWidget(int row);
+	/** Returns the row of a widget, or -1 if it is not a row of this list */
+	int getWidgetRow(Widget *w);
+	Rect getRowBox(int row);
+	/** Scrolls the parent ScrollWidget so the row is visible */
+	void scrollToRow(int row);
+	void recycleRowWidget(RowWidget rowWidget);
+	void step() override;
+	/** Returns the part of the widget which is visible in the ScrollWidget containing it, or in its parent otherwise, in the widget's coordinates */
+	static Rect getVisibleRect(Widget *w);
+};
+
 /** Deletes itself from parent when clicked */
 struct MenuOverlay : OpaqueWidget {
 	void step() override;
@@ -68,6 +116,8 @@ struct Menu : OpaqueWidget {
 	Menu *childMenu = NULL;
 	/** The entry which created the child menu */
 	MenuEntry *activeEntry = NULL;
+	/** Number of entries which have been stepped at least once */
+	int measuredCount = 0;
 
 	Menu() {
 		box.size = Vec(0, 0);
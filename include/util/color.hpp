@@ -62,6 +62,10 @@ inline NVGcolor colorAlpha(NVGcolor a, float alpha) {
 	return a;
 }
 
+inline bool colorIsEqual(NVGcolor a, NVGcolor b) {
+	return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
 NVGcolor colorFromHexString(std::string s);
 std::string colorToHexString(NVGcolor c);
 
@@ -1,5 +1,7 @@
 #pragma once
 #include <string>
+#include <vector>
+#include <atomic>
 #include <jansson.h>
 
 
@@ -17,12 +19,35 @@ enum RequestMethod {
 Caller must json_decref().
 */
 json_t *requestJson(RequestMethod method, std::string url, json_t *dataJ);
-/** Returns true if downloaded successfully */
+/** Returns true if downloaded successfully
+Data is written to a ".part" file next to `filename` first, and an interrupted download of the same URL is resumed from that file with an HTTP range request.
+`progress` may be read from another thread while downloading.
+*/
+bool requestDownload(std::string url, std::string filename, std::atomic<float> *progress);
+/** Same as above, for callers of the original API which poll a plain float */
 bool requestDownload(std::string url, std::string filename, float *progress);
+
+/** A file download to be performed by requestDownloads() */
+struct RequestDownload {
+	std::string url;
+	std::string filename;
+	/** Between 0 and 1, written by the download thread */
+	std::atomic<float> progress{0.f};
+	/** Set to true from any thread to abort the download */
+	std::atomic<bool> cancelled{false};
+	/** Set after the download has finished */
+	bool success = false;
+};
+
+/** Performs the downloads with at most `maxTransfers` running at the same time, and returns when all have finished */
+void requestDownloads(const std::vector<RequestDownload*> &downloads, int maxTransfers);
+
 /** URL-encodes `s` */
 std::string requestEscape(std::string s);
 /** Computes the SHA256 of the file at `filename` */
 std::string requestSHA256File(std::string filename);
+/** Computes the SHA256 of the bytes of `s` */
+std::string requestSHA256String(std::string s);
 
 
 } // namespace rack
@@ -26,6 +26,30 @@ struct Font {
 	static std::shared_ptr<Font> load(const std::string &filename);
 };
 
+/** A string measured and broken into rows with a font and size
+Layouts are cached, so text which is drawn or measured every frame is only laid out when it changes.
+*/
+struct TextLayout {
+	struct Row {
+		/** Byte range of the row in the string */
+		int begin, end;
+		float width;
+	};
+	std::vector<Row> rows;
+	/** Advance width of the whole string on one line */
+	float width = 0.f;
+	/** Distance between baselines */
+	float lineHeight = 0.f;
+
+	/** Returns the cached layout of `text`, laying it out the first time
+	Rows are broken to fit `breakWidth`, or only at newlines if it is INFINITY.
+	The reference is valid until the next call.
+	*/
+	static const TextLayout &get(NVGcontext *vg, int font, float size, const std::string &text, float breakWidth = INFINITY);
+	/** Draws the rows of `text` left-aligned with the first baseline at `pos`, like nvgTextBox() but without breaking lines again */
+	void draw(NVGcontext *vg, const std::string &text, Vec pos) const;
+};
+
 struct Image {
 	int handle;
 	Image(const std::string &filename);
@@ -35,9 +59,23 @@ struct Image {
 
 struct SVG {
 	NSVGimage *handle;
+	/** NVG_SOLID or NVG_HOLE for each path of each shape, in order
+	Finding holes compares every pair of paths in a shape, so it is done once when parsing rather than every time the SVG is drawn.
+	*/
+	std::vector<int> windings;
 	SVG(const std::string &filename);
 	~SVG();
+	void computeWindings();
+	/** Returns the SVG from the cache, parsing it if needed
+	Thread-safe.
+	*/
 	static std::shared_ptr<SVG> load(const std::string &filename);
+	/** Parses SVGs on background threads so later calls to load() return without parsing
+	SVGs which aren't loaded within a minute after prefetching finishes are freed.
+	*/
+	static void prefetch(const std::vector<std::string> &filenames);
+	/** Cancels prefetching and waits for the background threads to finish */
+	static void stopPrefetch();
 };
 
 
@@ -54,6 +92,10 @@ struct Widget {
 	Widget *parent = NULL;
 	std::list<Widget*> children;
 	bool visible = true;
+	/** Set to true if draw() can change on its own, e.g. a display which reads its module's state
+	The window only redraws the areas of widgets whose box, visibility, or known fields changed, so other widgets would not be redrawn until the next input.
+	*/
+	bool alwaysDirty = false;
 
 	virtual ~Widget();
 
@@ -252,6 +294,7 @@ struct SVGWidget : VirtualWidget {
 /** Caches a widget's draw() result to a framebuffer so it is called less frequently
 When `dirty` is true, its children will be re-rendered on the next call to step() override.
 Events are not passed to the underlying scene.
+Images are packed into shared atlas textures, and the least recently drawn ones are evicted and re-rendered on demand when gFramebufferBudget is exceeded.
 */
 struct FramebufferWidget : VirtualWidget {
 	/** Set this to true to re-render the children to the framebuffer the next time it is drawn */
@@ -269,10 +312,18 @@ struct FramebufferWidget : VirtualWidget {
 	FramebufferWidget();
 	~FramebufferWidget();
 	void draw(NVGcontext *vg) override;
+	/** Returns the nanovg image containing the rendered children, or -1
+	The children are rendered into an atlas page shared with other FramebufferWidgets, so the first call makes an image of this widget's own, which is kept up to date from then on.
+	*/
 	int getImageHandle();
+	/** Returns whether the next draw() will re-render the children, because the widget is dirty or because it is showing a cached zoom level and zooming has settled */
+	bool isRenderPending();
 	void onZoom(EventZoom &e) override;
 };
 
+/** GPU memory in bytes which FramebufferWidget images may use before the least recently drawn are evicted */
+extern size_t gFramebufferBudget;
+
 /** A Widget representing a float value */
 struct QuantityWidget : VirtualWidget {
 	float value = 0.0;
@@ -29,6 +29,19 @@ extern float gWindowRatio;
 extern bool gAllowCursorLock;
 extern int gGuiFrame;
 extern Vec gMousePos;
+/** Incremented by every input event, including cursor movement */
+extern int gInputGeneration;
+/** Smoothed time in seconds spent handling events, stepping, and rendering each frame, excluding the frame rate limiter */
+extern float gFrameTime;
+/** Frame rate limit when there has been no input for a couple of seconds */
+extern float gIdleFrameRate;
+/** Frame rate limit when the window is not focused or not visible */
+extern float gBackgroundFrameRate;
+/** The area of the window being redrawn, in scene coordinates
+Only the areas of widgets which changed since the last frame are redrawn, with a full redraw after any input, scrolling, or zooming.
+The scene is drawn once for each of a few disjoint damaged areas, so this changes during a frame.
+*/
+extern Rect gDamageRect;
 
 
 void windowInit();
@@ -47,6 +60,8 @@ bool windowIsMaximized();
 void windowSetTheme(NVGcolor bg, NVGcolor fg);
 void windowSetFullScreen(bool fullScreen);
 bool windowGetFullScreen();
+/** Returns gDamageRect in the coordinates of `widget`, so it can skip drawing children outside of it */
+Rect windowGetDamageRect(Widget *widget);
 
 
 } // namespace rack
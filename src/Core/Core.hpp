@@ -1,4 +1,5 @@
 #include "rack.hpp"
+#include "VoiceAllocator.hpp"
 
 
 using namespace rack;
@@ -13,7 +14,6 @@ extern Model *modelBlank;
 extern Model *modelNotes;
 
 
-
 struct GridChoice : LedDisplayChoice {
 	virtual void setId(int id) {}
 };
@@ -64,6 +64,7 @@ struct MIDICCToCVInterface : Module {
 				if (learningId >= 0 && ccs[cc] != msg.data2) {
 					learnedCcs[learningId] = cc;
 					learningId = -1;
+					gStateGeneration++;
 				}
 				// Set CV
 				// Allow CC to be negative if the 8th bit is set
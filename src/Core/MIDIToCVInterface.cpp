@@ -3,8 +3,6 @@
 #include "dsp/digital.hpp"
 #include "dsp/filter.hpp"
 
-#include <algorithm>
-
 
 struct MIDIToCVInterface : Module {
 	enum ParamIds {
@@ -43,6 +41,7 @@ struct MIDIToCVInterface : Module {
 	PulseGenerator startPulse;
 	PulseGenerator stopPulse;
 	PulseGenerator continuePulse;
+	MidiClock midiClock;
 	int clock = 0;
 	int divisions[2];
 
@@ -52,12 +51,18 @@ struct MIDIToCVInterface : Module {
 	};
 
 	NoteData noteData[128];
-	std::vector<uint8_t> heldNotes;
+	NoteList heldNotes;
 	uint8_t lastNote;
 	bool pedal;
 	bool gate;
-
-	MIDIToCVInterface() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS), heldNotes(128) {
+	/** Number of channels of the CV, gate, velocity, and aftertouch outputs, with one voice per channel
+	1 is the monophonic last-note behavior.
+	*/
+	int channels = 1;
+	/** Assigns notes to channels when `channels` is above 1 */
+	VoiceAllocator voices;
+
+	MIDIToCVInterface() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS), voices(1) {
 		onReset();
 	}
 
@@ -72,6 +77,8 @@ struct MIDIToCVInterface : Module {
 		json_object_set_new(rootJ, "divisions", divisionsJ);
 
 		json_object_set_new(rootJ, "midi", midiInput.toJson());
+		json_object_set_new(rootJ, "channels", json_integer(channels));
+		json_object_set_new(rootJ, "polyMode", json_integer(voices.polyMode));
 		return rootJ;
 	}
 
@@ -88,6 +95,14 @@ struct MIDIToCVInterface : Module {
 		json_t *midiJ = json_object_get(rootJ, "midi");
 		if (midiJ)
 			midiInput.fromJson(midiJ);
+
+		json_t *channelsJ = json_object_get(rootJ, "channels");
+		if (channelsJ)
+			setChannels(json_integer_value(channelsJ));
+
+		json_t *polyModeJ = json_object_get(rootJ, "polyMode");
+		if (polyModeJ)
+			voices.polyMode = (VoiceAllocator::PolyMode) json_integer_value(polyModeJ);
 	}
 
 	void onReset() override {
@@ -95,17 +110,21 @@ struct MIDIToCVInterface : Module {
 		lastNote = 60;
 		pedal = false;
 		gate = false;
+		midiClock.reset();
 		clock = 0;
 		divisions[0] = 24;
 		divisions[1] = 6;
+		voices.reset();
+	}
+
+	void setChannels(int channels) {
+		this->channels = clamp(channels, 1, PORT_MAX_CHANNELS);
+		voices.channels = this->channels;
+		voices.reset();
 	}
 
 	void pressNote(uint8_t note) {
-		// Remove existing similar note
-		auto it = std::find(heldNotes.begin(), heldNotes.end(), note);
-		if (it != heldNotes.end())
-			heldNotes.erase(it);
-		// Push note
+		// Push note, removing the existing similar note
 		heldNotes.push_back(note);
 		lastNote = note;
 		gate = true;
@@ -114,15 +133,13 @@ struct MIDIToCVInterface : Module {
 
 	void releaseNote(uint8_t note) {
 		// Remove the note
-		auto it = std::find(heldNotes.begin(), heldNotes.end(), note);
-		if (it != heldNotes.end())
-			heldNotes.erase(it);
+		heldNotes.remove(note);
 		// Hold note if pedal is pressed
 		if (pedal)
 			return;
 		// Set last note
 		if (!heldNotes.empty()) {
-			lastNote = heldNotes[heldNotes.size() - 1];
+			lastNote = heldNotes.back();
 			gate = true;
 		}
 		else {
@@ -146,11 +163,39 @@ struct MIDIToCVInterface : Module {
 		}
 		float deltaTime = engineGetSampleTime();
 
-		outputs[CV_OUTPUT].value = (lastNote - 60) / 12.f;
-		outputs[GATE_OUTPUT].value = gate ? 10.f : 0.f;
-		outputs[VELOCITY_OUTPUT].value = rescale(noteData[lastNote].velocity, 0, 127, 0.f, 10.f);
+		// Clock ticks are regenerated on exact frames by the MidiClock rather than when the queue is drained
+		if (midiClock.process(deltaTime)) {
+			if (clock % divisions[0] == 0) {
+				clockPulses[0].trigger(1e-3);
+			}
+			if (clock % divisions[1] == 0) {
+				clockPulses[1].trigger(1e-3);
+			}
+			if (++clock >= (24*16*16)) {
+				// Avoid overflowing the integer
+				clock = 0;
+			}
+		}
+
+		for (int id : {CV_OUTPUT, GATE_OUTPUT, VELOCITY_OUTPUT, AFTERTOUCH_OUTPUT}) {
+			outputs[id].setChannels(channels);
+		}
+		if (channels == 1) {
+			outputs[CV_OUTPUT].value = (lastNote - 60) / 12.f;
+			outputs[GATE_OUTPUT].value = gate ? 10.f : 0.f;
+			outputs[VELOCITY_OUTPUT].value = rescale(noteData[lastNote].velocity, 0, 127, 0.f, 10.f);
+			outputs[AFTERTOUCH_OUTPUT].value = rescale(noteData[lastNote].aftertouch, 0, 127, 0.f, 10.f);
+		}
+		else {
+			for (int c = 0; c < channels; c++) {
+				uint8_t note = voices.notes[c];
+				outputs[CV_OUTPUT].setVoltage((note - 60) / 12.f, c);
+				outputs[GATE_OUTPUT].setVoltage(voices.getGate(c) ? 10.f : 0.f, c);
+				outputs[VELOCITY_OUTPUT].setVoltage(rescale(noteData[note].velocity, 0, 127, 0.f, 10.f), c);
+				outputs[AFTERTOUCH_OUTPUT].setVoltage(rescale(noteData[note].aftertouch, 0, 127, 0.f, 10.f), c);
+			}
+		}
 
-		outputs[AFTERTOUCH_OUTPUT].value = rescale(noteData[lastNote].aftertouch, 0, 127, 0.f, 10.f);
 		pitchFilter.lambda = 100.f * deltaTime;
 		outputs[PITCH_OUTPUT].value = pitchFilter.process(rescale(pitch, 0, 16384, -5.f, 5.f));
 		modFilter.lambda = 100.f * deltaTime;
@@ -172,16 +217,19 @@ struct MIDIToCVInterface : Module {
 			// note off
 			case 0x8: {
 				releaseNote(msg.note());
+				voices.releaseNote(msg.note());
 			} break;
 			// note on
 			case 0x9: {
 				if (msg.value() > 0) {
 					noteData[msg.note()].velocity = msg.value();
 					pressNote(msg.note());
+					voices.pressNote(msg.note());
 				}
 				else {
 					// For some reason, some keyboards send a "note on" event with a velocity of 0 to signal that the key has been released.
 					releaseNote(msg.note());
+					voices.releaseNote(msg.note());
 				}
 			} break;
 			// channel aftertouch
@@ -212,30 +260,22 @@ struct MIDIToCVInterface : Module {
 			} break;
 			// sustain
 			case 0x40: {
-				if (msg.value() >= 64)
+				if (msg.value() >= 64) {
 					pressPedal();
-				else
+					voices.pressPedal();
+				}
+				else {
 					releasePedal();
+					voices.releasePedal();
+				}
 			} break;
 			default: break;
 		}
 	}
 
 	void processSystem(MidiMessage msg) {
+		midiClock.processMessage(msg);
 		switch (msg.channel()) {
-			// Timing
-			case 0x8: {
-				if (clock % divisions[0] == 0) {
-					clockPulses[0].trigger(1e-3);
-				}
-				if (clock % divisions[1] == 0) {
-					clockPulses[1].trigger(1e-3);
-				}
-				if (++clock >= (24*16*16)) {
-					// Avoid overflowing the integer
-					clock = 0;
-				}
-			} break;
 			// Start
 			case 0xa: {
 				startPulse.trigger(1e-3);
@@ -294,6 +334,7 @@ struct MIDIToCVInterfaceWidget : ModuleWidget {
 			int division;
 			void onAction(EventAction &e) override {
 				module->divisions[index] = division;
+				gStateGeneration++;
 			}
 		};
 
@@ -322,6 +363,63 @@ struct MIDIToCVInterfaceWidget : ModuleWidget {
 			item->index = i;
 			menu->addChild(item);
 		}
+
+		struct ChannelsValueItem : MenuItem {
+			MIDIToCVInterface *module;
+			int channels;
+			void onAction(EventAction &e) override {
+				module->setChannels(channels);
+				gStateGeneration++;
+			}
+		};
+
+		struct ChannelsItem : MenuItem {
+			MIDIToCVInterface *module;
+			Menu *createChildMenu() override {
+				Menu *menu = new Menu();
+				for (int channels = 1; channels <= PORT_MAX_CHANNELS; channels++) {
+					ChannelsValueItem *item = MenuItem::create<ChannelsValueItem>((channels == 1) ? "Monophonic" : stringf("%d", channels), CHECKMARK(module->channels == channels));
+					item->module = module;
+					item->channels = channels;
+					menu->addChild(item);
+				}
+				return menu;
+			}
+		};
+
+		struct PolyModeValueItem : MenuItem {
+			MIDIToCVInterface *module;
+			VoiceAllocator::PolyMode polyMode;
+			void onAction(EventAction &e) override {
+				module->voices.polyMode = polyMode;
+				module->voices.reset();
+				gStateGeneration++;
+			}
+		};
+
+		struct PolyModeItem : MenuItem {
+			MIDIToCVInterface *module;
+			Menu *createChildMenu() override {
+				Menu *menu = new Menu();
+				std::vector<std::string> polyModeNames = {"Rotate", "Reuse", "Reset", "Reassign", "Unison"};
+				for (int i = 0; i < VoiceAllocator::NUM_MODES; i++) {
+					VoiceAllocator::PolyMode polyMode = (VoiceAllocator::PolyMode) i;
+					PolyModeValueItem *item = MenuItem::create<PolyModeValueItem>(polyModeNames[i], CHECKMARK(module->voices.polyMode == polyMode));
+					item->module = module;
+					item->polyMode = polyMode;
+					menu->addChild(item);
+				}
+				return menu;
+			}
+		};
+
+		menu->addChild(construct<MenuLabel>());
+		ChannelsItem *channelsItem = MenuItem::create<ChannelsItem>("Polyphony channels");
+		channelsItem->module = module;
+		menu->addChild(channelsItem);
+		PolyModeItem *polyModeItem = MenuItem::create<PolyModeItem>("Polyphony mode");
+		polyModeItem->module = module;
+		menu->addChild(polyModeItem);
 	}
 };
 
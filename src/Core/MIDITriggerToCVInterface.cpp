@@ -44,6 +44,7 @@ struct MIDITriggerToCVInterface : Module {
 		if (learningId >= 0) {
 			learnedNotes[learningId] = note;
 			learningId = -1;
+			gStateGeneration++;
 		}
 		// Find id
 		for (int i = 0; i < 16; i++) {
@@ -238,6 +239,7 @@ struct MIDITriggerToCVInterfaceWidget : ModuleWidget {
 			MIDITriggerToCVInterface *module;
 			void onAction(EventAction &e) override {
 				module->velocity ^= true;
+				gStateGeneration++;
 			}
 		};
 
@@ -4,6 +4,15 @@ using namespace rack;
 
 
 
+struct NotesTextField : LedDisplayTextField {
+	void onTextChange() override {
+		LedDisplayTextField::onTextChange();
+		// The text is saved in the patch
+		gStateGeneration++;
+	}
+};
+
+
 struct NotesWidget : ModuleWidget {
 	TextField *textField;
 
@@ -15,7 +24,7 @@ struct NotesWidget : ModuleWidget {
 		addChild(Widget::create<ScrewSilver>(Vec(RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
 		addChild(Widget::create<ScrewSilver>(Vec(box.size.x - 2 * RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
 
-		textField = Widget::create<LedDisplayTextField>(mm2px(Vec(3.39962, 14.8373)));
+		textField = Widget::create<NotesTextField>(mm2px(Vec(3.39962, 14.8373)));
 		textField->box.size = mm2px(Vec(74.480, 102.753));
 		textField->multiline = true;
 		addChild(textField);
@@ -2,8 +2,6 @@
 #include "midi.hpp"
 #include "dsp/digital.hpp"
 
-#include <algorithm>
-
 
 struct QuadMIDIToCVInterface : Module {
 	enum ParamIds {
@@ -25,40 +23,25 @@ struct QuadMIDIToCVInterface : Module {
 
 	MidiInputQueue midiInput;
 
-	enum PolyMode {
-		ROTATE_MODE,
-		REUSE_MODE,
-		RESET_MODE,
-		REASSIGN_MODE,
-		UNISON_MODE,
-		NUM_MODES
-	};
-	PolyMode polyMode = RESET_MODE;
-
 	struct NoteData {
 		uint8_t velocity = 0;
 		uint8_t aftertouch = 0;
 	};
 
 	NoteData noteData[128];
-	// cachedNotes : UNISON_MODE and REASSIGN_MODE cache all played notes. The other polyModes cache stolen notes (after the 4th one).
-	std::vector<uint8_t> cachedNotes;
-	uint8_t notes[4];
-	bool gates[4];
-	// gates set to TRUE by pedal and current gate. FALSE by pedal.
-	bool pedalgates[4];
-	bool pedal;
-	int rotateIndex;
-	int stealIndex;
+	VoiceAllocator voices;
+	/** Whether the outputs of the first voice also carry all four voices as polyphonic channels */
+	bool polyOutputs = false;
 
-	QuadMIDIToCVInterface() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS), cachedNotes(128) {
+	QuadMIDIToCVInterface() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS), voices(4) {
 		onReset();
 	}
 
 	json_t *toJson() override {
 		json_t *rootJ = json_object();
 		json_object_set_new(rootJ, "midi", midiInput.toJson());
-		json_object_set_new(rootJ, "polyMode", json_integer(polyMode));
+		json_object_set_new(rootJ, "polyMode", json_integer(voices.polyMode));
+		json_object_set_new(rootJ, "polyOutputs", json_boolean(polyOutputs));
 		return rootJ;
 	}
 
@@ -69,175 +52,15 @@ struct QuadMIDIToCVInterface : Module {
 
 		json_t *polyModeJ = json_object_get(rootJ, "polyMode");
 		if (polyModeJ)
-			polyMode = (PolyMode) json_integer_value(polyModeJ);
-	}
-
-	void onReset() override {
-		for (int i = 0; i < 4; i++) {
-			notes[i] = 60;
-			gates[i] = false;
-			pedalgates[i] = false;
-		}
-		pedal = false;
-		rotateIndex = -1;
-		cachedNotes.clear();
-	}
-
-	int getPolyIndex(int nowIndex) {
-		for (int i = 0; i < 4; i++) {
-			nowIndex++;
-			if (nowIndex > 3)
-				nowIndex = 0;
-			if (!(gates[nowIndex] || pedalgates[nowIndex])) {
-				stealIndex = nowIndex;
-				return nowIndex;
-			}
-		}
-		// All taken = steal (stealIndex always rotates)
-		stealIndex++;
-		if (stealIndex > 3)
-			stealIndex = 0;
-		if ((polyMode < REASSIGN_MODE) && (gates[stealIndex]))
-			cachedNotes.push_back(notes[stealIndex]);
-		return stealIndex;
-	}
-
-	void pressNote(uint8_t note) {
-		// Set notes and gates
-		switch (polyMode) {
-			case ROTATE_MODE: {
-				rotateIndex = getPolyIndex(rotateIndex);
-			} break;
-
-			case REUSE_MODE: {
-				bool reuse = false;
-				for (int i = 0; i < 4; i++) {
-					if (notes[i] == note) {
-						rotateIndex = i;
-						reuse = true;
-						break;
-					}
-				}
-				if (!reuse)
-					rotateIndex = getPolyIndex(rotateIndex);
-			} break;
-
-			case RESET_MODE: {
-				rotateIndex = getPolyIndex(-1);
-			} break;
-
-			case REASSIGN_MODE: {
-				cachedNotes.push_back(note);
-				rotateIndex = getPolyIndex(-1);
-			} break;
-
-			case UNISON_MODE: {
-				cachedNotes.push_back(note);
-				for (int i = 0; i < 4; i++) {
-					notes[i] = note;
-					gates[i] = true;
-					pedalgates[i] = pedal;
-					// reTrigger[i].trigger(1e-3);
-				}
-				return;
-			} break;
+			voices.polyMode = (VoiceAllocator::PolyMode) json_integer_value(polyModeJ);
 
-			default: break;
-		}
-		// Set notes and gates
-		// if (gates[rotateIndex] || pedalgates[rotateIndex])
-		// 	reTrigger[rotateIndex].trigger(1e-3);
-		notes[rotateIndex] = note;
-		gates[rotateIndex] = true;
-		pedalgates[rotateIndex] = pedal;
+		json_t *polyOutputsJ = json_object_get(rootJ, "polyOutputs");
+		if (polyOutputsJ)
+			polyOutputs = json_is_true(polyOutputsJ);
 	}
 
-	void releaseNote(uint8_t note) {
-		// Remove the note
-		auto it = std::find(cachedNotes.begin(), cachedNotes.end(), note);
-		if (it != cachedNotes.end())
-			cachedNotes.erase(it);
-
-		switch (polyMode) {
-			case REASSIGN_MODE: {
-				for (int i = 0; i < 4; i++) {
-					if (i < (int) cachedNotes.size()) {
-						if (!pedalgates[i])
-							notes[i] = cachedNotes[i];
-						pedalgates[i] = pedal;
-					}
-					else {
-						gates[i] = false;
-					}
-				}
-			} break;
-
-			case UNISON_MODE: {
-				if (!cachedNotes.empty()) {
-					uint8_t backnote = cachedNotes.back();
-					for (int i = 0; i < 4; i++) {
-						notes[i] = backnote;
-						gates[i] = true;
-					}
-				}
-				else {
-					for (int i = 0; i < 4; i++) {
-						gates[i] = false;
-					}
-				}
-			} break;
-
-			// default ROTATE_MODE REUSE_MODE RESET_MODE
-			default: {
-				for (int i = 0; i < 4; i++) {
-					if (notes[i] == note) {
-						if (pedalgates[i]) {
-							gates[i] = false;
-						}
-						else if (!cachedNotes.empty()) {
-							notes[i] = cachedNotes.back();
-							cachedNotes.pop_back();
-						}
-						else {
-							gates[i] = false;
-						}
-					}
-				}
-			} break;
-		}
-	}
-
-	void pressPedal() {
-		pedal = true;
-		for (int i = 0; i < 4; i++) {
-			pedalgates[i] = gates[i];
-		}
-	}
-
-	void releasePedal() {
-		pedal = false;
-		// When pedal is off, recover notes for pressed keys (if any) after they were already being "cycled" out by pedal-sustained notes.
-		for (int i = 0; i < 4; i++) {
-			pedalgates[i] = false;
-			if (!cachedNotes.empty()) {
-				if (polyMode < REASSIGN_MODE) {
-					notes[i] = cachedNotes.back();
-					cachedNotes.pop_back();
-					gates[i] = true;
-				}
-			}
-		}
-		if (polyMode == REASSIGN_MODE) {
-			for (int i = 0; i < 4; i++) {
-				if (i < (int) cachedNotes.size()) {
-					notes[i] = cachedNotes[i];
-					gates[i] = true;
-				}
-				else {
-					gates[i] = false;
-				}
-			}
-		}
+	void onReset() override {
+		voices.reset();
 	}
 
 	void step() override {
@@ -247,29 +70,39 @@ struct QuadMIDIToCVInterface : Module {
 		}
 
 		for (int i = 0; i < 4; i++) {
-			uint8_t lastNote = notes[i];
-			uint8_t lastGate = (gates[i] || pedalgates[i]);
+			uint8_t lastNote = voices.notes[i];
+			uint8_t lastGate = voices.getGate(i);
 			outputs[CV_OUTPUT + i].value = (lastNote - 60) / 12.f;
 			outputs[GATE_OUTPUT + i].value = lastGate ? 10.f : 0.f;
 			outputs[VELOCITY_OUTPUT + i].value = rescale(noteData[lastNote].velocity, 0, 127, 0.f, 10.f);
 			outputs[AFTERTOUCH_OUTPUT + i].value = rescale(noteData[lastNote].aftertouch, 0, 127, 0.f, 10.f);
 		}
+
+		// Channel 0 is the first voice, so monophonic modules see no difference
+		for (int id : {CV_OUTPUT, GATE_OUTPUT, VELOCITY_OUTPUT, AFTERTOUCH_OUTPUT}) {
+			outputs[id].setChannels(polyOutputs ? 4 : 1);
+			if (polyOutputs) {
+				for (int i = 1; i < 4; i++) {
+					outputs[id].setVoltage(outputs[id + i].value, i);
+				}
+			}
+		}
 	}
 
 	void processMessage(MidiMessage msg) {
 		switch (msg.status()) {
 			// note off
 			case 0x8: {
-				releaseNote(msg.note());
+				voices.releaseNote(msg.note());
 			} break;
 			// note on
 			case 0x9: {
 				if (msg.value() > 0) {
 					noteData[msg.note()].velocity = msg.value();
-					pressNote(msg.note());
+					voices.pressNote(msg.note());
 				}
 				else {
-					releaseNote(msg.note());
+					voices.releaseNote(msg.note());
 				}
 			} break;
 			// channel aftertouch
@@ -289,9 +122,9 @@ struct QuadMIDIToCVInterface : Module {
 			// sustain
 			case 0x40: {
 				if (msg.value() >= 64)
-					pressPedal();
+					voices.pressPedal();
 				else
-					releasePedal();
+					voices.releasePedal();
 			} break;
 			default: break;
 		}
@@ -336,28 +169,42 @@ struct QuadMIDIToCVInterfaceWidget : ModuleWidget {
 
 		struct PolyphonyItem : MenuItem {
 			QuadMIDIToCVInterface *module;
-			QuadMIDIToCVInterface::PolyMode polyMode;
+			VoiceAllocator::PolyMode polyMode;
 			void onAction(EventAction &e) override {
-				module->polyMode = polyMode;
+				module->voices.polyMode = polyMode;
 				module->onReset();
+				gStateGeneration++;
 			}
 		};
 
 		menu->addChild(MenuEntry::create());
 		menu->addChild(MenuLabel::create("Polyphony mode"));
 
-		auto addPolyphonyItem = [&](QuadMIDIToCVInterface::PolyMode polyMode, std::string name) {
-			PolyphonyItem *item = MenuItem::create<PolyphonyItem>(name, CHECKMARK(module->polyMode == polyMode));
+		auto addPolyphonyItem = [&](VoiceAllocator::PolyMode polyMode, std::string name) {
+			PolyphonyItem *item = MenuItem::create<PolyphonyItem>(name, CHECKMARK(module->voices.polyMode == polyMode));
 			item->module = module;
 			item->polyMode = polyMode;
 			menu->addChild(item);
 		};
 
-		addPolyphonyItem(QuadMIDIToCVInterface::RESET_MODE, "Reset");
-		addPolyphonyItem(QuadMIDIToCVInterface::ROTATE_MODE, "Rotate");
-		addPolyphonyItem(QuadMIDIToCVInterface::REUSE_MODE, "Reuse");
-		addPolyphonyItem(QuadMIDIToCVInterface::REASSIGN_MODE, "Reassign");
-		addPolyphonyItem(QuadMIDIToCVInterface::UNISON_MODE, "Unison");
+		addPolyphonyItem(VoiceAllocator::RESET_MODE, "Reset");
+		addPolyphonyItem(VoiceAllocator::ROTATE_MODE, "Rotate");
+		addPolyphonyItem(VoiceAllocator::REUSE_MODE, "Reuse");
+		addPolyphonyItem(VoiceAllocator::REASSIGN_MODE, "Reassign");
+		addPolyphonyItem(VoiceAllocator::UNISON_MODE, "Unison");
+
+		struct PolyOutputsItem : MenuItem {
+			QuadMIDIToCVInterface *module;
+			void onAction(EventAction &e) override {
+				module->polyOutputs ^= true;
+				gStateGeneration++;
+			}
+		};
+
+		menu->addChild(MenuEntry::create());
+		PolyOutputsItem *polyOutputsItem = MenuItem::create<PolyOutputsItem>("Polyphonic outputs on voice 1", CHECKMARK(module->polyOutputs));
+		polyOutputsItem->module = module;
+		menu->addChild(polyOutputsItem);
 	}
 };
 
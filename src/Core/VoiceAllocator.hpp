@@ -0,0 +1,325 @@
+#pragma once
+#include "engine.hpp"
+#include <bitset>
+
+
+using namespace rack;
+
+
+/** Ordered set of MIDI notes in fixed arrays, so adding and removing notes on the engine thread takes constant time and never allocates */
+struct NoteList {
+	static const int NONE = -1;
+	std::bitset<128> contained;
+	int8_t prevNotes[128];
+	int8_t nextNotes[128];
+	int first = NONE;
+	int last = NONE;
+	int count = 0;
+
+	void clear() {
+		contained.reset();
+		first = NONE;
+		last = NONE;
+		count = 0;
+	}
+	bool contains(int note) {
+		return 0 <= note && note < 128 && contained[note];
+	}
+	bool empty() {
+		return count == 0;
+	}
+	int size() {
+		return count;
+	}
+	uint8_t back() {
+		return last;
+	}
+	/** Returns the note after `note` in the list, or NONE */
+	int getNext(int note) {
+		return nextNotes[note];
+	}
+	/** Appends the note, moving it to the back if it is already in the list */
+	void push_back(int note) {
+		if (!(0 <= note && note < 128))
+			return;
+		remove(note);
+		prevNotes[note] = last;
+		nextNotes[note] = NONE;
+		if (last != NONE)
+			nextNotes[last] = note;
+		else
+			first = note;
+		last = note;
+		contained[note] = true;
+		count++;
+	}
+	void remove(int note) {
+		if (!contains(note))
+			return;
+		int prev = prevNotes[note];
+		int next = nextNotes[note];
+		if (prev != NONE)
+			nextNotes[prev] = next;
+		else
+			first = next;
+		if (next != NONE)
+			prevNotes[next] = prev;
+		else
+			last = prev;
+		contained[note] = false;
+		count--;
+	}
+	void pop_back() {
+		if (last != NONE)
+			remove(last);
+	}
+};
+
+
+/** Sequence of MIDI notes in a fixed array, so it never allocates
+Unlike NoteList, a note may appear more than once, which VoiceAllocator relies on to behave like the std::vector it replaced.
+If the array is full, the oldest note is dropped.
+*/
+struct NoteStack {
+	static const int CAPACITY = 128;
+	uint8_t notes[CAPACITY];
+	int count = 0;
+
+	void clear() {
+		count = 0;
+	}
+	bool empty() {
+		return count == 0;
+	}
+	int size() {
+		return count;
+	}
+	uint8_t operator[](int i) {
+		return notes[i];
+	}
+	uint8_t back() {
+		return notes[count - 1];
+	}
+	void push_back(uint8_t note) {
+		if (count == CAPACITY) {
+			memmove(&notes[0], &notes[1], CAPACITY - 1);
+			count--;
+		}
+		notes[count++] = note;
+	}
+	/** Removes the oldest occurrence of the note */
+	void remove(uint8_t note) {
+		for (int i = 0; i < count; i++) {
+			if (notes[i] == note) {
+				memmove(&notes[i], &notes[i + 1], count - i - 1);
+				count--;
+				return;
+			}
+		}
+	}
+	void pop_back() {
+		if (count > 0)
+			count--;
+	}
+};
+
+
+/** Assigns MIDI notes to a fixed number of voices, with the same poly modes and sustain pedal handling for every Core MIDI module */
+struct VoiceAllocator {
+	enum PolyMode {
+		ROTATE_MODE,
+		REUSE_MODE,
+		RESET_MODE,
+		REASSIGN_MODE,
+		UNISON_MODE,
+		NUM_MODES
+	};
+	PolyMode polyMode = RESET_MODE;
+	/** Number of voices, up to PORT_MAX_CHANNELS */
+	int channels;
+
+	uint8_t notes[PORT_MAX_CHANNELS];
+	bool gates[PORT_MAX_CHANNELS];
+	/** Set to the gate when the pedal is pressed, or when a note is pressed while the pedal is held */
+	bool pedalgates[PORT_MAX_CHANNELS];
+	bool pedal;
+	/** UNISON_MODE and REASSIGN_MODE cache all held notes. The other modes cache notes stolen by newer notes. */
+	NoteStack cachedNotes;
+	int rotateIndex;
+	int stealIndex;
+
+	VoiceAllocator(int channels = 4) {
+		this->channels = clamp(channels, 1, PORT_MAX_CHANNELS);
+		reset();
+	}
+
+	void reset() {
+		for (int i = 0; i < PORT_MAX_CHANNELS; i++) {
+			notes[i] = 60;
+			gates[i] = false;
+			pedalgates[i] = false;
+		}
+		pedal = false;
+		rotateIndex = -1;
+		stealIndex = 0;
+		cachedNotes.clear();
+	}
+
+	bool getGate(int i) {
+		return gates[i] || pedalgates[i];
+	}
+
+	int getPolyIndex(int nowIndex) {
+		for (int i = 0; i < channels; i++) {
+			nowIndex++;
+			if (nowIndex >= channels)
+				nowIndex = 0;
+			if (!getGate(nowIndex)) {
+				stealIndex = nowIndex;
+				return nowIndex;
+			}
+		}
+		// All taken = steal (stealIndex always rotates)
+		stealIndex++;
+		if (stealIndex >= channels)
+			stealIndex = 0;
+		if ((polyMode < REASSIGN_MODE) && (gates[stealIndex]))
+			cachedNotes.push_back(notes[stealIndex]);
+		return stealIndex;
+	}
+
+	void pressNote(uint8_t note) {
+		switch (polyMode) {
+			case ROTATE_MODE: {
+				rotateIndex = getPolyIndex(rotateIndex);
+			} break;
+
+			case REUSE_MODE: {
+				bool reuse = false;
+				for (int i = 0; i < channels; i++) {
+					if (notes[i] == note) {
+						rotateIndex = i;
+						reuse = true;
+						break;
+					}
+				}
+				if (!reuse)
+					rotateIndex = getPolyIndex(rotateIndex);
+			} break;
+
+			case RESET_MODE: {
+				rotateIndex = getPolyIndex(-1);
+			} break;
+
+			case REASSIGN_MODE: {
+				cachedNotes.push_back(note);
+				rotateIndex = getPolyIndex(-1);
+			} break;
+
+			case UNISON_MODE: {
+				cachedNotes.push_back(note);
+				for (int i = 0; i < channels; i++) {
+					notes[i] = note;
+					gates[i] = true;
+					pedalgates[i] = pedal;
+				}
+				return;
+			} break;
+
+			default: break;
+		}
+		notes[rotateIndex] = note;
+		gates[rotateIndex] = true;
+		pedalgates[rotateIndex] = pedal;
+	}
+
+	/** Assigns the oldest held notes to the voices in order */
+	void reassignNotes() {
+		for (int i = 0; i < channels; i++) {
+			if (i < cachedNotes.size()) {
+				if (!pedalgates[i])
+					notes[i] = cachedNotes[i];
+				pedalgates[i] = pedal;
+			}
+			else {
+				gates[i] = false;
+			}
+		}
+	}
+
+	void releaseNote(uint8_t note) {
+		cachedNotes.remove(note);
+
+		switch (polyMode) {
+			case REASSIGN_MODE: {
+				reassignNotes();
+			} break;
+
+			case UNISON_MODE: {
+				if (!cachedNotes.empty()) {
+					uint8_t backnote = cachedNotes.back();
+					for (int i = 0; i < channels; i++) {
+						notes[i] = backnote;
+						gates[i] = true;
+					}
+				}
+				else {
+					for (int i = 0; i < channels; i++) {
+						gates[i] = false;
+					}
+				}
+			} break;
+
+			// default ROTATE_MODE REUSE_MODE RESET_MODE
+			default: {
+				for (int i = 0; i < channels; i++) {
+					if (notes[i] == note) {
+						if (pedalgates[i]) {
+							gates[i] = false;
+						}
+						else if (!cachedNotes.empty()) {
+							notes[i] = cachedNotes.back();
+							cachedNotes.pop_back();
+						}
+						else {
+							gates[i] = false;
+						}
+					}
+				}
+			} break;
+		}
+	}
+
+	void pressPedal() {
+		pedal = true;
+		for (int i = 0; i < channels; i++) {
+			pedalgates[i] = gates[i];
+		}
+	}
+
+	void releasePedal() {
+		pedal = false;
+		// When pedal is off, recover notes for pressed keys (if any) after they were already being "cycled" out by pedal-sustained notes.
+		for (int i = 0; i < channels; i++) {
+			pedalgates[i] = false;
+			if (!cachedNotes.empty()) {
+				if (polyMode < REASSIGN_MODE) {
+					notes[i] = cachedNotes.back();
+					cachedNotes.pop_back();
+					gates[i] = true;
+				}
+			}
+		}
+		if (polyMode == REASSIGN_MODE) {
+			for (int i = 0; i < channels; i++) {
+				if (i < cachedNotes.size()) {
+					notes[i] = cachedNotes[i];
+					gates[i] = true;
+				}
+				else {
+					gates[i] = false;
+				}
+			}
+		}
+	}
+};
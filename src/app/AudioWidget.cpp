@@ -1,5 +1,6 @@
 #include "app.hpp"
 #include "audio.hpp"
+#include "engine.hpp"
 
 
 namespace rack {
@@ -10,6 +11,7 @@ struct AudioDriverItem : MenuItem {
 	int driver;
 	void onAction(EventAction &e) override {
 		audioIO->setDriver(driver);
+		gStateGeneration++;
 	}
 };
 
@@ -39,6 +41,7 @@ struct AudioDeviceItem : MenuItem {
 	int offset;
 	void onAction(EventAction &e) override {
 		audioIO->setDevice(device, offset);
+		gStateGeneration++;
 	}
 };
 
@@ -90,6 +93,7 @@ struct AudioSampleRateItem : MenuItem {
 	int sampleRate;
 	void onAction(EventAction &e) override {
 		audioIO->setSampleRate(sampleRate);
+		gStateGeneration++;
 	}
 };
 
@@ -122,6 +126,7 @@ struct AudioBlockSizeItem : MenuItem {
 	int blockSize;
 	void onAction(EventAction &e) override {
 		audioIO->setBlockSize(blockSize);
+		gStateGeneration++;
 	}
 };
 
@@ -38,7 +38,8 @@ LedDisplayChoice::LedDisplayChoice() {
 }
 
 void LedDisplayChoice::draw(NVGcontext *vg) {
-	nvgScissor(vg, 0, 0, box.size.x, box.size.y);
+	nvgSave(vg);
+	nvgIntersectScissor(vg, 0, 0, box.size.x, box.size.y);
 
 	if (font->handle >= 0) {
 		nvgFillColor(vg, color);
@@ -49,7 +50,7 @@ void LedDisplayChoice::draw(NVGcontext *vg) {
 		nvgText(vg, textOffset.x, textOffset.y, text.c_str(), NULL);
 	}
 
-	nvgResetScissor(vg);
+	nvgRestore(vg);
 }
 
 void LedDisplayChoice::onMouseDown(EventMouseDown &e) {
@@ -70,7 +71,8 @@ LedDisplayTextField::LedDisplayTextField() {
 
 
 void LedDisplayTextField::draw(NVGcontext *vg) {
-	nvgScissor(vg, 0, 0, box.size.x, box.size.y);
+	nvgSave(vg);
+	nvgIntersectScissor(vg, 0, 0, box.size.x, box.size.y);
 
 	// Background
 	nvgBeginPath(vg);
@@ -93,7 +95,7 @@ void LedDisplayTextField::draw(NVGcontext *vg) {
 		bndSetFont(gGuiFont->handle);
 	}
 
-	nvgResetScissor(vg);
+	nvgRestore(vg);
 }
 
 int LedDisplayTextField::getTextPosition(Vec mousePos) {
@@ -1,5 +1,6 @@
 #include "app.hpp"
 #include "midi.hpp"
+#include "engine.hpp"
 
 
 namespace rack {
@@ -10,6 +11,7 @@ struct MidiDriverItem : MenuItem {
 	int driverId;
 	void onAction(EventAction &e) override {
 		midiIO->setDriverId(driverId);
+		gStateGeneration++;
 	}
 };
 
@@ -44,6 +46,7 @@ struct MidiDeviceItem : MenuItem {
 	int deviceId;
 	void onAction(EventAction &e) override {
 		midiIO->setDeviceId(deviceId);
+		gStateGeneration++;
 	}
 };
 
@@ -86,6 +89,7 @@ struct MidiChannelItem : MenuItem {
 	int channel;
 	void onAction(EventAction &e) override {
 		midiIO->channel = channel;
+		gStateGeneration++;
 	}
 };
 
@@ -2,6 +2,7 @@
 #include "plugin.hpp"
 #include "window.hpp"
 #include <set>
+#include <unordered_map>
 #include <algorithm>
 
 
@@ -23,22 +24,143 @@ bool isMatch(std::string s, std::string search) {
 	return (s.find(search) != std::string::npos);
 }
 
+/** Inverted index from character trigrams to models, so a search only verifies the models which contain all of its trigrams
+Built once, the first time the module browser searches.
+*/
+struct SearchIndex {
+	struct Entry {
+		Model *model;
+		/** Lowercase plugin slug, author, name, model slug, and tag names, separated by spaces */
+		std::string text;
+		/** Lowercase name, for ranking */
+		std::string name;
+	};
+	/** In plugin and model order */
+	std::vector<Entry> entries;
+	std::unordered_map<Model*, int> entryIds;
+	/** Sorted entry ids containing each trigram */
+	std::unordered_map<uint32_t, std::vector<int>> trigrams;
+	bool built = false;
+
+	static uint32_t getTrigram(const std::string &s, size_t i) {
+		return ((uint32_t) (uint8_t) s[i] << 16) | ((uint32_t) (uint8_t) s[i + 1] << 8) | (uint32_t) (uint8_t) s[i + 2];
+	}
+
+	void build() {
+		for (Plugin *plugin : gPlugins) {
+			for (Model *model : plugin->models) {
+				Entry entry;
+				entry.model = model;
+				entry.text = model->plugin->slug + " " + model->author + " " + model->name + " " + model->slug;
+				for (ModelTag tag : model->tags) {
+					entry.text += " ";
+					entry.text += gTagNames[tag];
+				}
+				entry.text = stringLowercase(entry.text);
+				entry.name = stringLowercase(model->name);
+
+				int id = entries.size();
+				for (size_t i = 0; i + 3 <= entry.text.size(); i++) {
+					std::vector<int> &ids = trigrams[getTrigram(entry.text, i)];
+					if (ids.empty() || ids.back() != id)
+						ids.push_back(id);
+				}
+				entryIds[model] = id;
+				entries.push_back(entry);
+			}
+		}
+		built = true;
+	}
+
+	/** Returns the sorted ids of entries containing `search`, which must be lowercase
+	If `candidates` is given, only those entries are checked.
+	*/
+	std::vector<int> find(const std::string &search, const std::vector<int> *candidates) {
+		// Narrow the candidates to the rarest trigram of the search
+		for (size_t i = 0; i + 3 <= search.size(); i++) {
+			auto it = trigrams.find(getTrigram(search, i));
+			if (it == trigrams.end())
+				return std::vector<int>();
+			if (!candidates || it->second.size() < candidates->size())
+				candidates = &it->second;
+		}
+
+		std::vector<int> ids;
+		if (candidates) {
+			for (int id : *candidates) {
+				if (entries[id].text.find(search) != std::string::npos)
+					ids.push_back(id);
+			}
+		}
+		else {
+			for (int id = 0; id < (int) entries.size(); id++) {
+				if (entries[id].text.find(search) != std::string::npos)
+					ids.push_back(id);
+			}
+		}
+		return ids;
+	}
+
+	/** Lower is better: the name starts with the search, then the name contains it, then anything else does */
+	int getRank(int id, const std::string &search) {
+		size_t pos = entries[id].name.find(search);
+		if (pos == 0)
+			return 0;
+		if (pos != std::string::npos)
+			return 1;
+		return 2;
+	}
+};
+
+static SearchIndex sSearchIndex;
+/** The last search and its matches, so typing more characters only re-checks those matches */
+static std::string sLastSearch;
+static std::vector<int> sLastMatches;
+
+/** Returns the models matching `search`, best matches first */
+static std::vector<Model*> searchModels(std::string search) {
+	if (!sSearchIndex.built) {
+		sSearchIndex.build();
+		sLastSearch = "";
+		sLastMatches.clear();
+	}
+	search = stringLowercase(search);
+
+	std::vector<int> matches;
+	if (search.empty()) {
+		for (int id = 0; id < (int) sSearchIndex.entries.size(); id++) {
+			matches.push_back(id);
+		}
+	}
+	else {
+		// Anything containing the new search also contains the last one
+		bool incremental = !sLastSearch.empty() && search.find(sLastSearch) != std::string::npos;
+		matches = sSearchIndex.find(search, incremental ? &sLastMatches : NULL);
+	}
+	sLastSearch = search;
+	sLastMatches = matches;
+
+	if (!search.empty()) {
+		std::stable_sort(matches.begin(), matches.end(), [&](int a, int b) {
+			return sSearchIndex.getRank(a, search) < sSearchIndex.getRank(b, search);
+		});
+	}
+	std::vector<Model*> models;
+	for (int id : matches) {
+		models.push_back(sSearchIndex.entries[id].model);
+	}
+	return models;
+}
+
 static bool isModelMatch(Model *model, std::string search) {
 	if (search.empty())
 		return true;
-	std::string s;
-	s += model->plugin->slug;
-	s += " ";
-	s += model->author;
-	s += " ";
-	s += model->name;
-	s += " ";
-	s += model->slug;
-	for (ModelTag tag : model->tags) {
-		s += " ";
-		s += gTagNames[tag];
-	}
-	return isMatch(s, search);
+	if (!sSearchIndex.built)
+		sSearchIndex.build();
+	auto it = sSearchIndex.entryIds.find(model);
+	if (it == sSearchIndex.entryIds.end())
+		return false;
+	return sSearchIndex.entries[it->second].text.find(stringLowercase(search)) != std::string::npos;
 }
 
 
@@ -49,18 +171,20 @@ struct FavoriteRadioButton : RadioButton {
 };
 
 
+/** Items are recycled by BrowserList, so their children are created once and their setters only update them */
 struct SeparatorItem : OpaqueWidget {
+	Label *label;
+
 	SeparatorItem() {
 		box.size.y = 2*BND_WIDGET_HEIGHT + 2*itemMargin;
+		label = Widget::create<Label>(Vec(0, 12 + itemMargin));
+		label->fontSize = 20;
+		label->color.a *= 0.5;
+		addChild(label);
 	}
 
 	void setText(std::string text) {
-		clearChildren();
-		Label *label = Widget::create<Label>(Vec(0, 12 + itemMargin));
 		label->text = text;
-		label->fontSize = 20;
-		label->color.a *= 0.5;
-		addChild(label);
 	}
 };
 
@@ -99,40 +223,41 @@ struct BrowserListItem : OpaqueWidget {
 
 
 struct ModelItem : BrowserListItem {
-	Model *model;
-	Label *pluginLabel = NULL;
-
-	void setModel(Model *model) {
-		clearChildren();
-		assert(model);
-		this->model = model;
+	Model *model = NULL;
+	FavoriteRadioButton *favoriteButton;
+	Label *nameLabel;
+	Label *pluginLabel;
 
-		FavoriteRadioButton *favoriteButton = Widget::create<FavoriteRadioButton>(Vec(8, itemMargin));
+	ModelItem() {
+		favoriteButton = Widget::create<FavoriteRadioButton>(Vec(8, itemMargin));
 		favoriteButton->box.size.x = 20;
 		favoriteButton->label = "★";
 		addChild(favoriteButton);
 
-		// Set favorite button initial state
-		auto it = sFavoriteModels.find(model);
-		if (it != sFavoriteModels.end())
-			favoriteButton->setValue(1);
-		favoriteButton->model = model;
-
-		Label *nameLabel = Widget::create<Label>(favoriteButton->box.getTopRight());
-		nameLabel->text = model->name;
+		nameLabel = Widget::create<Label>(favoriteButton->box.getTopRight());
 		addChild(nameLabel);
 
 		pluginLabel = Widget::create<Label>(Vec(0, itemMargin));
 		pluginLabel->alignment = Label::RIGHT_ALIGNMENT;
-		pluginLabel->text = model->plugin->slug + " " + model->plugin->version;
 		pluginLabel->color.a = 0.5;
 		addChild(pluginLabel);
 	}
 
+	void setModel(Model *model) {
+		assert(model);
+		this->model = model;
+
+		// Set favorite button state
+		favoriteButton->setValue(sFavoriteModels.find(model) != sFavoriteModels.end() ? 1 : 0);
+		favoriteButton->model = model;
+
+		nameLabel->text = model->name;
+		pluginLabel->text = model->plugin->slug + " " + model->plugin->version;
+	}
+
 	void step() override {
 		BrowserListItem::step();
-		if (pluginLabel)
-			pluginLabel->box.size.x = box.size.x - BND_SCROLLBAR_WIDTH;
+		pluginLabel->box.size.x = box.size.x - BND_SCROLLBAR_WIDTH;
 	}
 
 	void onAction(EventAction &e) override {
@@ -149,16 +274,19 @@ struct ModelItem : BrowserListItem {
 
 struct AuthorItem : BrowserListItem {
 	std::string author;
+	Label *authorLabel;
+
+	AuthorItem() {
+		authorLabel = Widget::create<Label>(Vec(0, 0 + itemMargin));
+		addChild(authorLabel);
+	}
 
 	void setAuthor(std::string author) {
-		clearChildren();
 		this->author = author;
-		Label *authorLabel = Widget::create<Label>(Vec(0, 0 + itemMargin));
 		if (author.empty())
 			authorLabel->text = "Show all modules";
 		else
 			authorLabel->text = author;
-		addChild(authorLabel);
 	}
 
 	void onAction(EventAction &e) override;
@@ -167,16 +295,19 @@ struct AuthorItem : BrowserListItem {
 
 struct TagItem : BrowserListItem {
 	ModelTag tag;
+	Label *tagLabel;
+
+	TagItem() {
+		tagLabel = Widget::create<Label>(Vec(0, 0 + itemMargin));
+		addChild(tagLabel);
+	}
 
 	void setTag(ModelTag tag) {
-		clearChildren();
 		this->tag = tag;
-		Label *tagLabel = Widget::create<Label>(Vec(0, 0 + itemMargin));
 		if (tag == NO_TAG)
 			tagLabel->text = "Show all tags";
 		else
 			tagLabel->text = gTagNames[tag];
-		addChild(tagLabel);
 	}
 
 	void onAction(EventAction &e) override;
@@ -194,21 +325,91 @@ struct ClearFilterItem : BrowserListItem {
 };
 
 
-struct BrowserList : List {
+/** Description of a BrowserList row, from which its widget is created when the row is near the visible area */
+struct BrowserRow {
+	enum Type {
+		SEPARATOR,
+		MODEL,
+		AUTHOR,
+		TAG,
+		CLEAR_FILTER,
+	};
+	Type type;
+	std::string text;
+	Model *model = NULL;
+	ModelTag tag = NO_TAG;
+};
+
+
+struct BrowserList : VirtualList {
+	std::vector<BrowserRow> rows;
+	/** Rows which can be selected, i.e. everything except separators */
+	std::vector<int> itemRows;
+	/** Index into itemRows */
 	int selected = 0;
 
+	void setRows(const std::vector<BrowserRow> &rows) {
+		this->rows = rows;
+		rowCount = rows.size();
+		itemRows.clear();
+		for (int row = 0; row < rowCount; row++) {
+			if (rows[row].type != BrowserRow::SEPARATOR)
+				itemRows.push_back(row);
+		}
+		selected = 0;
+		refresh();
+	}
+
+	float getRowHeight(int row) override {
+		if (rows[row].type == BrowserRow::SEPARATOR)
+			return 2*BND_WIDGET_HEIGHT + 2*itemMargin;
+		return BND_WIDGET_HEIGHT + 2*itemMargin;
+	}
+
+	int getRowType(int row) override {
+		return rows[row].type;
+	}
+
+	Widget *createRow(int row, Widget *recycled) override {
+		const BrowserRow &r = rows[row];
+		switch (r.type) {
+			case BrowserRow::SEPARATOR: {
+				SeparatorItem *item = recycled ? dynamic_cast<SeparatorItem*>(recycled) : new SeparatorItem();
+				item->setText(r.text);
+				return item;
+			} break;
+			case BrowserRow::MODEL: {
+				ModelItem *item = recycled ? dynamic_cast<ModelItem*>(recycled) : new ModelItem();
+				item->setModel(r.model);
+				return item;
+			} break;
+			case BrowserRow::AUTHOR: {
+				AuthorItem *item = recycled ? dynamic_cast<AuthorItem*>(recycled) : new AuthorItem();
+				item->setAuthor(r.text);
+				return item;
+			} break;
+			case BrowserRow::TAG: {
+				TagItem *item = recycled ? dynamic_cast<TagItem*>(recycled) : new TagItem();
+				item->setTag(r.tag);
+				return item;
+			} break;
+			case BrowserRow::CLEAR_FILTER: {
+				return recycled ? recycled : new ClearFilterItem();
+			} break;
+		}
+		return NULL;
+	}
+
 	void step() override {
 		incrementSelection(0);
-		// Find and select item
-		int i = 0;
-		for (Widget *child : children) {
-			BrowserListItem *item = dynamic_cast<BrowserListItem*>(child);
-			if (item) {
-				item->selected = (i == selected);
-				i++;
-			}
+		VirtualList::step();
+
+		int selectedRow = itemRows.empty() ? -1 : itemRows[selected];
+		for (auto &pair : rowWidgets) {
+			BrowserListItem *item = dynamic_cast<BrowserListItem*>(pair.second.widget);
+			if (item)
+				item->selected = (pair.first == selectedRow);
 		}
-		List::step();
 	}
 
 	void incrementSelection(int delta) {
@@ -217,51 +418,26 @@ struct BrowserList : List {
 	}
 
 	int countItems() {
-		int n = 0;
-		for (Widget *child : children) {
-			BrowserListItem *item = dynamic_cast<BrowserListItem*>(child);
-			if (item) {
-				n++;
-			}
-		}
-		return n;
+		return itemRows.size();
 	}
 
 	void selectItem(Widget *w) {
-		int i = 0;
-		for (Widget *child : children) {
-			BrowserListItem *item = dynamic_cast<BrowserListItem*>(child);
-			if (item) {
-				if (child == w) {
-					selected = i;
-					break;
-				}
-				i++;
-			}
-		}
+		int row = getWidgetRow(w);
+		auto it = std::find(itemRows.begin(), itemRows.end(), row);
+		if (it != itemRows.end())
+			selected = it - itemRows.begin();
 	}
 
 	BrowserListItem *getSelectedItem() {
-		int i = 0;
-		for (Widget *child : children) {
-			BrowserListItem *item = dynamic_cast<BrowserListItem*>(child);
-			if (item) {
-				if (i == selected) {
-					return item;
-				}
-				i++;
-			}
-		}
-		return NULL;
+		if (itemRows.empty())
+			return NULL;
+		return dynamic_cast<BrowserListItem*>(getRowWidget(itemRows[selected]));
 	}
 
 	void scrollSelected() {
-		BrowserListItem *item = getSelectedItem();
-		if (item) {
-			ScrollWidget *parentScroll = dynamic_cast<ScrollWidget*>(parent->parent);
-			if (parentScroll)
-				parentScroll->scrollTo(item->box);
-		}
+		if (itemRows.empty())
+			return;
+		scrollToRow(itemRows[selected]);
 	}
 };
 
@@ -343,82 +519,79 @@ struct ModuleBrowser : OpaqueWidget {
 
 	void refreshSearch() {
 		std::string search = searchField->text;
-		moduleList->clearChildren();
-		moduleList->selected = 0;
+		std::string lowercaseSearch = stringLowercase(search);
+		std::vector<BrowserRow> rows;
+		auto addSeparator = [&](std::string text) {
+			BrowserRow row;
+			row.type = BrowserRow::SEPARATOR;
+			row.text = text;
+			rows.push_back(row);
+		};
+		auto addModel = [&](Model *model) {
+			BrowserRow row;
+			row.type = BrowserRow::MODEL;
+			row.model = model;
+			rows.push_back(row);
+		};
 		bool filterPage = !(sAuthorFilter.empty() && sTagFilter == NO_TAG);
 
 		if (!filterPage) {
 			// Favorites
 			if (!sFavoriteModels.empty()) {
-				SeparatorItem *item = new SeparatorItem();
-				item->setText("Favorites");
-				moduleList->addChild(item);
+				addSeparator("Favorites");
 			}
 			for (Model *model : sFavoriteModels) {
 				if (isModelFiltered(model) && isModelMatch(model, search)) {
-					ModelItem *item = new ModelItem();
-					item->setModel(model);
-					moduleList->addChild(item);
+					addModel(model);
 				}
 			}
 			// Author items
-			{
-				SeparatorItem *item = new SeparatorItem();
-				item->setText("Authors");
-				moduleList->addChild(item);
-			}
+			addSeparator("Authors");
 			for (std::string author : availableAuthors) {
-				if (isMatch(author, search)) {
-					AuthorItem *item = new AuthorItem();
-					item->setAuthor(author);
-					moduleList->addChild(item);
+				if (stringLowercase(author).find(lowercaseSearch) != std::string::npos) {
+					BrowserRow row;
+					row.type = BrowserRow::AUTHOR;
+					row.text = author;
+					rows.push_back(row);
 				}
 			}
 			// Tag items
-			{
-				SeparatorItem *item = new SeparatorItem();
-				item->setText("Tags");
-				moduleList->addChild(item);
-			}
+			addSeparator("Tags");
 			for (ModelTag tag : availableTags) {
-				if (isMatch(gTagNames[tag], search)) {
-					TagItem *item = new TagItem();
-					item->setTag(tag);
-					moduleList->addChild(item);
+				if (stringLowercase(gTagNames[tag]).find(lowercaseSearch) != std::string::npos) {
+					BrowserRow row;
+					row.type = BrowserRow::TAG;
+					row.tag = tag;
+					rows.push_back(row);
 				}
 			}
 		}
 		else {
 			// Clear filter
-			ClearFilterItem *item = new ClearFilterItem();
-			moduleList->addChild(item);
+			BrowserRow row;
+			row.type = BrowserRow::CLEAR_FILTER;
+			rows.push_back(row);
 		}
 
 		if (filterPage || !search.empty()) {
 			if (!search.empty()) {
-				SeparatorItem *item = new SeparatorItem();
-				item->setText("Modules");
-				moduleList->addChild(item);
+				addSeparator("Modules");
 			}
 			else if (filterPage) {
-				SeparatorItem *item = new SeparatorItem();
 				if (!sAuthorFilter.empty())
-					item->setText(sAuthorFilter);
+					addSeparator(sAuthorFilter);
 				else if (sTagFilter != NO_TAG)
-					item->setText("Tag: " + gTagNames[sTagFilter]);
-				moduleList->addChild(item);
+					addSeparator("Tag: " + gTagNames[sTagFilter]);
 			}
 			// Modules
-			for (Plugin *plugin : gPlugins) {
-				for (Model *model : plugin->models) {
-					if (isModelFiltered(model) && isModelMatch(model, search)) {
-						ModelItem *item = new ModelItem();
-						item->setModel(model);
-						moduleList->addChild(item);
-					}
+			for (Model *model : searchModels(search)) {
+				if (isModelFiltered(model)) {
+					addModel(model);
 				}
 			}
 		}
+
+		moduleList->setRows(rows);
 	}
 
 	void step() override {
@@ -77,6 +77,9 @@ json_t *ModuleWidget::toJson() {
 		json_array_append_new(paramsJ, paramJ);
 	}
 	json_object_set_new(rootJ, "params", paramsJ);
+	// bypass
+	if (module && module->bypassed)
+		json_object_set_new(rootJ, "bypass", json_true());
 	// data
 	if (module) {
 		json_t *dataJ = module->toJson();
@@ -155,6 +158,11 @@ void ModuleWidget::fromJson(json_t *rootJ) {
 		}
 	}
 
+	// bypass
+	json_t *bypassJ = json_object_get(rootJ, "bypass");
+	if (bypassJ && module)
+		module->bypassed = json_is_true(bypassJ);
+
 	// data
 	json_t *dataJ = json_object_get(rootJ, "data");
 	if (dataJ && module) {
@@ -292,9 +300,18 @@ void ModuleWidget::randomize() {
 }
 
 void ModuleWidget::draw(NVGcontext *vg) {
-	nvgScissor(vg, 0, 0, box.size.x, box.size.y);
+	nvgSave(vg);
+	nvgIntersectScissor(vg, 0, 0, box.size.x, box.size.y);
 	Widget::draw(vg);
 
+	// Dim bypassed modules
+	if (module && module->bypassed) {
+		nvgBeginPath(vg);
+		nvgRect(vg, 0, 0, box.size.x, box.size.y);
+		nvgFillColor(vg, nvgRGBAf(0, 0, 0, 0.4));
+		nvgFill(vg);
+	}
+
 	// Power meter
 	if (module && gPowerMeter) {
 		nvgBeginPath(vg);
@@ -304,13 +321,15 @@ void ModuleWidget::draw(NVGcontext *vg) {
 		nvgFillColor(vg, nvgRGBAf(0, 0, 0, 0.5));
 		nvgFill(vg);
 
-		std::string cpuText = stringf("%.0f mS", module->cpuTime * 1000.f);
+		float cpuTime = 0.f;
+		module->snapshot.read(module->snapshot.cpuTimeOffset(), &cpuTime, 1);
+		std::string cpuText = stringf("%.0f mS", cpuTime * 1000.f);
 		nvgFontFaceId(vg, gGuiFont->handle);
 		nvgFontSize(vg, 12);
 		nvgFillColor(vg, nvgRGBf(1, 1, 1));
 		nvgText(vg, 10.0, box.size.y - 6.0, cpuText.c_str(), NULL);
 
-		float p = clamp(module->cpuTime, 0.f, 1.f);
+		float p = clamp(cpuTime, 0.f, 1.f);
 		nvgBeginPath(vg);
 		nvgRect(vg,
 			0, (1.f - p) * box.size.y,
@@ -319,7 +338,7 @@ void ModuleWidget::draw(NVGcontext *vg) {
 		nvgFill(vg);
 	}
 
-	nvgResetScissor(vg);
+	nvgRestore(vg);
 }
 
 void ModuleWidget::drawShadow(NVGcontext *vg) {
@@ -408,6 +427,16 @@ void ModuleWidget::onHoverKey(EventHoverKey &e) {
 				return;
 			}
 		} break;
+		case GLFW_KEY_E: {
+			if (windowIsModPressed() && !windowIsShiftPressed()) {
+				if (module) {
+					module->bypassed = !module->bypassed;
+					gStateGeneration++;
+				}
+				e.consumed = true;
+				return;
+			}
+		} break;
 	}
 
 	Widget::onHoverKey(e);
@@ -436,6 +465,14 @@ struct ModuleDisconnectItem : MenuItem {
 	}
 };
 
+struct ModuleBypassItem : MenuItem {
+	ModuleWidget *moduleWidget;
+	void onAction(EventAction &e) override {
+		moduleWidget->module->bypassed = !moduleWidget->module->bypassed;
+		gStateGeneration++;
+	}
+};
+
 struct ModuleResetItem : MenuItem {
 	ModuleWidget *moduleWidget;
 	void onAction(EventAction &e) override {
@@ -519,6 +556,14 @@ Menu *ModuleWidget::createContextMenu() {
 	disconnectItem->moduleWidget = this;
 	menu->addChild(disconnectItem);
 
+	if (module) {
+		ModuleBypassItem *bypassItem = new ModuleBypassItem();
+		bypassItem->text = "Bypass";
+		bypassItem->rightText = CHECKMARK(module->bypassed) + std::string(" " WINDOW_MOD_KEY_NAME "+E");
+		bypassItem->moduleWidget = this;
+		menu->addChild(bypassItem);
+	}
+
 	ModuleCloneItem *cloneItem = new ModuleCloneItem();
 	cloneItem->text = "Duplicate";
 	cloneItem->rightText = WINDOW_MOD_KEY_NAME "+D";
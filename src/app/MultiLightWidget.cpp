@@ -11,6 +11,10 @@ void MultiLightWidget::addBaseColor(NVGcolor baseColor) {
 
 void MultiLightWidget::setValues(const std::vector<float> &values) {
 	assert(values.size() == baseColors.size());
+	setValues(values.data());
+}
+
+void MultiLightWidget::setValues(const float *values) {
 	color = nvgRGBAf(0, 0, 0, 0);
 	for (size_t i = 0; i < baseColors.size(); i++) {
 		NVGcolor c = baseColors[i];
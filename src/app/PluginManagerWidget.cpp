@@ -53,6 +53,11 @@ struct SyncButton : Button {
 	/** Plugins have been updated */
 	bool completed = false;
 
+	SyncButton() {
+		// The notification circle appears when the update check finishes
+		alwaysDirty = true;
+	}
+
 	void step() override {
 		// Check for plugin update on first step()
 		if (!checked) {
@@ -189,10 +194,10 @@ PluginManagerWidget::PluginManagerWidget() {
 		downloadProgress->unit = "%";
 		downloadWidget->addChild(downloadProgress);
 
-		// Button *cancelButton = new CancelButton();
-		// cancelButton->box.size.x = 100;
-		// cancelButton->text = "Cancel";
-		// downloadWidget->addChild(cancelButton);
+		Button *cancelButton = new CancelButton();
+		cancelButton->box.size.x = 100;
+		cancelButton->text = "Cancel";
+		downloadWidget->addChild(cancelButton);
 
 		addChild(downloadWidget);
 	}
@@ -28,16 +28,11 @@ Port::~Port() {
 }
 
 void Port::step() {
-	std::vector<float> values(2);
-	if (type == INPUT) {
-		values[0] = module->inputs[portId].plugLights[0].getBrightness();
-		values[1] = module->inputs[portId].plugLights[1].getBrightness();
-	}
-	else {
-		values[0] = module->outputs[portId].plugLights[0].getBrightness();
-		values[1] = module->outputs[portId].plugLights[1].getBrightness();
-	}
-	plugLight->setValues(values);
+	ModuleSnapshot &snapshot = module->snapshot;
+	float values[2];
+	int offset = (type == INPUT) ? snapshot.inputPlugLightOffset(portId) : snapshot.outputPlugLightOffset(portId);
+	if (snapshot.read(offset, values, 2))
+		plugLight->setValues(values);
 }
 
 void Port::draw(NVGcontext *vg) {
@@ -116,7 +116,8 @@ void RackScene::onHoverKey(EventHoverKey &e) {
 void RackScene::onPathDrop(EventPathDrop &e) {
 	if (e.paths.size() >= 1) {
 		const std::string &firstPath = e.paths.front();
-		if (stringExtension(firstPath) == "vcv") {
+		std::string extension = stringExtension(firstPath);
+		if (extension == "vcv" || extension == "vcvb") {
 			gRackWidget->load(firstPath);
 			e.consumed = true;
 		}
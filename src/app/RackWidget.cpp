@@ -4,20 +4,163 @@
 #include "window.hpp"
 #include "settings.hpp"
 #include "asset.hpp"
+#include "binpatch.hpp"
 #include <map>
 #include <algorithm>
+#include <thread>
+#include <atomic>
 #include "osdialog.h"
 
 
 namespace rack {
 
 
+/** Value of gStateGeneration when the last autosave was started */
+static int autosaveStateGeneration = -1;
+static std::thread autosaveThread;
+static std::atomic<bool> isAutosaving(false);
+
+/** Writes to a temporary file and renames it over `filename`, so an interrupted write does not destroy the previous file
+Returns true if successful.
+*/
+static bool writeJson(json_t *rootJ, std::string filename) {
+	std::string tmpFilename = filename + ".tmp";
+	FILE *file = fopen(tmpFilename.c_str(), "w");
+	if (!file)
+		return false;
+	int err = json_dumpf(rootJ, file, JSON_INDENT(2) | JSON_REAL_PRECISION(9));
+	if (fclose(file) || err) {
+		remove(tmpFilename.c_str());
+		return false;
+	}
+#if ARCH_WIN
+	// rename() does not replace existing files on Windows
+	remove(filename.c_str());
+#endif
+	return !rename(tmpFilename.c_str(), filename.c_str());
+}
+
+static void autosaveWait() {
+	if (autosaveThread.joinable())
+		autosaveThread.join();
+}
+
+
 struct ModuleContainer : Widget {
+	/** Children intersecting each rack row, in z-order */
+	std::map<int, std::vector<Widget*>> rows;
+	bool rowsDirty = true;
+
+	static int getRow(float y) {
+		return (int) floorf(y / RACK_GRID_HEIGHT);
+	}
+
+	void updateRows() {
+		if (!rowsDirty)
+			return;
+		rows.clear();
+		for (Widget *child : children) {
+			int rowMin = getRow(child->box.pos.y);
+			int rowMax = max(rowMin, (int) ceilf((child->box.pos.y + child->box.size.y) / RACK_GRID_HEIGHT) - 1);
+			for (int row = rowMin; row <= rowMax; row++) {
+				rows[row].push_back(child);
+			}
+		}
+		rowsDirty = false;
+	}
+
+	/** Calls `f` for each child which might intersect the vertical span from `y` to `y + height` */
+	template <typename F>
+	void forEachChildInRows(float y, float height, F f) {
+		updateRows();
+		auto it = rows.lower_bound(getRow(y));
+		auto end = rows.upper_bound(max(getRow(y), (int) ceilf((y + height) / RACK_GRID_HEIGHT) - 1));
+		for (; it != end; it++) {
+			for (Widget *child : it->second) {
+				f(child);
+			}
+		}
+	}
+
+	/** Returns whether `box` overlaps any child other than `ignored` */
+	bool collides(Rect box, Widget *ignored) {
+		bool collision = false;
+		forEachChildInRows(box.pos.y, box.size.y, [&](Widget *child) {
+			if (child != ignored && box.intersects(child->box))
+				collision = true;
+		});
+		return collision;
+	}
+
+	/** Returns the grid column nearest to `x` in [xMin, xMax) where a box at height `y` with `size` does not overlap a child other than `ignored`, or -1 if there is none */
+	int findFreeColumn(int x, int xMin, int xMax, float y, Vec size, Widget *ignored) {
+		// Collect the horizontal intervals occupied by children overlapping the box vertically
+		std::vector<std::pair<float, float>> intervals;
+		forEachChildInRows(y, size.y, [&](Widget *child) {
+			if (child == ignored)
+				return;
+			Rect box = child->box;
+			if (!(y + size.y > box.pos.y && box.pos.y + box.size.y > y))
+				return;
+			intervals.push_back(std::make_pair(box.pos.x, box.pos.x + box.size.x));
+		});
+		std::sort(intervals.begin(), intervals.end());
+
+		// Find the column closest to `x` in each gap between intervals
+		int bestX = -1;
+		int lo = xMin;
+		for (size_t i = 0; i <= intervals.size(); i++) {
+			int hi = xMax - 1;
+			if (i < intervals.size())
+				hi = min(hi, (int) floorf((intervals[i].first - size.x) / RACK_GRID_WIDTH));
+			if (lo <= hi) {
+				int gapX = clamp(x, lo, hi);
+				if (bestX < 0 || std::abs(gapX - x) < std::abs(bestX - x))
+					bestX = gapX;
+			}
+			if (i < intervals.size())
+				lo = max(lo, (int) ceilf(intervals[i].second / RACK_GRID_WIDTH));
+			if (lo >= xMax)
+				break;
+		}
+		return bestX;
+	}
+
+	/** Returns the area of the rack on screen, in the container's coordinates */
+	Rect getCullingBox() {
+		Rect viewport = parent->getViewport(Rect(Vec(), parent->box.size));
+		viewport.pos = viewport.pos.minus(box.pos);
+		// Include the margin of module shadows
+		return viewport.grow(Vec(RACK_GRID_WIDTH * 4, RACK_GRID_WIDTH * 4));
+	}
+
+	void step() override {
+		// Children might have been moved directly since the last frame
+		rowsDirty = true;
+
+		// Modules which are off screen are stepped when they scroll into view, before they are drawn
+		Rect cullingBox = getCullingBox();
+		for (Widget *child : children) {
+			if (!cullingBox.intersects(child->box))
+				continue;
+			child->step();
+		}
+	}
+
 	void draw(NVGcontext *vg) override {
-		// Draw shadows behind each ModuleWidget first, so the shadow doesn't overlap the front.
+		// Only modules whose panel or shadow overlaps the area being redrawn
+		Rect cullingBox = getCullingBox().clamp(windowGetDamageRect(this).grow(Vec(RACK_GRID_WIDTH * 4, RACK_GRID_WIDTH * 4)));
+		std::vector<Widget*> visibleChildren;
 		for (Widget *child : children) {
 			if (!child->visible)
 				continue;
+			if (!cullingBox.intersects(child->box))
+				continue;
+			visibleChildren.push_back(child);
+		}
+
+		// Draw shadows behind each ModuleWidget first, so the shadow doesn't overlap the front.
+		for (Widget *child : visibleChildren) {
 			nvgSave(vg);
 			nvgTranslate(vg, child->box.pos.x, child->box.pos.y);
 			ModuleWidget *w = dynamic_cast<ModuleWidget*>(child);
@@ -25,7 +168,55 @@ struct ModuleContainer : Widget {
 			nvgRestore(vg);
 		}
 
-		Widget::draw(vg);
+		for (Widget *child : visibleChildren) {
+			nvgSave(vg);
+			nvgTranslate(vg, child->box.pos.x, child->box.pos.y);
+			child->draw(vg);
+			nvgRestore(vg);
+		}
+	}
+
+	/** Dispatches a positional event to the topmost child under it, only testing children in the event's row */
+	template <typename T>
+	void recursePositionEvent(void (Widget::*method)(T&), T &e) {
+		updateRows();
+		auto it = rows.find(getRow(e.pos.y));
+		if (it == rows.end())
+			return;
+		// Copy the row, since handlers may add or remove modules
+		std::vector<Widget*> row = it->second;
+		Vec pos = e.pos;
+		for (auto rit = row.rbegin(); rit != row.rend(); rit++) {
+			Widget *child = *rit;
+			if (!child->visible)
+				continue;
+			if (child->box.contains(pos)) {
+				e.pos = pos.minus(child->box.pos);
+				(child->*method)(e);
+				if (e.consumed)
+					break;
+			}
+		}
+		e.pos = pos;
+	}
+
+	void onMouseDown(EventMouseDown &e) override {
+		recursePositionEvent(&Widget::onMouseDown, e);
+	}
+	void onMouseUp(EventMouseUp &e) override {
+		recursePositionEvent(&Widget::onMouseUp, e);
+	}
+	void onMouseMove(EventMouseMove &e) override {
+		recursePositionEvent(&Widget::onMouseMove, e);
+	}
+	void onHoverKey(EventHoverKey &e) override {
+		recursePositionEvent(&Widget::onHoverKey, e);
+	}
+	void onScroll(EventScroll &e) override {
+		recursePositionEvent(&Widget::onScroll, e);
+	}
+	void onPathDrop(EventPathDrop &e) override {
+		recursePositionEvent(&Widget::onPathDrop, e);
 	}
 };
 
@@ -49,12 +240,14 @@ RackWidget::RackWidget() {
 }
 
 RackWidget::~RackWidget() {
+	autosaveWait();
 }
 
 void RackWidget::clear() {
 	wireContainer->activeWire = NULL;
 	wireContainer->clearChildren();
 	moduleContainer->clearChildren();
+	dynamic_cast<ModuleContainer*>(moduleContainer)->rowsDirty = true;
 
 	gRackScene->scrollWidget->offset = Vec(0, 0);
 }
@@ -130,10 +323,18 @@ void RackWidget::save(std::string filename) {
 	if (!rootJ)
 		return;
 
-	FILE *file = fopen(filename.c_str(), "w");
-	if (file) {
-		json_dumpf(rootJ, file, JSON_INDENT(2) | JSON_REAL_PRECISION(9));
-		fclose(file);
+	// Don't race with an autosave writing the same file
+	autosaveWait();
+
+	if (stringExtension(filename) == "vcvb") {
+		if (binpatchSave(rootJ, filename)) {
+			std::string message = stringf("Could not save binary patch %s", filename.c_str());
+			osdialog_message(OSDIALOG_WARNING, OSDIALOG_OK, message.c_str());
+		}
+	}
+	else {
+		if (!writeJson(rootJ, filename))
+			warn("Could not save patch %s", filename.c_str());
 	}
 
 	json_decref(rootJ);
@@ -141,6 +342,22 @@ void RackWidget::save(std::string filename) {
 
 void RackWidget::load(std::string filename) {
 	info("Loading patch %s", filename.c_str());
+	// A patch opened before the pending one was loaded replaces it
+	pendingPath = "";
+	if (binpatchIsFile(filename)) {
+		json_t *rootJ = binpatchLoad(filename);
+		if (rootJ) {
+			clear();
+			fromJson(rootJ);
+			json_decref(rootJ);
+		}
+		else {
+			std::string message = stringf("Could not load binary patch %s", filename.c_str());
+			osdialog_message(OSDIALOG_WARNING, OSDIALOG_OK, message.c_str());
+		}
+		return;
+	}
+
 	FILE *file = fopen(filename.c_str(), "r");
 	if (!file) {
 		// Exit silently
@@ -412,12 +629,14 @@ void RackWidget::pastePresetClipboard() {
 
 void RackWidget::addModule(ModuleWidget *m) {
 	moduleContainer->addChild(m);
+	dynamic_cast<ModuleContainer*>(moduleContainer)->rowsDirty = true;
 	m->create();
 }
 
 void RackWidget::deleteModule(ModuleWidget *m) {
 	m->_delete();
 	moduleContainer->removeChild(m);
+	dynamic_cast<ModuleContainer*>(moduleContainer)->rowsDirty = true;
 }
 
 void RackWidget::cloneModule(ModuleWidget *m) {
@@ -434,40 +653,45 @@ bool RackWidget::requestModuleBox(ModuleWidget *m, Rect box) {
 	if (box.pos.x < 0 || box.pos.y < 0)
 		return false;
 
-	for (Widget *child2 : moduleContainer->children) {
-		if (m == child2) continue;
-		if (box.intersects(child2->box)) {
-			return false;
-		}
-	}
+	ModuleContainer *container = dynamic_cast<ModuleContainer*>(moduleContainer);
+	if (container->collides(box, m))
+		return false;
+	// Module positions and sizes are saved in the patch
+	if (!box.isEqual(m->box))
+		gStateGeneration++;
 	m->box = box;
+	container->rowsDirty = true;
 	return true;
 }
 
 bool RackWidget::requestModuleBoxNearest(ModuleWidget *m, Rect box) {
-	// Create possible positions
+	ModuleContainer *container = dynamic_cast<ModuleContainer*>(moduleContainer);
+	// Search the same range of grid positions as a brute-force search would, but find the nearest free position of each row directly
 	int x0 = roundf(box.pos.x / RACK_GRID_WIDTH);
 	int y0 = roundf(box.pos.y / RACK_GRID_HEIGHT);
-	std::vector<Vec> positions;
+	float bestDist = INFINITY;
+	Vec bestPos;
 	for (int y = max(0, y0 - 8); y < y0 + 8; y++) {
-		for (int x = max(0, x0 - 400); x < x0 + 400; x++) {
-			positions.push_back(Vec(x * RACK_GRID_WIDTH, y * RACK_GRID_HEIGHT));
+		float dy = y * RACK_GRID_HEIGHT - box.pos.y;
+		// Rows further away than the best position cannot contain a closer one
+		if (std::abs(dy) >= bestDist)
+			continue;
+		int x = container->findFreeColumn(x0, max(0, x0 - 400), x0 + 400, y * RACK_GRID_HEIGHT, box.size, m);
+		if (x < 0)
+			continue;
+		Vec pos = Vec(x * RACK_GRID_WIDTH, y * RACK_GRID_HEIGHT);
+		float dist = pos.minus(box.pos).norm();
+		if (dist < bestDist) {
+			bestDist = dist;
+			bestPos = pos;
 		}
 	}
 
-	// Sort possible positions by distance to the requested position
-	std::sort(positions.begin(), positions.end(), [box](Vec a, Vec b) {
-		return a.minus(box.pos).norm() < b.minus(box.pos).norm();
-	});
-
-	// Find a position that does not collide
-	for (Vec position : positions) {
-		Rect newBox = box;
-		newBox.pos = position;
-		if (requestModuleBox(m, newBox))
-			return true;
-	}
-	return false;
+	if (bestDist == INFINITY)
+		return false;
+	Rect newBox = box;
+	newBox.pos = bestPos;
+	return requestModuleBox(m, newBox);
 }
 
 void RackWidget::step() {
@@ -488,15 +712,55 @@ void RackWidget::step() {
 		rail->box.size = rails->box.size;
 	}
 
-	// Autosave every 15 seconds
-	if (gGuiFrame % (60 * 15) == 0) {
-		save(assetLocal("autosave.vcv"));
-		settingsSave(assetLocal("settings.json"));
+	// Lights and meters read the values the engine publishes in response
+	engineRequestSnapshot();
+
+	if (!pendingPath.empty() && !pluginIsExtracting()) {
+		load(pendingPath);
+	}
+
+	// Autosave every 15 seconds, regardless of the frame rate
+	static double lastAutosaveTime = 0.0;
+	double time = glfwGetTime();
+	if (time - lastAutosaveTime >= 15.0) {
+		lastAutosaveTime = time;
+		autosave();
 	}
 
 	Widget::step();
 }
 
+void RackWidget::autosave() {
+	// Settings are not part of the patch. settingsSave() skips writing them if they haven't changed.
+	settingsSave(assetLocal("settings.json"));
+
+	// Don't replace the autosave before the patch it holds is loaded
+	if (!pendingPath.empty())
+		return;
+	// Skip if the patch hasn't been edited since the last autosave
+	int stateGeneration = gStateGeneration;
+	if (stateGeneration == autosaveStateGeneration)
+		return;
+	// Skip if the last autosave is still being written, and try again next time
+	if (isAutosaving)
+		return;
+	autosaveWait();
+	autosaveStateGeneration = stateGeneration;
+
+	// Snapshot the patch on the UI thread, and serialize and write it in the background
+	json_t *rootJ = toJson();
+	if (!rootJ)
+		return;
+	std::string filename = assetLocal("autosave.vcv");
+	isAutosaving = true;
+	autosaveThread = std::thread([rootJ, filename]() {
+		if (!writeJson(rootJ, filename))
+			warn("Could not autosave patch %s", filename.c_str());
+		json_decref(rootJ);
+		isAutosaving = false;
+	});
+}
+
 void RackWidget::draw(NVGcontext *vg) {
 	Widget::draw(vg);
 }
@@ -215,6 +215,17 @@ void Toolbar::draw(NVGcontext *vg) {
 	bndBevel(vg, 0.0, 0.0, box.size.x, box.size.y);
 
 	Widget::draw(vg);
+
+	// Show the GUI frame time along with the module power meters
+	if (gPowerMeter) {
+		int wireCount = gRackWidget->wireContainer->children.size();
+		std::string frameText = stringf("GUI %.1f mS, %d cables", gFrameTime * 1000.f, wireCount);
+		nvgFontFaceId(vg, gGuiFont->handle);
+		nvgFontSize(vg, 12);
+		nvgFillColor(vg, bndGetTheme()->regularTheme.textColor);
+		nvgTextAlign(vg, NVG_ALIGN_RIGHT | NVG_ALIGN_MIDDLE);
+		nvgText(vg, box.size.x - 10.0, box.size.y / 2, frameText.c_str(), NULL);
+	}
 }
 
 
@@ -1,8 +1,16 @@
 #include "app.hpp"
+#include "window.hpp"
+#include <map>
+#include <algorithm>
 
 namespace rack {
 
 
+static bool colorEquals(NVGcolor a, NVGcolor b) {
+	return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+
 void WireContainer::setActiveWire(WireWidget *w) {
 	if (activeWire) {
 		removeChild(activeWire);
@@ -94,12 +102,80 @@ WireWidget *WireContainer::getTopWire(Port *port) {
 }
 
 void WireContainer::draw(NVGcontext *vg) {
-	Widget::draw(vg);
-
-	// Wire plugs
+	// Skip wires which are entirely off screen or outside of the area being redrawn
+	Rect viewport = parent->getViewport(Rect(Vec(), parent->box.size));
+	viewport.pos = viewport.pos.minus(box.pos);
+	viewport = viewport.clamp(windowGetDamageRect(this));
+	std::vector<WireWidget*> visibleWires;
 	for (Widget *child : children) {
 		WireWidget *wire = dynamic_cast<WireWidget*>(child);
 		assert(wire);
+		if (!viewport.intersects(wire->getBoundingBox()))
+			continue;
+		visibleWires.push_back(wire);
+	}
+
+	// Group wires by opacity, which is the same for all wires except the hovered or active one, and then by color
+	struct ColorGroup {
+		NVGcolor color;
+		std::vector<WireWidget*> wires;
+	};
+	std::map<float, std::vector<ColorGroup>> opacityGroups;
+	for (WireWidget *wire : visibleWires) {
+		if (!wire->visible)
+			continue;
+		float opacity = wire->getOpacity();
+		if (opacity <= 0.0)
+			continue;
+		wire->updateCurve();
+		std::vector<ColorGroup> &colorGroups = opacityGroups[opacity];
+		auto it = std::find_if(colorGroups.begin(), colorGroups.end(), [&](const ColorGroup &group) {
+			return colorEquals(group.color, wire->color);
+		});
+		if (it == colorGroups.end()) {
+			colorGroups.push_back(ColorGroup());
+			it = colorGroups.end() - 1;
+			it->color = wire->color;
+		}
+		it->wires.push_back(wire);
+	}
+
+	nvgSave(vg);
+	nvgLineJoin(vg, NVG_ROUND);
+	// Stroke all shadows of each opacity as a single path, below all wires
+	for (auto &pair : opacityGroups) {
+		nvgGlobalAlpha(vg, powf(pair.first, 1.5));
+		nvgBeginPath(vg);
+		for (ColorGroup &group : pair.second) {
+			for (WireWidget *wire : group.wires) {
+				wire->drawShadowPath(vg);
+			}
+		}
+		WireWidget::strokeShadowPath(vg);
+	}
+	// Stroke the outlines of each color as a single path, and then the solid parts over them, so the number of strokes doesn't grow with the number of wires.
+	// Wires of the same opacity no longer keep their stacking order where they cross, but the opaque hovered or active wire is still drawn last, on top of the others.
+	for (auto &pair : opacityGroups) {
+		nvgGlobalAlpha(vg, powf(pair.first, 1.5));
+		for (ColorGroup &group : pair.second) {
+			nvgBeginPath(vg);
+			for (WireWidget *wire : group.wires) {
+				wire->drawCurvePath(vg);
+			}
+			WireWidget::strokeOutlinePath(vg, group.color);
+		}
+		for (ColorGroup &group : pair.second) {
+			nvgBeginPath(vg);
+			for (WireWidget *wire : group.wires) {
+				wire->drawCurvePath(vg);
+			}
+			WireWidget::strokeSolidPath(vg, group.color);
+		}
+	}
+	nvgRestore(vg);
+
+	// Wire plugs
+	for (WireWidget *wire : visibleWires) {
 		wire->drawPlugs(vg);
 	}
 }
@@ -27,48 +27,31 @@ static void drawPlug(NVGcontext *vg, Vec pos, NVGcolor color) {
 	nvgFill(vg);
 }
 
-static void drawWire(NVGcontext *vg, Vec pos1, Vec pos2, NVGcolor color, float tension, float opacity) {
-	NVGcolor colorShadow = nvgRGBAf(0, 0, 0, 0.10);
-	NVGcolor colorOutline = nvgLerpRGBA(color, nvgRGBf(0.0, 0.0, 0.0), 0.5);
+static Vec getWireSlump(Vec pos1, Vec pos2, float tension) {
+	float dist = pos1.minus(pos2).norm();
+	Vec slump;
+	slump.y = (1.0 - tension) * (150.0 + 1.0*dist);
+	return slump;
+}
 
-	// Wire
-	if (opacity > 0.0) {
-		nvgSave(vg);
-		nvgGlobalAlpha(vg, powf(opacity, 1.5));
-
-		float dist = pos1.minus(pos2).norm();
-		Vec slump;
-		slump.y = (1.0 - tension) * (150.0 + 1.0*dist);
-		Vec pos3 = pos1.plus(pos2).div(2).plus(slump);
-
-		nvgLineJoin(vg, NVG_ROUND);
-
-		// Shadow
-		Vec pos4 = pos3.plus(slump.mult(0.08));
-		nvgBeginPath(vg);
-		nvgMoveTo(vg, pos1.x, pos1.y);
-		nvgQuadTo(vg, pos4.x, pos4.y, pos2.x, pos2.y);
-		nvgStrokeColor(vg, colorShadow);
-		nvgStrokeWidth(vg, 5);
-		nvgStroke(vg);
-
-		// Wire outline
-		nvgBeginPath(vg);
-		nvgMoveTo(vg, pos1.x, pos1.y);
-		nvgQuadTo(vg, pos3.x, pos3.y, pos2.x, pos2.y);
-		nvgStrokeColor(vg, colorOutline);
-		nvgStrokeWidth(vg, 5);
-		nvgStroke(vg);
-
-		// Wire solid
-		nvgStrokeColor(vg, color);
-		nvgStrokeWidth(vg, 3);
-		nvgStroke(vg);
+/** Flattens the quadratic Bezier curve from `pos1` to `pos3` with control point `pos2` */
+static void tessellateCurve(std::vector<Vec> &points, Vec pos1, Vec pos2, Vec pos3, int segments) {
+	points.resize(segments + 1);
+	for (int i = 0; i <= segments; i++) {
+		float t = (float) i / segments;
+		float u = 1.f - t;
+		points[i] = pos1.mult(u * u).plus(pos2.mult(2.f * u * t)).plus(pos3.mult(t * t));
+	}
+}
 
-		nvgRestore(vg);
+static void pathCurve(NVGcontext *vg, const std::vector<Vec> &points) {
+	nvgMoveTo(vg, points[0].x, points[0].y);
+	for (size_t i = 1; i < points.size(); i++) {
+		nvgLineTo(vg, points[i].x, points[i].y);
 	}
 }
 
+static const NVGcolor wireShadowColor = nvgRGBAf(0, 0, 0, 0.10);
 
 static const NVGcolor wireColors[] = {
 	nvgRGB(0xc9, 0xb7, 0x0e), // yellow
@@ -142,6 +125,18 @@ Vec WireWidget::getInputPos() {
 	}
 }
 
+Rect WireWidget::getBoundingBox() {
+	Vec outputPos = getOutputPos();
+	Vec inputPos = getInputPos();
+	float tension = gToolbar->wireTensionSlider->value;
+	// A quadratic Bezier curve lies within the bounds of its control points, and the shadow's control point is the lowest.
+	Vec slump = getWireSlump(outputPos, inputPos, tension);
+	Vec controlPos = outputPos.plus(inputPos).div(2).plus(slump.mult(1.08));
+	Rect bound = Rect::fromMinMax(outputPos.min(inputPos).min(controlPos), outputPos.max(inputPos).max(controlPos));
+	// Include the stroke width and plug radius
+	return bound.grow(Vec(10, 10));
+}
+
 json_t *WireWidget::toJson() {
 	json_t *rootJ = json_object();
 	std::string s = colorToHexString(color);
@@ -160,9 +155,8 @@ void WireWidget::fromJson(json_t *rootJ) {
 	}
 }
 
-void WireWidget::draw(NVGcontext *vg) {
+float WireWidget::getOpacity() {
 	float opacity = gToolbar->wireOpacitySlider->value / 100.0;
-	float tension = gToolbar->wireTensionSlider->value;
 
 	WireWidget *activeWire = gRackWidget->wireContainer->activeWire;
 	if (activeWire) {
@@ -175,10 +169,80 @@ void WireWidget::draw(NVGcontext *vg) {
 		if (hoveredPort && (hoveredPort == outputPort || hoveredPort == inputPort))
 			opacity = 1.0;
 	}
+	return opacity;
+}
 
+void WireWidget::updateCurve() {
 	Vec outputPos = getOutputPos();
 	Vec inputPos = getInputPos();
-	drawWire(vg, outputPos, inputPos, color, tension, opacity);
+	float tension = gToolbar->wireTensionSlider->value;
+	float zoom = gRackScene->zoomWidget->zoom * gPixelRatio;
+	if (!curvePoints.empty() && outputPos.isEqual(curveOutputPos) && inputPos.isEqual(curveInputPos) && tension == curveTension && zoom == curveZoom)
+		return;
+	curveOutputPos = outputPos;
+	curveInputPos = inputPos;
+	curveTension = tension;
+	curveZoom = zoom;
+
+	Vec slump = getWireSlump(outputPos, inputPos, tension);
+	Vec pos3 = outputPos.plus(inputPos).div(2).plus(slump);
+	Vec pos4 = pos3.plus(slump.mult(0.08));
+	// A quadratic Bezier curve with control points P0, P1, P2 flattened into n segments is off by at most |P0 - 2 P1 + P2| / (4 n^2).
+	// Use enough segments to keep this under a quarter of a pixel on screen at any zoom.
+	float bend = outputPos.minus(pos3.mult(2)).plus(inputPos).norm() * zoom;
+	int segments = clamp((int) std::ceil(std::sqrt(bend)), 4, 1024);
+	tessellateCurve(curvePoints, outputPos, pos3, inputPos, segments);
+	tessellateCurve(shadowPoints, outputPos, pos4, inputPos, segments);
+}
+
+void WireWidget::drawShadowPath(NVGcontext *vg) {
+	pathCurve(vg, shadowPoints);
+}
+
+void WireWidget::strokeShadowPath(NVGcontext *vg) {
+	nvgStrokeColor(vg, wireShadowColor);
+	nvgStrokeWidth(vg, 5);
+	nvgStroke(vg);
+}
+
+void WireWidget::drawCurvePath(NVGcontext *vg) {
+	pathCurve(vg, curvePoints);
+}
+
+void WireWidget::strokeOutlinePath(NVGcontext *vg, NVGcolor color) {
+	NVGcolor colorOutline = nvgLerpRGBA(color, nvgRGBf(0.0, 0.0, 0.0), 0.5);
+	nvgStrokeColor(vg, colorOutline);
+	nvgStrokeWidth(vg, 5);
+	nvgStroke(vg);
+}
+
+void WireWidget::strokeSolidPath(NVGcontext *vg, NVGcolor color) {
+	nvgStrokeColor(vg, color);
+	nvgStrokeWidth(vg, 3);
+	nvgStroke(vg);
+}
+
+void WireWidget::draw(NVGcontext *vg) {
+	float opacity = getOpacity();
+	if (opacity <= 0.0)
+		return;
+
+	updateCurve();
+	nvgSave(vg);
+	nvgGlobalAlpha(vg, powf(opacity, 1.5));
+	nvgLineJoin(vg, NVG_ROUND);
+
+	// Shadow
+	nvgBeginPath(vg);
+	drawShadowPath(vg);
+	strokeShadowPath(vg);
+
+	// Wire outline and solid
+	nvgBeginPath(vg);
+	drawCurvePath(vg);
+	strokeOutlinePath(vg, color);
+	strokeSolidPath(vg, color);
+	nvgRestore(vg);
 }
 
 void WireWidget::drawPlugs(NVGcontext *vg) {
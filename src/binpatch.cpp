@@ -0,0 +1,581 @@
+#include "binpatch.hpp"
+#include "util/common.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#if ARCH_WIN
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+
+namespace rack {
+
+
+/** Arrays with fewer elements are kept in the JSON chunk */
+static const size_t MIN_ARRAY_CHUNK = 64;
+/** Strings with fewer bytes are kept in the JSON chunk */
+static const size_t MIN_STRING_CHUNK = 1024;
+static const char *CHUNK_KEY = "$binpatchChunk";
+
+
+/** Converts a value between host and little-endian byte order, in either direction */
+template <typename T>
+static T littleEndian(T x) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	uint8_t bytes[sizeof(T)];
+	memcpy(bytes, &x, sizeof(T));
+	std::reverse(bytes, bytes + sizeof(T));
+	memcpy(&x, bytes, sizeof(T));
+#endif
+	return x;
+}
+
+static BinpatchHeader littleEndian(BinpatchHeader header) {
+	header.version = littleEndian(header.version);
+	header.moduleCount = littleEndian(header.moduleCount);
+	header.wireCount = littleEndian(header.wireCount);
+	header.chunkCount = littleEndian(header.chunkCount);
+	header.rootChunk = littleEndian(header.rootChunk);
+	header.flags = littleEndian(header.flags);
+	header.moduleTableOffset = littleEndian(header.moduleTableOffset);
+	header.wireTableOffset = littleEndian(header.wireTableOffset);
+	header.chunkTableOffset = littleEndian(header.chunkTableOffset);
+	return header;
+}
+
+static BinpatchModule littleEndian(BinpatchModule module) {
+	module.chunk = littleEndian(module.chunk);
+	return module;
+}
+
+static BinpatchWire littleEndian(BinpatchWire wire) {
+	wire.outputModuleId = littleEndian(wire.outputModuleId);
+	wire.outputId = littleEndian(wire.outputId);
+	wire.inputModuleId = littleEndian(wire.inputModuleId);
+	wire.inputId = littleEndian(wire.inputId);
+	wire.chunk = littleEndian(wire.chunk);
+	wire.flags = littleEndian(wire.flags);
+	return wire;
+}
+
+static BinpatchChunk littleEndian(BinpatchChunk chunk) {
+	chunk.offset = littleEndian(chunk.offset);
+	chunk.size = littleEndian(chunk.size);
+	chunk.type = littleEndian(chunk.type);
+	return chunk;
+}
+
+template <typename T>
+static std::vector<T> littleEndian(const std::vector<T> &entries) {
+	std::vector<T> converted;
+	for (const T &entry : entries) {
+		converted.push_back(littleEndian(entry));
+	}
+	return converted;
+}
+
+
+////////////////////
+// save
+////////////////////
+
+struct ChunkData {
+	uint32_t type;
+	std::string data;
+};
+
+static uint32_t addChunk(std::vector<ChunkData> &chunks, uint32_t type, const void *data, size_t size) {
+	ChunkData chunk;
+	chunk.type = type;
+	chunk.data = std::string((const char*) data, size);
+	chunks.push_back(chunk);
+	return chunks.size() - 1;
+}
+
+static uint32_t addJsonChunk(std::vector<ChunkData> &chunks, json_t *valueJ) {
+	// The default real precision of 17 digits round-trips doubles exactly
+	char *text = json_dumps(valueJ, JSON_COMPACT | JSON_ENCODE_ANY);
+	uint32_t index = addChunk(chunks, BINPATCH_CHUNK_JSON, text, text ? strlen(text) : 0);
+	free(text);
+	return index;
+}
+
+static json_t *chunkRef(uint32_t index) {
+	json_t *refJ = json_object();
+	json_object_set_new(refJ, CHUNK_KEY, json_integer(index));
+	return refJ;
+}
+
+static bool isArrayOfType(json_t *arrayJ, int type) {
+	size_t i;
+	json_t *elementJ;
+	json_array_foreach(arrayJ, i, elementJ) {
+		if (json_typeof(elementJ) != type)
+			return false;
+	}
+	return true;
+}
+
+/** Returns a copy of `valueJ` with large arrays and strings moved into chunks
+Keys beginning with "$" are escaped with another "$", so only chunk references have a key with a single "$".
+*/
+static json_t *extractChunks(std::vector<ChunkData> &chunks, json_t *valueJ) {
+	switch (json_typeof(valueJ)) {
+		case JSON_OBJECT: {
+			json_t *objectJ = json_object();
+			const char *key;
+			json_t *childJ;
+			json_object_foreach(valueJ, key, childJ) {
+				std::string storedKey = (key[0] == '$') ? std::string("$") + key : std::string(key);
+				json_object_set_new(objectJ, storedKey.c_str(), extractChunks(chunks, childJ));
+			}
+			return objectJ;
+		} break;
+		case JSON_ARRAY: {
+			size_t size = json_array_size(valueJ);
+			size_t i;
+			json_t *elementJ;
+			if (size >= MIN_ARRAY_CHUNK && isArrayOfType(valueJ, JSON_REAL)) {
+				std::vector<double> values;
+				json_array_foreach(valueJ, i, elementJ) {
+					values.push_back(littleEndian(json_real_value(elementJ)));
+				}
+				return chunkRef(addChunk(chunks, BINPATCH_CHUNK_REAL, values.data(), values.size() * sizeof(double)));
+			}
+			if (size >= MIN_ARRAY_CHUNK && isArrayOfType(valueJ, JSON_INTEGER)) {
+				std::vector<int64_t> values;
+				json_array_foreach(valueJ, i, elementJ) {
+					values.push_back(littleEndian((int64_t) json_integer_value(elementJ)));
+				}
+				return chunkRef(addChunk(chunks, BINPATCH_CHUNK_INTEGER, values.data(), values.size() * sizeof(int64_t)));
+			}
+			json_t *arrayJ = json_array();
+			json_array_foreach(valueJ, i, elementJ) {
+				json_array_append_new(arrayJ, extractChunks(chunks, elementJ));
+			}
+			return arrayJ;
+		} break;
+		case JSON_STRING: {
+			size_t size = json_string_length(valueJ);
+			if (size >= MIN_STRING_CHUNK)
+				return chunkRef(addChunk(chunks, BINPATCH_CHUNK_STRING, json_string_value(valueJ), size));
+		} break;
+		default: break;
+	}
+	return json_incref(valueJ);
+}
+
+static bool getInt32(json_t *objectJ, const char *key, int32_t *value) {
+	json_t *valueJ = json_object_get(objectJ, key);
+	if (!json_is_integer(valueJ))
+		return false;
+	json_int_t i = json_integer_value(valueJ);
+	if (i < INT32_MIN || i > INT32_MAX)
+		return false;
+	*value = i;
+	return true;
+}
+
+static bool writePadding(FILE *file, uint64_t size) {
+	static const char zeros[BINPATCH_ALIGN] = {};
+	return fwrite(zeros, 1, size, file) == size;
+}
+
+static uint64_t alignOffset(uint64_t offset) {
+	return (offset + BINPATCH_ALIGN - 1) / BINPATCH_ALIGN * BINPATCH_ALIGN;
+}
+
+int binpatchSave(json_t *rootJ, std::string filename) {
+	std::vector<ChunkData> chunks;
+	std::vector<BinpatchModule> modules;
+	std::vector<BinpatchWire> wires;
+
+	// modules
+	json_t *modulesJ = json_object_get(rootJ, "modules");
+	size_t moduleId;
+	json_t *moduleJ;
+	json_array_foreach(modulesJ, moduleId, moduleJ) {
+		json_t *extractedJ = extractChunks(chunks, moduleJ);
+		BinpatchModule module = {};
+		module.chunk = addJsonChunk(chunks, extractedJ);
+		json_decref(extractedJ);
+		modules.push_back(module);
+	}
+
+	// wires
+	json_t *wiresJ = json_object_get(rootJ, "wires");
+	size_t wireId;
+	json_t *wireJ;
+	json_array_foreach(wiresJ, wireId, wireJ) {
+		json_t *extractedJ = extractChunks(chunks, wireJ);
+		BinpatchWire wire = {};
+		if (json_is_object(extractedJ)
+			&& getInt32(extractedJ, "outputModuleId", &wire.outputModuleId)
+			&& getInt32(extractedJ, "outputId", &wire.outputId)
+			&& getInt32(extractedJ, "inputModuleId", &wire.inputModuleId)
+			&& getInt32(extractedJ, "inputId", &wire.inputId)) {
+			wire.flags |= BINPATCH_WIRE_PORTS;
+			json_object_del(extractedJ, "outputModuleId");
+			json_object_del(extractedJ, "outputId");
+			json_object_del(extractedJ, "inputModuleId");
+			json_object_del(extractedJ, "inputId");
+		}
+		wire.chunk = addJsonChunk(chunks, extractedJ);
+		json_decref(extractedJ);
+		wires.push_back(wire);
+	}
+
+	// root, without the arrays which are stored in the tables.
+	// Remove them from a shallow copy before extracting, so their chunks aren't stored twice.
+	json_t *shallowRootJ = json_copy(rootJ);
+	if (json_is_array(modulesJ))
+		json_object_del(shallowRootJ, "modules");
+	if (json_is_array(wiresJ))
+		json_object_del(shallowRootJ, "wires");
+	json_t *extractedRootJ = extractChunks(chunks, shallowRootJ);
+	json_decref(shallowRootJ);
+
+	BinpatchHeader header = {};
+	memcpy(header.magic, BINPATCH_MAGIC, sizeof(header.magic));
+	header.version = BINPATCH_VERSION;
+	if (json_is_array(modulesJ))
+		header.flags |= BINPATCH_MODULES;
+	if (json_is_array(wiresJ))
+		header.flags |= BINPATCH_WIRES;
+	header.rootChunk = addJsonChunk(chunks, extractedRootJ);
+	json_decref(extractedRootJ);
+	header.moduleCount = modules.size();
+	header.wireCount = wires.size();
+	header.chunkCount = chunks.size();
+
+	// Compute layout
+	header.moduleTableOffset = alignOffset(sizeof(BinpatchHeader));
+	header.wireTableOffset = alignOffset(header.moduleTableOffset + modules.size() * sizeof(BinpatchModule));
+	header.chunkTableOffset = alignOffset(header.wireTableOffset + wires.size() * sizeof(BinpatchWire));
+	std::vector<BinpatchChunk> chunkTable;
+	uint64_t offset = alignOffset(header.chunkTableOffset + chunks.size() * sizeof(BinpatchChunk));
+	for (const ChunkData &chunk : chunks) {
+		BinpatchChunk entry = {};
+		entry.offset = offset;
+		entry.size = chunk.data.size();
+		entry.type = chunk.type;
+		chunkTable.push_back(entry);
+		offset = alignOffset(offset + entry.size);
+	}
+
+	// Write to a temporary file so a failed save does not destroy the previous patch
+	std::string tmpFilename = filename + ".tmp";
+	FILE *file = fopen(tmpFilename.c_str(), "wb");
+	if (!file)
+		return -1;
+
+	bool success = true;
+	uint64_t position = 0;
+	auto writeAt = [&](uint64_t at, const void *data, uint64_t size) {
+		success = success && writePadding(file, at - position);
+		success = success && (fwrite(data, 1, size, file) == size);
+		position = at + size;
+	};
+	BinpatchHeader fileHeader = littleEndian(header);
+	std::vector<BinpatchModule> fileModules = littleEndian(modules);
+	std::vector<BinpatchWire> fileWires = littleEndian(wires);
+	std::vector<BinpatchChunk> fileChunkTable = littleEndian(chunkTable);
+	writeAt(0, &fileHeader, sizeof(fileHeader));
+	writeAt(header.moduleTableOffset, fileModules.data(), fileModules.size() * sizeof(BinpatchModule));
+	writeAt(header.wireTableOffset, fileWires.data(), fileWires.size() * sizeof(BinpatchWire));
+	writeAt(header.chunkTableOffset, fileChunkTable.data(), fileChunkTable.size() * sizeof(BinpatchChunk));
+	for (size_t i = 0; i < chunks.size(); i++) {
+		writeAt(chunkTable[i].offset, chunks[i].data.data(), chunkTable[i].size);
+	}
+	success = success && (fclose(file) == 0);
+
+	if (!success) {
+		remove(tmpFilename.c_str());
+		return -1;
+	}
+#if ARCH_WIN
+	// rename() does not replace existing files on Windows
+	remove(filename.c_str());
+#endif
+	if (rename(tmpFilename.c_str(), filename.c_str())) {
+		remove(tmpFilename.c_str());
+		return -1;
+	}
+	return 0;
+}
+
+
+////////////////////
+// load
+////////////////////
+
+struct MappedFile {
+	const uint8_t *data = NULL;
+	uint64_t size = 0;
+
+	MappedFile(std::string filename) {
+#if ARCH_WIN
+		HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return;
+		LARGE_INTEGER fileSize;
+		if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+			HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping) {
+				// The view keeps the mapping alive after its handle is closed
+				data = (const uint8_t*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+				if (data)
+					size = fileSize.QuadPart;
+				CloseHandle(mapping);
+			}
+		}
+		CloseHandle(file);
+#else
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0)
+			return;
+		struct stat statbuf;
+		if (!fstat(fd, &statbuf) && statbuf.st_size > 0) {
+			void *p = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED) {
+				data = (const uint8_t*) p;
+				size = statbuf.st_size;
+			}
+		}
+		close(fd);
+#endif
+	}
+
+	~MappedFile() {
+		if (!data)
+			return;
+#if ARCH_WIN
+		UnmapViewOfFile(data);
+#else
+		munmap((void*) data, size);
+#endif
+	}
+};
+
+struct BinpatchReader {
+	const uint8_t *data;
+	uint64_t size;
+	const BinpatchChunk *chunks;
+	uint32_t chunkCount;
+	/** Whether object keys beginning with "$" were escaped, since version 2 */
+	bool escapedKeys;
+
+	/** Returns false if the chunk does not exist or lies outside the file */
+	bool getChunk(json_int_t index, BinpatchChunk *chunk) {
+		if (index < 0 || index >= chunkCount)
+			return false;
+		*chunk = littleEndian(chunks[index]);
+		if (chunk->offset > size || chunk->size > size - chunk->offset)
+			return false;
+		if (chunk->offset % BINPATCH_ALIGN != 0)
+			return false;
+		return true;
+	}
+
+	/** Returns a new reference to the array or string stored in a raw chunk, or NULL on failure */
+	json_t *loadDataChunk(json_int_t index) {
+		BinpatchChunk chunk;
+		if (getChunk(index, &chunk)) {
+			switch (chunk.type) {
+				case BINPATCH_CHUNK_REAL: {
+					const double *values = (const double*) (data + chunk.offset);
+					json_t *arrayJ = json_array();
+					for (uint64_t i = 0; i < chunk.size / sizeof(double); i++) {
+						json_array_append_new(arrayJ, json_real(littleEndian(values[i])));
+					}
+					return arrayJ;
+				} break;
+				case BINPATCH_CHUNK_INTEGER: {
+					const int64_t *values = (const int64_t*) (data + chunk.offset);
+					json_t *arrayJ = json_array();
+					for (uint64_t i = 0; i < chunk.size / sizeof(int64_t); i++) {
+						json_array_append_new(arrayJ, json_integer(littleEndian(values[i])));
+					}
+					return arrayJ;
+				} break;
+				case BINPATCH_CHUNK_STRING: {
+					return json_stringn((const char*) (data + chunk.offset), chunk.size);
+				} break;
+				default: break;
+			}
+		}
+		warn("Binary patch chunk %d is invalid", (int) index);
+		return NULL;
+	}
+
+	/** Returns a new reference to the value stored in a JSON chunk with its chunk references resolved, or NULL on failure */
+	json_t *loadJsonChunk(json_int_t index) {
+		BinpatchChunk chunk;
+		if (!getChunk(index, &chunk) || chunk.type != BINPATCH_CHUNK_JSON) {
+			warn("Binary patch chunk %d is invalid", (int) index);
+			return NULL;
+		}
+		json_error_t error;
+		json_t *valueJ = json_loadb((const char*) (data + chunk.offset), chunk.size, JSON_DECODE_ANY, &error);
+		if (!valueJ) {
+			warn("Binary patch chunk %d is not valid JSON: %s", (int) index, error.text);
+			return NULL;
+		}
+		return resolveChunks(valueJ);
+	}
+
+	/** Replaces chunk references in `valueJ` with their values and unescapes object keys
+	Steals a reference to `valueJ` and returns a new reference, or NULL on failure.
+	*/
+	json_t *resolveChunks(json_t *valueJ) {
+		if (json_is_object(valueJ)) {
+			json_t *indexJ = json_object_get(valueJ, CHUNK_KEY);
+			if (indexJ && json_object_size(valueJ) == 1) {
+				json_t *chunkJ = json_is_integer(indexJ) ? loadDataChunk(json_integer_value(indexJ)) : NULL;
+				json_decref(valueJ);
+				return chunkJ;
+			}
+			// Keys can't be renamed in place, so build a new object
+			json_t *objectJ = json_object();
+			const char *key;
+			json_t *childJ;
+			json_object_foreach(valueJ, key, childJ) {
+				json_t *resolvedJ = resolveChunks(json_incref(childJ));
+				if (!resolvedJ) {
+					json_decref(objectJ);
+					json_decref(valueJ);
+					return NULL;
+				}
+				const char *originalKey = (escapedKeys && key[0] == '$') ? key + 1 : key;
+				json_object_set_new(objectJ, originalKey, resolvedJ);
+			}
+			json_decref(valueJ);
+			return objectJ;
+		}
+		else if (json_is_array(valueJ)) {
+			for (size_t i = 0; i < json_array_size(valueJ); i++) {
+				json_t *resolvedJ = resolveChunks(json_incref(json_array_get(valueJ, i)));
+				if (!resolvedJ) {
+					json_decref(valueJ);
+					return NULL;
+				}
+				json_array_set_new(valueJ, i, resolvedJ);
+			}
+		}
+		return valueJ;
+	}
+};
+
+bool binpatchIsFile(std::string filename) {
+	FILE *file = fopen(filename.c_str(), "rb");
+	if (!file)
+		return false;
+	char magic[4];
+	bool isBinpatch = (fread(magic, 1, sizeof(magic), file) == sizeof(magic)) && !memcmp(magic, BINPATCH_MAGIC, sizeof(magic));
+	fclose(file);
+	return isBinpatch;
+}
+
+/** Returns whether the table of `count` entries of `entrySize` bytes at `offset` lies inside the file */
+static bool isTableValid(uint64_t fileSize, uint64_t offset, uint64_t count, uint64_t entrySize) {
+	if (offset > fileSize || offset % BINPATCH_ALIGN != 0)
+		return false;
+	return count <= (fileSize - offset) / entrySize;
+}
+
+json_t *binpatchLoad(std::string filename) {
+	MappedFile file(filename);
+	if (!file.data) {
+		warn("Could not map binary patch %s", filename.c_str());
+		return NULL;
+	}
+
+	// Validate header and tables
+	if (file.size < sizeof(BinpatchHeader)) {
+		warn("Binary patch %s is truncated", filename.c_str());
+		return NULL;
+	}
+	BinpatchHeader header = littleEndian(*(const BinpatchHeader*) file.data);
+	if (memcmp(header.magic, BINPATCH_MAGIC, sizeof(header.magic))) {
+		warn("%s is not a binary patch", filename.c_str());
+		return NULL;
+	}
+	if (header.version < 1 || header.version > BINPATCH_VERSION) {
+		warn("Binary patch %s has unsupported version %d", filename.c_str(), (int) header.version);
+		return NULL;
+	}
+	if (!isTableValid(file.size, header.moduleTableOffset, header.moduleCount, sizeof(BinpatchModule))
+		|| !isTableValid(file.size, header.wireTableOffset, header.wireCount, sizeof(BinpatchWire))
+		|| !isTableValid(file.size, header.chunkTableOffset, header.chunkCount, sizeof(BinpatchChunk))) {
+		warn("Binary patch %s has an invalid table", filename.c_str());
+		return NULL;
+	}
+
+	BinpatchReader reader;
+	reader.data = file.data;
+	reader.size = file.size;
+	reader.chunks = (const BinpatchChunk*) (file.data + header.chunkTableOffset);
+	reader.chunkCount = header.chunkCount;
+	reader.escapedKeys = (header.version >= 2);
+
+	// root
+	json_t *rootJ = reader.loadJsonChunk(header.rootChunk);
+	if (!json_is_object(rootJ)) {
+		warn("Binary patch %s has an invalid root object", filename.c_str());
+		json_decref(rootJ);
+		return NULL;
+	}
+
+	// modules
+	const BinpatchModule *modules = (const BinpatchModule*) (file.data + header.moduleTableOffset);
+	json_t *modulesJ = json_array();
+	for (uint32_t i = 0; i < header.moduleCount; i++) {
+		json_t *moduleJ = reader.loadJsonChunk(littleEndian(modules[i]).chunk);
+		if (!moduleJ) {
+			json_decref(modulesJ);
+			json_decref(rootJ);
+			return NULL;
+		}
+		json_array_append_new(modulesJ, moduleJ);
+	}
+	if (header.flags & BINPATCH_MODULES)
+		json_object_set_new(rootJ, "modules", modulesJ);
+	else
+		json_decref(modulesJ);
+
+	// wires
+	const BinpatchWire *wires = (const BinpatchWire*) (file.data + header.wireTableOffset);
+	json_t *wiresJ = json_array();
+	for (uint32_t i = 0; i < header.wireCount; i++) {
+		BinpatchWire wire = littleEndian(wires[i]);
+		json_t *wireJ = reader.loadJsonChunk(wire.chunk);
+		if (!wireJ) {
+			json_decref(wiresJ);
+			json_decref(rootJ);
+			return NULL;
+		}
+		if (json_is_object(wireJ) && (wire.flags & BINPATCH_WIRE_PORTS)) {
+			json_object_set_new(wireJ, "outputModuleId", json_integer(wire.outputModuleId));
+			json_object_set_new(wireJ, "outputId", json_integer(wire.outputId));
+			json_object_set_new(wireJ, "inputModuleId", json_integer(wire.inputModuleId));
+			json_object_set_new(wireJ, "inputId", json_integer(wire.inputId));
+		}
+		json_array_append_new(wiresJ, wireJ);
+	}
+	if (header.flags & BINPATCH_WIRES)
+		json_object_set_new(rootJ, "wires", wiresJ);
+	else
+		json_decref(wiresJ);
+
+	return rootJ;
+}
+
+
+} // namespace rack
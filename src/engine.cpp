@@ -3,13 +3,16 @@
 #include <assert.h>
 #include <math.h>
 #include <vector>
+#include <map>
 #include <algorithm>
 #include <chrono>
 #include <thread>
+#include <atomic>
 #include <xmmintrin.h>
 #include <pmmintrin.h>
 
 #include "engine.hpp"
+#include "dsp/mpscqueue.hpp"
 
 
 namespace rack {
@@ -18,6 +21,7 @@ bool gPaused = false;
 std::vector<Module*> gModules;
 std::vector<Wire*> gWires;
 bool gPowerMeter = false;
+std::atomic<int> gStateGeneration(0);
 
 static bool running = false;
 static float sampleRate = 44100.f;
@@ -31,10 +35,36 @@ static std::mutex mutex;
 static std::thread thread;
 static VIPMutex vipMutex;
 
+static std::atomic<bool> snapshotRequested(false);
+
 // Parameter interpolation
-static Module *smoothModule = NULL;
-static int smoothParamId;
-static float smoothValue;
+struct ParamChange {
+	Module *module;
+	int paramId;
+	float value;
+};
+
+/** Smoothed param changes, drained by the engine thread before each block. Only consumed with `mutex` locked. */
+static MPSCQueue<ParamChange, 1024> paramQueue;
+
+/** Latest value of each param changed while the queue was full, keyed by (module, paramId)
+While `paramOverflowed` is set, new changes go here instead of the queue, so they are applied after everything already queued.
+*/
+static std::map<std::pair<Module*, int>, float> paramOverflow;
+static std::mutex paramOverflowMutex;
+static std::atomic<bool> paramOverflowed(false);
+
+/** Params moving toward a target value, stored as parallel arrays so the smoothing loop stays tight
+`smoothValues` is a contiguous copy of the current values, so the arithmetic can be vectorized.
+Only accessed with `mutex` locked.
+*/
+static std::vector<Module*> smoothModules;
+static std::vector<float*> smoothParams;
+static std::vector<float> smoothValues;
+static std::vector<float> smoothTargets;
+
+/** Number of frames the engine steps each time it locks `mutex`, and the period of param smoothing */
+static const int BLOCK_FRAMES = 64;
 
 
 float Light::getBrightness() {
@@ -56,13 +86,84 @@ void Light::setBrightnessSmooth(float brightness, float frames) {
 }
 
 
+void ModuleSnapshot::resize(Module *module) {
+	numLights = module->lights.size();
+	numInputs = module->inputs.size();
+	numOutputs = module->outputs.size();
+	buffers[0].assign(size(), 0.f);
+	buffers[1].assign(size(), 0.f);
+	sequence = 0;
+}
+
+void ModuleSnapshot::write(Module *module) {
+	uint32_t s = sequence.load(std::memory_order_relaxed);
+	std::vector<float> &buffer = buffers[(s + 1) % 2];
+	// This buffer was the latest before the last write() published `s`.
+	// A release store only orders the writes before it, so without this fence the writes below could become visible before `s` does, and a reader which still sees `s - 1` would copy a torn buffer.
+	std::atomic_thread_fence(std::memory_order_release);
+	for (int i = 0; i < numLights; i++) {
+		buffer[lightOffset(i)] = module->lights[i].getBrightness();
+	}
+	for (int i = 0; i < numInputs; i++) {
+		Input &input = module->inputs[i];
+		buffer[inputPlugLightOffset(i) + 0] = input.plugLights[0].getBrightness();
+		buffer[inputPlugLightOffset(i) + 1] = input.plugLights[1].getBrightness();
+		buffer[inputVoltageOffset(i)] = input.voltages[0];
+	}
+	for (int i = 0; i < numOutputs; i++) {
+		Output &output = module->outputs[i];
+		buffer[outputPlugLightOffset(i) + 0] = output.plugLights[0].getBrightness();
+		buffer[outputPlugLightOffset(i) + 1] = output.plugLights[1].getBrightness();
+		buffer[outputVoltageOffset(i)] = output.voltages[0];
+	}
+	buffer[cpuTimeOffset()] = module->cpuTime;
+	sequence.store(s + 1, std::memory_order_release);
+}
+
+bool ModuleSnapshot::read(int offset, float *values, int count) {
+	// The module hasn't been added to the engine, or its lights or ports changed since
+	if (offset < 0 || offset + count > size())
+		return false;
+	while (true) {
+		uint32_t s = sequence.load(std::memory_order_acquire);
+		if (s == 0)
+			return false;
+		const std::vector<float> &buffer = buffers[s % 2];
+		for (int i = 0; i < count; i++) {
+			values[i] = buffer[offset + i];
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		// The engine only starts overwriting this buffer after publishing the other one
+		if (sequence.load(std::memory_order_relaxed) == s)
+			return true;
+	}
+}
+
+
 void Wire::step() {
-	float value = outputModule->outputs[outputId].value;
-	inputModule->inputs[inputId].value = value;
+	Output &output = outputModule->outputs[outputId];
+	Input &input = inputModule->inputs[inputId];
+	int channels = output.channels;
+	// Most wires are monophonic
+	input.voltages[0] = output.voltages[0];
+	for (int c = 1; c < channels; c++) {
+		input.voltages[c] = output.voltages[c];
+	}
+	// Zero the channels the output stopped carrying, like Output::setChannels() does
+	for (int c = channels; c < input.channels; c++) {
+		input.voltages[c] = 0.f;
+	}
+	input.channels = channels;
 }
 
 
 void engineInit() {
+	paramQueue.clear();
+	// Avoid allocating on the engine thread unless many params move at once
+	smoothModules.reserve(256);
+	smoothParams.reserve(256);
+	smoothValues.reserve(256);
+	smoothTargets.reserve(256);
 }
 
 void engineDestroy() {
@@ -71,6 +172,137 @@ void engineDestroy() {
 	assert(gModules.empty());
 }
 
+static void updateActive();
+
+
+/** Seconds of silence before a module with sleepWhenSilent sleeps */
+static const float SLEEP_SILENCE_TIME = 1.f;
+/** Voltages below this are considered silent */
+static const float SLEEP_SILENCE_THRESHOLD = 1e-6f;
+
+
+static bool isPortSilent(const float *voltages, int channels) {
+	for (int c = 0; c < channels; c++) {
+		if (std::fabs(voltages[c]) > SLEEP_SILENCE_THRESHOLD)
+			return false;
+	}
+	return true;
+}
+
+/** Returns whether step() can be skipped on this frame */
+static bool isModuleAsleep(Module *module) {
+	if (module->bypassed || module->unused)
+		return true;
+
+	if (module->sleepWhenSilent) {
+		bool silent = !module->paramChanged;
+		module->paramChanged = false;
+		for (Input &input : module->inputs) {
+			if (!silent)
+				break;
+			if (input.active && !isPortSilent(input.voltages, input.channels))
+				silent = false;
+		}
+		// While asleep the outputs are zeroed, so this only delays sleeping until any tail has decayed
+		for (Output &output : module->outputs) {
+			if (!silent)
+				break;
+			if (!isPortSilent(output.voltages, output.channels))
+				silent = false;
+		}
+
+		if (!silent) {
+			module->silentTime = 0.f;
+			return false;
+		}
+		if (module->silentTime < SLEEP_SILENCE_TIME) {
+			module->silentTime += sampleTime;
+			return false;
+		}
+		return true;
+	}
+	return false;
+}
+
+static void setSmoothTarget(Module *module, int paramId, float value) {
+	float *param = &module->params[paramId].value;
+	module->paramChanged = true;
+	auto it = std::find(smoothParams.begin(), smoothParams.end(), param);
+	if (it != smoothParams.end()) {
+		smoothTargets[it - smoothParams.begin()] = value;
+	}
+	else {
+		smoothModules.push_back(module);
+		smoothParams.push_back(param);
+		smoothValues.push_back(*param);
+		smoothTargets.push_back(value);
+	}
+}
+
+/** Moves queued param changes into the smoothing table. Must be called with `mutex` locked. */
+static void applyParamChanges() {
+	while (ParamChange *front = paramQueue.front()) {
+		ParamChange change = *front;
+		paramQueue.pop();
+		setSmoothTarget(change.module, change.paramId, change.value);
+	}
+
+	// Overflowed changes are newer than everything drained above
+	if (paramOverflowed.load(std::memory_order_acquire)) {
+		// Don't wait for a setter on the engine thread. Until the table is drained, new changes keep coalescing into it.
+		std::unique_lock<std::mutex> lock(paramOverflowMutex, std::try_to_lock);
+		if (lock.owns_lock()) {
+			for (const auto &pair : paramOverflow) {
+				setSmoothTarget(pair.first.first, pair.first.second, pair.second);
+			}
+			paramOverflow.clear();
+			paramOverflowed.store(false, std::memory_order_release);
+		}
+	}
+}
+
+/** Moves smoothed params `frames` frames toward their targets
+Params are updated once per block rather than every frame. The exponential decay over the block is applied in one step, so the trajectory matches per-frame smoothing at the block boundaries.
+*/
+static void stepParamSmoothing(int frames) {
+	const float lambda = 60.0; // decay rate is 1 graphics frame
+	const float k = 1.f - std::pow(1.f - lambda * sampleTime, (float) frames);
+	size_t n = smoothParams.size();
+	if (n == 0)
+		return;
+
+	// Read back the current values, since engineSetParam() may have set a param directly
+	for (size_t i = 0; i < n; i++) {
+		smoothValues[i] = *smoothParams[i];
+	}
+	float *values = smoothValues.data();
+	const float *targets = smoothTargets.data();
+	for (size_t i = 0; i < n; i++) {
+		values[i] += (targets[i] - values[i]) * k;
+	}
+
+	for (size_t i = 0; i < n;) {
+		if (*smoothParams[i] == smoothValues[i]) {
+			// Snap to actual smooth value if the value doesn't change enough (due to the granularity of floats)
+			*smoothParams[i] = smoothTargets[i];
+			// Remove by swapping with the last entry
+			n--;
+			smoothModules[i] = smoothModules[n];
+			smoothParams[i] = smoothParams[n];
+			smoothValues[i] = smoothValues[n];
+			smoothTargets[i] = smoothTargets[n];
+		}
+		else {
+			*smoothParams[i] = smoothValues[i];
+			i++;
+		}
+	}
+	smoothModules.resize(n);
+	smoothParams.resize(n);
+	smoothValues.resize(n);
+	smoothTargets.resize(n);
+}
+
 static void engineStep() {
 	// Sample rate
 	if (sampleRateRequested != sampleRate) {
@@ -91,29 +323,35 @@ static void engineStep() {
 		randomizeModule = NULL;
 	}
 
-	// Param smoothing
-	{
-		Module *localSmoothModule = smoothModule;
-		int localSmoothParamId = smoothParamId;
-		float localSmoothValue = smoothValue;
-		if (localSmoothModule) {
-			float value = localSmoothModule->params[localSmoothParamId].value;
-			const float lambda = 60.0; // decay rate is 1 graphics frame
-			float delta = localSmoothValue - value;
-			float newValue = value + delta * lambda * sampleTime;
-			if (value == newValue) {
-				// Snap to actual smooth value if the value doesn't change enough (due to the granularity of floats)
-				localSmoothModule->params[localSmoothParamId].value = localSmoothValue;
-				smoothModule = NULL;
-			}
-			else {
-				localSmoothModule->params[localSmoothParamId].value = newValue;
+	// Step modules
+	for (Module *module : gModules) {
+		if (isModuleAsleep(module)) {
+			if (!module->sleeping) {
+				module->sleeping = true;
+				for (Output &output : module->outputs) {
+					for (int c = 0; c < output.channels; c++) {
+						output.voltages[c] = 0.f;
+					}
+				}
+				// Turn off the lights, so the GUI doesn't show them frozen at their last brightness
+				for (Light &light : module->lights) {
+					light.value = 0.f;
+				}
+				for (Input &input : module->inputs) {
+					input.plugLights[0].value = 0.f;
+					input.plugLights[1].value = 0.f;
+				}
+				for (Output &output : module->outputs) {
+					output.plugLights[0].value = 0.f;
+					output.plugLights[1].value = 0.f;
+				}
 			}
+			if (gPowerMeter)
+				module->cpuTime -= module->cpuTime * sampleTime / 0.5f;
+			continue;
 		}
-	}
+		module->sleeping = false;
 
-	// Step modules
-	for (Module *module : gModules) {
 		std::chrono::high_resolution_clock::time_point startTime;
 		if (gPowerMeter) {
 			startTime = std::chrono::high_resolution_clock::now();
@@ -131,14 +369,14 @@ static void engineStep() {
 		// Step ports
 		for (Input &input : module->inputs) {
 			if (input.active) {
-				float value = input.value / 5.f;
+				float value = input.voltages[0] / 5.f;
 				input.plugLights[0].setBrightnessSmooth(value);
 				input.plugLights[1].setBrightnessSmooth(-value);
 			}
 		}
 		for (Output &output : module->outputs) {
 			if (output.active) {
-				float value = output.value / 5.f;
+				float value = output.voltages[0] / 5.f;
 				output.plugLights[0].setBrightnessSmooth(value);
 				output.plugLights[1].setBrightnessSmooth(-value);
 			}
@@ -158,7 +396,7 @@ static void engineRun() {
 	_MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
 
 	// Every time the engine waits and locks a mutex, it steps this many frames
-	const int mutexSteps = 64;
+	const int mutexSteps = BLOCK_FRAMES;
 	// Time in seconds that the engine is rushing ahead of the estimated clock time
 	double ahead = 0.0;
 	auto lastTime = std::chrono::high_resolution_clock::now();
@@ -166,10 +404,20 @@ static void engineRun() {
 	while (running) {
 		vipMutex.wait();
 
-		if (!gPaused) {
+		{
 			std::lock_guard<std::mutex> lock(mutex);
-			for (int i = 0; i < mutexSteps; i++) {
-				engineStep();
+			// Keep draining the param queue while paused, so it doesn't fill up
+			applyParamChanges();
+			if (!gPaused) {
+				stepParamSmoothing(mutexSteps);
+				for (int i = 0; i < mutexSteps; i++) {
+					engineStep();
+				}
+				if (snapshotRequested.exchange(false)) {
+					for (Module *module : gModules) {
+						module->snapshot.write(module);
+					}
+				}
 			}
 		}
 
@@ -200,6 +448,19 @@ void engineStop() {
 	thread.join();
 }
 
+void engineStepFrames(int frames) {
+	assert(!running);
+	std::lock_guard<std::mutex> lock(mutex);
+	applyParamChanges();
+	for (int i = 0; i < frames; i += BLOCK_FRAMES) {
+		int blockFrames = std::min(frames - i, BLOCK_FRAMES);
+		stepParamSmoothing(blockFrames);
+		for (int j = 0; j < blockFrames; j++) {
+			engineStep();
+		}
+	}
+}
+
 void engineAddModule(Module *module) {
 	assert(module);
 	VIPLock vipLock(vipMutex);
@@ -207,16 +468,40 @@ void engineAddModule(Module *module) {
 	// Check that the module is not already added
 	auto it = std::find(gModules.begin(), gModules.end(), module);
 	assert(it == gModules.end());
+	module->snapshot.resize(module);
 	gModules.push_back(module);
+	updateActive();
+	gStateGeneration++;
 }
 
 void engineRemoveModule(Module *module) {
 	assert(module);
 	VIPLock vipLock(vipMutex);
 	std::lock_guard<std::mutex> lock(mutex);
-	// If a param is being smoothed on this module, stop smoothing it immediately
-	if (module == smoothModule) {
-		smoothModule = NULL;
+	// Drop queued and overflowed changes to this module, so none of them refer to it after it is deleted.
+	// Changes to other modules are applied early, which is harmless.
+	// Callers must not set params of the module after removing it.
+	applyParamChanges();
+	{
+		std::lock_guard<std::mutex> overflowLock(paramOverflowMutex);
+		for (auto it = paramOverflow.begin(); it != paramOverflow.end();) {
+			if (it->first.first == module)
+				it = paramOverflow.erase(it);
+			else
+				it++;
+		}
+	}
+	// If params are being smoothed on this module, stop smoothing them immediately
+	for (size_t i = 0; i < smoothModules.size();) {
+		if (smoothModules[i] == module) {
+			smoothModules.erase(smoothModules.begin() + i);
+			smoothParams.erase(smoothParams.begin() + i);
+			smoothValues.erase(smoothValues.begin() + i);
+			smoothTargets.erase(smoothTargets.begin() + i);
+		}
+		else {
+			i++;
+		}
 	}
 	// Check that all wires are disconnected
 	for (Wire *wire : gWires) {
@@ -228,14 +513,17 @@ void engineRemoveModule(Module *module) {
 	assert(it != gModules.end());
 	// Remove it
 	gModules.erase(it);
+	gStateGeneration++;
 }
 
 void engineResetModule(Module *module) {
 	resetModule = module;
+	gStateGeneration++;
 }
 
 void engineRandomizeModule(Module *module) {
 	randomizeModule = module;
+	gStateGeneration++;
 }
 
 static void updateActive() {
@@ -253,6 +541,18 @@ static void updateActive() {
 		wire->outputModule->outputs[wire->outputId].active = true;
 		wire->inputModule->inputs[wire->inputId].active = true;
 	}
+	// Find modules which can sleep because nothing is connected
+	for (Module *module : gModules) {
+		module->unused = module->sleepWhenUnused && !module->outputs.empty() && module->lights.empty();
+		for (Input &input : module->inputs) {
+			if (input.active)
+				module->unused = false;
+		}
+		for (Output &output : module->outputs) {
+			if (output.active)
+				module->unused = false;
+		}
+	}
 }
 
 void engineAddWire(Wire *wire) {
@@ -270,6 +570,7 @@ void engineAddWire(Wire *wire) {
 	// Add the wire
 	gWires.push_back(wire);
 	updateActive();
+	gStateGeneration++;
 }
 
 void engineRemoveWire(Wire *wire) {
@@ -279,25 +580,41 @@ void engineRemoveWire(Wire *wire) {
 	// Check that the wire is already added
 	auto it = std::find(gWires.begin(), gWires.end(), wire);
 	assert(it != gWires.end());
-	// Set input to 0V
-	wire->inputModule->inputs[wire->inputId].value = 0.0;
+	// Set input to 0V on all channels
+	Input &input = wire->inputModule->inputs[wire->inputId];
+	for (int c = 0; c < input.channels; c++) {
+		input.voltages[c] = 0.f;
+	}
+	input.channels = 1;
 	// Remove the wire
 	gWires.erase(it);
 	updateActive();
+	gStateGeneration++;
 }
 
 void engineSetParam(Module *module, int paramId, float value) {
 	module->params[paramId].value = value;
+	module->paramChanged = true;
+	gStateGeneration++;
 }
 
 void engineSetParamSmooth(Module *module, int paramId, float value) {
-	// If another param is being smoothed, jump value
-	if (smoothModule && !(smoothModule == module && smoothParamId == paramId)) {
-		smoothModule->params[smoothParamId].value = smoothValue;
-	}
-	smoothParamId = paramId;
-	smoothValue = value;
-	smoothModule = module;
+	ParamChange change;
+	change.module = module;
+	change.paramId = paramId;
+	change.value = value;
+	gStateGeneration++;
+	// The engine drains the queue before every block, even while paused, so it can only fill up if over a thousand changes are made within one block.
+	// Once it has, keep coalescing changes into the overflow table until the engine drains it, so an older overflowed value can't undo a newer queued one.
+	if (!paramOverflowed.load(std::memory_order_acquire) && paramQueue.push(change))
+		return;
+	std::lock_guard<std::mutex> lock(paramOverflowMutex);
+	paramOverflow[std::make_pair(module, paramId)] = value;
+	paramOverflowed.store(true, std::memory_order_release);
+}
+
+void engineRequestSnapshot() {
+	snapshotRequested = true;
 }
 
 void engineSetSampleRate(float newSampleRate) {
@@ -81,6 +81,7 @@ int main(int argc, char* argv[]) {
 	appInit(devMode);
 	settingsLoad(assetLocal("settings.json"));
 
+	std::string loadPath;
 	if (patchFile.empty()) {
 		// To prevent launch crashes, if Rack crashes between now and 15 seconds from now, the "skipAutosaveOnLaunch" property will remain in settings.json, so that in the next launch, the broken autosave will not be loaded.
 		bool oldSkipAutosaveOnLaunch = gSkipAutosaveOnLaunch;
@@ -91,24 +92,31 @@ int main(int argc, char* argv[]) {
 			gRackWidget->lastPath = "";
 		}
 		else {
-			// Load autosave
-			std::string oldLastPath = gRackWidget->lastPath;
-			gRackWidget->load(assetLocal("autosave.vcv"));
-			gRackWidget->lastPath = oldLastPath;
+			// Load autosave, keeping lastPath
+			loadPath = assetLocal("autosave.vcv");
 		}
 	}
 	else {
 		// Load patch
-		gRackWidget->load(patchFile);
+		loadPath = patchFile;
 		gRackWidget->lastPath = patchFile;
 	}
+	if (!loadPath.empty()) {
+		// The patch may use plugins whose packages are still being extracted, so RackWidget::step() loads it once they are loaded
+		if (pluginIsExtracting())
+			gRackWidget->pendingPath = loadPath;
+		else
+			gRackWidget->load(loadPath);
+	}
 
 	engineStart();
 	windowRun();
 	engineStop();
 
 	// Destroy namespaces
-	gRackWidget->save(assetLocal("autosave.vcv"));
+	// If Rack quit before the patch was loaded, the autosave still holds it
+	if (gRackWidget->pendingPath.empty())
+		gRackWidget->save(assetLocal("autosave.vcv"));
 	settingsSave(assetLocal("settings.json"));
 	appDestroy();
 	windowDestroy();
@@ -3,6 +3,9 @@
 #include "bridge.hpp"
 #include "gamepad.hpp"
 #include "keyboard.hpp"
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 
 namespace rack {
@@ -11,6 +14,33 @@ namespace rack {
 static std::vector<int> driverIds;
 static std::map<int, MidiDriver*> drivers;
 
+/** Locks `outputs`, `outputRunning`, and the devices of MidiOutputs */
+static std::mutex outputMutex;
+/** Notified when `outputs` becomes non-empty or the output thread should stop */
+static std::condition_variable outputCv;
+/** MidiOutputs with a device, flushed by the output thread */
+static std::set<MidiOutput*> outputs;
+static std::thread outputThread;
+static bool outputRunning = false;
+
+
+static void midiOutputRun() {
+	std::unique_lock<std::mutex> lock(outputMutex);
+	while (outputRunning) {
+		// Sleep until a MidiOutput has a device
+		if (outputs.empty()) {
+			outputCv.wait(lock);
+			continue;
+		}
+		for (MidiOutput *midiOutput : outputs) {
+			midiOutput->flush();
+		}
+		lock.unlock();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		lock.lock();
+	}
+}
+
 
 ////////////////////
 // MidiDevice
@@ -28,11 +58,26 @@ void MidiInputDevice::unsubscribe(MidiInput *midiInput) {
 }
 
 void MidiInputDevice::onMessage(MidiMessage message) {
+	if (message.timestamp == 0.0) {
+		auto now = std::chrono::steady_clock::now().time_since_epoch();
+		message.timestamp = std::chrono::duration<double>(now).count();
+	}
 	for (MidiInput *midiInput : subscribed) {
 		midiInput->onMessage(message);
 	}
 }
 
+void MidiOutputDevice::subscribe(MidiOutput *midiOutput) {
+	subscribed.insert(midiOutput);
+}
+
+void MidiOutputDevice::unsubscribe(MidiOutput *midiOutput) {
+	// Remove MidiOutput from subscriptions
+	auto it = subscribed.find(midiOutput);
+	if (it != subscribed.end())
+		subscribed.erase(it);
+}
+
 ////////////////////
 // MidiDriver
 ////////////////////
@@ -183,15 +228,89 @@ bool MidiInputQueue::shift(MidiMessage *message) {
 // MidiOutput
 ////////////////////
 
-MidiOutput::MidiOutput() {
+MidiOutput::MidiOutput() : queueStart(0), queueEnd(0) {
+	if (driverIds.size() >= 1) {
+		setDriverId(driverIds[0]);
+	}
 }
 
 MidiOutput::~MidiOutput() {
 	setDriverId(-1);
 }
 
+std::vector<int> MidiOutput::getDeviceIds() {
+	if (driver) {
+		return driver->getOutputDeviceIds();
+	}
+	return {};
+}
+
+std::string MidiOutput::getDeviceName(int deviceId) {
+	if (driver) {
+		return driver->getOutputDeviceName(deviceId);
+	}
+	return "";
+}
+
 void MidiOutput::setDeviceId(int deviceId) {
-	// TODO
+	// Stop the output thread from flushing to the old device
+	{
+		std::lock_guard<std::mutex> lock(outputMutex);
+		outputs.erase(this);
+		device = NULL;
+	}
+
+	// Opening and closing devices can take a while, so the output thread keeps flushing other MidiOutputs meanwhile
+	// Destroy device
+	if (driver && this->deviceId >= 0) {
+		driver->unsubscribeOutputDevice(this->deviceId, this);
+	}
+	this->deviceId = -1;
+
+	// Create device
+	MidiOutputDevice *newDevice = NULL;
+	if (driver && deviceId >= 0) {
+		newDevice = driver->subscribeOutputDevice(deviceId, this);
+		this->deviceId = deviceId;
+	}
+	if (newDevice) {
+		{
+			std::lock_guard<std::mutex> lock(outputMutex);
+			device = newDevice;
+			// Discard messages queued while there was no device
+			queueStart = queueEnd.load();
+			outputs.insert(this);
+			if (!outputRunning) {
+				outputRunning = true;
+				outputThread = std::thread(midiOutputRun);
+			}
+		}
+		outputCv.notify_one();
+	}
+}
+
+bool MidiOutput::sendMessage(MidiMessage message) {
+	// Set channel
+	if (channel >= 0 && message.status() != 0xf) {
+		message.cmd = (message.cmd & 0xf0) | channel;
+	}
+
+	size_t end = queueEnd.load(std::memory_order_relaxed);
+	if (end - queueStart.load(std::memory_order_acquire) >= QUEUE_SIZE)
+		return false;
+	queue[end % QUEUE_SIZE] = message;
+	queueEnd.store(end + 1, std::memory_order_release);
+	return true;
+}
+
+void MidiOutput::flush() {
+	size_t start = queueStart.load(std::memory_order_relaxed);
+	size_t end = queueEnd.load(std::memory_order_acquire);
+	for (; start != end; start++) {
+		if (device)
+			device->sendMessage(queue[start % QUEUE_SIZE]);
+	}
+	queueStart.store(start, std::memory_order_release);
 }
 
 ////////////////////
@@ -199,6 +318,14 @@ void MidiOutput::setDeviceId(int deviceId) {
 ////////////////////
 
 void midiDestroy() {
+	{
+		std::lock_guard<std::mutex> lock(outputMutex);
+		outputRunning = false;
+	}
+	outputCv.notify_one();
+	if (outputThread.joinable())
+		outputThread.join();
+
 	driverIds.clear();
 	for (auto &pair : drivers) {
 		delete pair.second;
@@ -0,0 +1,134 @@
+#include "midi.hpp"
+#include <chrono>
+
+
+namespace rack {
+
+
+void MidiClock::reset() {
+	running = false;
+	receivedTicks = 0;
+	outputTicks = 0;
+	phase = 0.0;
+	positionError = 0.0;
+	pendingTicks = 0;
+	latency = 0.0;
+	dllTicks = 0;
+}
+
+bool MidiClock::processMessage(MidiMessage message) {
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	return processMessage(message, std::chrono::duration<double>(now).count());
+}
+
+bool MidiClock::processMessage(MidiMessage message, double time) {
+	if (message.status() != 0xf)
+		return false;
+	switch (message.channel()) {
+		// Timing
+		case 0x8: {
+			double t = message.timestamp;
+			// Restart the loop if ticks stopped arriving for a while, since the period estimate is stale
+			if (dllTicks >= 2 && t - dllTime > 1.0)
+				dllTicks = 0;
+
+			if (dllTicks == 0) {
+				dllTime = t;
+			}
+			else if (dllTicks == 1) {
+				dllPeriod = t - dllTime;
+				dllTime = t + dllPeriod;
+			}
+			else {
+				// Second order DLL, from "Using a DLL to filter time" by Fons Adriaensen
+				double omega = 2.0 * M_PI * bandwidth * dllPeriod;
+				double error = t - dllTime;
+				dllTime += M_SQRT2 * omega * error + dllPeriod;
+				dllPeriod += omega * omega * error;
+			}
+			dllTicks++;
+
+			receivedTicks++;
+			if (!isLocked() || dllPeriod <= 0.0) {
+				// Pass ticks through until the period is known
+				outputTicks = receivedTicks;
+				phase = 0.0;
+				positionError = 0.0;
+				pendingTicks++;
+			}
+			else {
+				// dllTime is the filtered time of the next tick, so this tick's filtered time is one period earlier
+				double lateness = time - (dllTime - dllPeriod);
+				latency = std::max(lateness, latency - latencyDecay * dllPeriod);
+				// The filtered position of the clock at `time - latency`
+				double position = receivedTicks + 1 - (dllTime - (time - latency)) / dllPeriod;
+				positionError = position - getPosition();
+			}
+		} break;
+		// Start
+		case 0xa: {
+			running = true;
+			receivedTicks = 0;
+			outputTicks = 0;
+			phase = 0.0;
+			positionError = 0.0;
+			pendingTicks = 0;
+		} break;
+		// Continue
+		case 0xb: {
+			running = true;
+		} break;
+		// Stop
+		case 0xc: {
+			running = false;
+		} break;
+		default: return false;
+	}
+	return true;
+}
+
+bool MidiClock::process(float deltaTime) {
+	if (isLocked() && dllPeriod > 0.0) {
+		if (std::fabs(positionError) > 4.0) {
+			// Too far off to correct smoothly, e.g. after a song position change
+			pendingTicks += std::max<int64_t>(receivedTicks - outputTicks, 0);
+			outputTicks = receivedTicks;
+			phase = 0.0;
+			positionError = 0.0;
+		}
+		else {
+			// Run slightly faster or slower until the position error is corrected
+			double rate = 1.0 + clamp((float) (positionError * phaseGain * dllPeriod), -0.5f, 0.5f);
+			double delta = deltaTime / dllPeriod;
+			phase += delta * rate;
+			positionError -= delta * (rate - 1.0);
+			if (phase >= 1.0) {
+				// Don't regenerate a tick before it is received.
+				// If it is later than `latency`, hold until it arrives. The next position error makes up for the lost time.
+				if (outputTicks < receivedTicks) {
+					phase -= 1.0;
+					outputTicks++;
+					pendingTicks++;
+				}
+				else {
+					phase = 1.0;
+				}
+			}
+		}
+	}
+
+	if (pendingTicks > 0) {
+		pendingTicks--;
+		return true;
+	}
+	return false;
+}
+
+float MidiClock::getTempo() {
+	if (!isLocked() || dllPeriod <= 0.0)
+		return 0.f;
+	return 60.0 / (24.0 * dllPeriod);
+}
+
+
+} // namespace rack
@@ -12,11 +12,17 @@
 #include <sys/stat.h>
 #include <sys/param.h> // for MAXPATHLEN
 #include <fcntl.h>
+#include <utime.h>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <set>
 #include <stdexcept>
 
 #define ZIP_STATIC
 #include <zip.h>
+#include <zlib.h>
 #include <jansson.h>
 
 #if ARCH_WIN
@@ -37,10 +43,50 @@ std::string gToken;
 
 
 static bool isDownloading = false;
-static float downloadProgress = 0.0;
+/** Written by the extraction threads while the UI thread reads it */
+static std::atomic<float> downloadProgress(0.f);
 static std::string downloadName;
 static std::string loginStatus;
 
+/** Extracts the packages found by pluginInit() in the background, so launching doesn't wait for it */
+static std::thread extractThread;
+/** Set by the extraction thread when it finishes */
+static std::atomic<bool> extractDone(false);
+/** Whether the plugins in `extractDirectories` are waiting to be loaded by pluginStep() */
+static bool extractPending = false;
+/** Top-level directories of the packages being extracted, which are not loaded until extraction finishes */
+static std::set<std::string> extractDirectories;
+/** Packages which failed to extract, written by the extraction thread before it sets `extractDone` */
+static std::string extractMessage;
+
+typedef std::pair<std::string, std::string> ModelKey;
+
+struct ModelKeyHash {
+	size_t operator()(const ModelKey &key) const {
+		std::hash<std::string> hash;
+		return hash(key.first) ^ (hash(key.second) * 31);
+	}
+};
+
+/** Lookup tables for pluginGetPlugin() and pluginGetModel(), containing the plugins in gPlugins
+If a plugin registers two models with the same slug, the first one is returned.
+*/
+static std::unordered_map<std::string, Plugin*> pluginIndex;
+static std::unordered_map<ModelKey, Model*, ModelKeyHash> modelIndex;
+
+/** Number of plugins downloaded at the same time by pluginSync() */
+static const int MAX_DOWNLOADS = 4;
+
+struct PluginDownload {
+	std::string slug;
+	std::string name;
+	RequestDownload request;
+};
+
+/** Downloads queued by pluginSync(), guarded by downloadsMutex so the UI thread can poll and cancel them */
+static std::vector<PluginDownload*> downloads;
+static std::mutex downloadsMutex;
+
 
 Plugin::~Plugin() {
 	for (Model *model : models) {
@@ -52,12 +98,25 @@ void Plugin::addModel(Model *model) {
 	assert(!model->plugin);
 	model->plugin = this;
 	models.push_back(model);
+	// Models added after the plugin has been registered are indexed here
+	auto it = pluginIndex.find(slug);
+	if (it != pluginIndex.end() && it->second == this)
+		modelIndex.emplace(ModelKey(slug, model->slug), model);
 }
 
 ////////////////////
 // private API
 ////////////////////
 
+/** Adds the plugin to gPlugins and indexes its models */
+static void registerPlugin(Plugin *plugin) {
+	gPlugins.push_back(plugin);
+	pluginIndex[plugin->slug] = plugin;
+	for (Model *model : plugin->models) {
+		modelIndex.emplace(ModelKey(plugin->slug, model->slug), model);
+	}
+}
+
 static bool loadPlugin(std::string path) {
 	std::string libraryFilename;
 #if ARCH_LIN
@@ -121,7 +180,7 @@ static bool loadPlugin(std::string path) {
 	}
 
 	// Add plugin to list
-	gPlugins.push_back(plugin);
+	registerPlugin(plugin);
 	info("Loaded plugin %s %s from %s", plugin->slug.c_str(), plugin->version.c_str(), libraryFilename.c_str());
 
 	return true;
@@ -194,27 +253,67 @@ static bool syncPlugin(std::string slug, json_t *manifestJ, bool dryRun) {
 		return json_boolean_value(successJ);
 	}
 	else {
-		downloadName = name;
-		downloadProgress = 0.0;
-		info("Downloading plugin %s %s %s", slug.c_str(), latestVersion.c_str(), arch.c_str());
+		info("Queuing download of plugin %s %s %s", slug.c_str(), latestVersion.c_str(), arch.c_str());
+
+		// Queue zip download, which is performed by pluginSync() along with the other plugins
+		PluginDownload *download = new PluginDownload();
+		download->slug = slug;
+		download->name = name;
+		download->request.url = downloadUrl;
+		download->request.filename = assetLocal("plugins/" + slug + ".zip");
+		std::lock_guard<std::mutex> lock(downloadsMutex);
+		downloads.push_back(download);
+		return true;
+	}
+}
 
-		// Download zip
-		std::string pluginDest = assetLocal("plugins/" + slug + ".zip");
-		if (!requestDownload(downloadUrl, pluginDest, &downloadProgress)) {
-			warn("Plugin %s download was unsuccessful", slug.c_str());
-			return false;
+/** Performs all downloads queued by syncPlugin() and returns true if any succeeded */
+static bool downloadPlugins() {
+	std::vector<RequestDownload*> requests;
+	{
+		std::lock_guard<std::mutex> lock(downloadsMutex);
+		if (downloads.size() == 1)
+			downloadName = downloads[0]->name;
+		else
+			downloadName = stringf("%d plugins", (int) downloads.size());
+		for (PluginDownload *download : downloads) {
+			requests.push_back(&download->request);
 		}
+	}
 
-		downloadName = "";
-		return true;
+	requestDownloads(requests, MAX_DOWNLOADS);
+
+	bool success = false;
+	std::lock_guard<std::mutex> lock(downloadsMutex);
+	for (PluginDownload *download : downloads) {
+		if (download->request.success) {
+			info("Downloaded plugin %s", download->slug.c_str());
+			success = true;
+		}
+		else if (download->request.cancelled) {
+			info("Plugin %s download was cancelled", download->slug.c_str());
+		}
+		else {
+			warn("Plugin %s download was unsuccessful", download->slug.c_str());
+		}
+		delete download;
 	}
+	downloads.clear();
+	downloadName = "";
+	return success;
 }
 
-static void loadPlugins(std::string path) {
+/** Loads the plugins in `path`, or only those in `include` if given, skipping those in `exclude` */
+static void loadPlugins(std::string path, const std::set<std::string> *include, const std::set<std::string> *exclude) {
 	std::string message;
 	for (std::string pluginPath : systemListEntries(path)) {
 		if (!systemIsDirectory(pluginPath))
 			continue;
+		std::string dir = stringFilename(pluginPath);
+		if (include && !include->count(dir))
+			continue;
+		if (exclude && exclude->count(dir))
+			continue;
 		if (!loadPlugin(pluginPath)) {
 			message += stringf("Could not load plugin %s\n", pluginPath.c_str());
 		}
@@ -225,9 +324,23 @@ static void loadPlugins(std::string path) {
 	}
 }
 
+/** Returns true if `path` already has the size and modification time of the zip entry, i.e. it was extracted by a previous launch */
+static bool isZipEntryExtracted(const char *path, const zip_stat_t &zs) {
+	if (!((zs.valid & ZIP_STAT_SIZE) && (zs.valid & ZIP_STAT_MTIME)))
+		return false;
+	struct stat statbuf;
+	if (stat(path, &statbuf))
+		return false;
+	return (zip_uint64_t) statbuf.st_size == zs.size && statbuf.st_mtime == zs.mtime;
+}
+
 /** Returns 0 if successful */
 static int extractZipHandle(zip_t *za, const char *dir) {
 	int err;
+	// Stream entries through one large buffer rather than many small reads and writes
+	const size_t bufferSize = 1 << 20;
+	std::vector<char> buffer(bufferSize);
+
 	for (int i = 0; i < zip_get_num_entries(za, 0); i++) {
 		zip_stat_t zs;
 		err = zip_stat_index(za, i, 0, &zs);
@@ -249,6 +362,9 @@ static int extractZipHandle(zip_t *za, const char *dir) {
 			}
 		}
 		else {
+			if (isZipEntryExtracted(path, zs))
+				continue;
+
 			zip_file_t *zf = zip_fopen_index(za, i, 0);
 			if (!zf) {
 				warn("zip_fopen_index() failed");
@@ -256,23 +372,63 @@ static int extractZipHandle(zip_t *za, const char *dir) {
 			}
 
 			FILE *outFile = fopen(path, "wb");
-			if (!outFile)
-				continue;
+			if (!outFile) {
+				warn("Could not open %s for writing: error %d", path, errno);
+				zip_fclose(zf);
+				return -1;
+			}
 
+			// Check the CRC while the entry is being written instead of in a second pass
+			uLong crc = crc32(0L, Z_NULL, 0);
+			bool readFailed = false;
+			bool writeFailed = false;
 			while (1) {
-				char buffer[1<<15];
-				int len = zip_fread(zf, buffer, sizeof(buffer));
-				if (len <= 0)
+				zip_int64_t len = zip_fread(zf, buffer.data(), bufferSize);
+				if (len < 0) {
+					warn("Could not read %s from zip: %s", zs.name, zip_file_strerror(zf));
+					readFailed = true;
 					break;
-				fwrite(buffer, 1, len, outFile);
+				}
+				if (len == 0)
+					break;
+				crc = crc32(crc, (const Bytef*) buffer.data(), len);
+				if (fwrite(buffer.data(), 1, len, outFile) != (size_t) len) {
+					writeFailed = true;
+					break;
+				}
 			}
 
 			err = zip_fclose(zf);
+			// Buffered data is written when the file is closed
+			if (fclose(outFile))
+				writeFailed = true;
+			if (writeFailed) {
+				warn("Could not write %s: error %d", path, errno);
+				remove(path);
+				return -1;
+			}
+			if (readFailed) {
+				remove(path);
+				return -1;
+			}
 			if (err) {
 				warn("zip_fclose() failed: error %d", err);
+				remove(path);
 				return err;
 			}
-			fclose(outFile);
+			if ((zs.valid & ZIP_STAT_CRC) && crc != zs.crc) {
+				warn("CRC mismatch for %s", path);
+				remove(path);
+				return -1;
+			}
+
+			// Stamp the entry's modification time so the next launch can skip it
+			if (zs.valid & ZIP_STAT_MTIME) {
+				struct utimbuf times;
+				times.actime = zs.mtime;
+				times.modtime = zs.mtime;
+				utime(path, &times);
+			}
 		}
 	}
 	return 0;
@@ -294,33 +450,102 @@ static int extractZip(const char *filename, const char *path) {
 	return err;
 }
 
-static void extractPackages(std::string path) {
-	std::string message;
+/** Adds the top-level directories of the zip's entries to `dirs` */
+static void listZipDirectories(const char *filename, std::set<std::string> &dirs) {
+	int err;
+	zip_t *za = zip_open(filename, 0, &err);
+	if (!za)
+		return;
+	defer({
+		zip_close(za);
+	});
 
-	for (std::string packagePath : systemListEntries(path)) {
-		if (stringExtension(packagePath) != "zip")
-			continue;
-		info("Extracting package %s", packagePath.c_str());
-		// Extract package
-		if (extractZip(packagePath.c_str(), path.c_str())) {
-			warn("Package %s failed to extract", packagePath.c_str());
-			message += stringf("Could not extract package %s\n", packagePath.c_str());
+	for (int i = 0; i < zip_get_num_entries(za, 0); i++) {
+		const char *name = zip_get_name(za, i, 0);
+		if (!name)
 			continue;
+		const char *slash = strchr(name, '/');
+		if (slash)
+			dirs.insert(std::string(name, slash - name));
+	}
+}
+
+/** Runs on `extractThread` */
+static void extractPackages(std::string path, std::vector<std::string> packagePaths) {
+	std::string message;
+	std::mutex messageMutex;
+	std::atomic<size_t> nextIndex(0);
+	std::atomic<size_t> extractedCount(0);
+
+	// Each worker opens its own zip handle, since libzip handles are not thread-safe
+	auto extractWorker = [&]() {
+		while (1) {
+			size_t i = nextIndex++;
+			if (i >= packagePaths.size())
+				break;
+			const std::string &packagePath = packagePaths[i];
+			info("Extracting package %s", packagePath.c_str());
+			// Extract package
+			if (extractZip(packagePath.c_str(), path.c_str())) {
+				warn("Package %s failed to extract", packagePath.c_str());
+				std::lock_guard<std::mutex> lock(messageMutex);
+				message += stringf("Could not extract package %s\n", packagePath.c_str());
+			}
+			// Remove package
+			else if (remove(packagePath.c_str())) {
+				warn("Could not delete file %s: error %d", packagePath.c_str(), errno);
+			}
+			downloadProgress = (float) ++extractedCount / packagePaths.size();
 		}
-		// Remove package
-		if (remove(packagePath.c_str())) {
-			warn("Could not delete file %s: error %d", packagePath.c_str(), errno);
-		}
+	};
+
+	int threadCount = clamp((int) std::thread::hardware_concurrency(), 1, (int) packagePaths.size());
+	std::vector<std::thread> threads;
+	for (int i = 0; i < threadCount; i++) {
+		threads.push_back(std::thread(extractWorker));
 	}
-	if (!message.empty()) {
-		osdialog_message(OSDIALOG_WARNING, OSDIALOG_OK, message.c_str());
+	for (std::thread &thread : threads) {
+		thread.join();
 	}
+
+	// Dialogs are shown by pluginStep() on the UI thread
+	extractMessage = message;
+	extractDone = true;
 }
 
 ////////////////////
 // public API
 ////////////////////
 
+/** Adds the SVGs in a directory and its subdirectories to `filenames`, until `bytes` runs out */
+static void listSVGs(std::string path, std::vector<std::string> &filenames, size_t &bytes) {
+	for (std::string entry : systemListEntries(path)) {
+		if (systemIsDirectory(entry)) {
+			listSVGs(entry, filenames, bytes);
+		}
+		else if (stringLowercase(stringExtension(entry)) == "svg") {
+			struct stat statbuf;
+			if (stat(entry.c_str(), &statbuf) || (size_t) statbuf.st_size > bytes)
+				continue;
+			bytes -= statbuf.st_size;
+			filenames.push_back(entry);
+		}
+	}
+}
+
+/** Parses the SVGs which plugins are likely to load in the background, so creating module widgets doesn't have to */
+static void prefetchSVGs() {
+	// Parsed SVGs take roughly as much memory as their text, so don't prefetch huge plugin collections entirely
+	size_t bytes = 64 << 20;
+	std::vector<std::string> filenames;
+	listSVGs(assetGlobal("res"), filenames, bytes);
+	for (Plugin *plugin : gPlugins) {
+		if (!plugin->path.empty())
+			listSVGs(plugin->path + "/res", filenames, bytes);
+	}
+	SVG::prefetch(filenames);
+}
+
 void pluginInit(bool devMode) {
 	tagsInit();
 
@@ -328,7 +553,7 @@ void pluginInit(bool devMode) {
 	// This function is defined in core.cpp
 	Plugin *corePlugin = new Plugin();
 	init(corePlugin);
-	gPlugins.push_back(corePlugin);
+	registerPlugin(corePlugin);
 
 	// Get local plugins directory
 	std::string localPlugins = assetLocal("plugins");
@@ -344,12 +569,61 @@ void pluginInit(bool devMode) {
 		}
 	}
 
-	// Extract packages and load plugins
-	extractPackages(localPlugins);
-	loadPlugins(localPlugins);
+	// Find packages to extract
+	std::vector<std::string> packagePaths;
+	for (std::string packagePath : systemListEntries(localPlugins)) {
+		if (stringExtension(packagePath) != "zip")
+			continue;
+		packagePaths.push_back(packagePath);
+		listZipDirectories(packagePath.c_str(), extractDirectories);
+	}
+
+	// Load the plugins which won't be replaced by a package
+	loadPlugins(localPlugins, NULL, &extractDirectories);
+
+	// Extract packages after launching, and load their plugins when done
+	if (!packagePaths.empty()) {
+		// Report progress through the download status so the plugin manager can display it
+		isDownloading = true;
+		downloadName = "Extracting plugins...";
+		downloadProgress = 0.0;
+		extractDone = false;
+		extractPending = true;
+		extractThread = std::thread(extractPackages, localPlugins, packagePaths);
+	}
+	prefetchSVGs();
+}
+
+void pluginStep() {
+	if (!extractPending || !extractDone)
+		return;
+	extractThread.join();
+	extractPending = false;
+	isDownloading = false;
+	downloadName = "";
+
+	if (!extractMessage.empty()) {
+		osdialog_message(OSDIALOG_WARNING, OSDIALOG_OK, extractMessage.c_str());
+		extractMessage = "";
+	}
+	loadPlugins(assetLocal("plugins"), &extractDirectories, NULL);
+	extractDirectories.clear();
+	// Cached SVGs are skipped, so this only parses the new plugins' SVGs
+	prefetchSVGs();
+}
+
+bool pluginIsExtracting() {
+	return extractPending;
 }
 
 void pluginDestroy() {
+	// Quitting while extracting waits for the packages to finish, so no plugin is left half-written
+	if (extractThread.joinable())
+		extractThread.join();
+	extractPending = false;
+	extractDirectories.clear();
+	SVG::stopPrefetch();
+
 	for (Plugin *plugin : gPlugins) {
 		// Free library handle
 #if ARCH_WIN
@@ -365,6 +639,8 @@ void pluginDestroy() {
 		// delete plugin;
 	}
 	gPlugins.clear();
+	pluginIndex.clear();
+	modelIndex.clear();
 }
 
 bool pluginSync(bool dryRun) {
@@ -443,6 +719,10 @@ bool pluginSync(bool dryRun) {
 		}
 	}
 
+	if (!dryRun && available) {
+		available = downloadPlugins();
+	}
+
 	return available;
 }
 
@@ -476,7 +756,18 @@ void pluginLogOut() {
 }
 
 void pluginCancelDownload() {
-	// TODO
+	std::lock_guard<std::mutex> lock(downloadsMutex);
+	for (PluginDownload *download : downloads) {
+		download->request.cancelled = true;
+	}
+}
+
+void pluginCancelDownload(std::string pluginSlug) {
+	std::lock_guard<std::mutex> lock(downloadsMutex);
+	for (PluginDownload *download : downloads) {
+		if (download->slug == pluginSlug)
+			download->request.cancelled = true;
+	}
 }
 
 bool pluginIsLoggedIn() {
@@ -488,7 +779,24 @@ bool pluginIsDownloading() {
 }
 
 float pluginGetDownloadProgress() {
-	return downloadProgress;
+	std::lock_guard<std::mutex> lock(downloadsMutex);
+	if (downloads.empty())
+		return downloadProgress;
+	// Average of all concurrent downloads
+	float progress = 0.f;
+	for (PluginDownload *download : downloads) {
+		progress += download->request.progress;
+	}
+	return progress / downloads.size();
+}
+
+float pluginGetDownloadProgress(std::string pluginSlug) {
+	std::lock_guard<std::mutex> lock(downloadsMutex);
+	for (PluginDownload *download : downloads) {
+		if (download->slug == pluginSlug)
+			return download->request.progress;
+	}
+	return 0.f;
 }
 
 std::string pluginGetDownloadName() {
@@ -500,24 +808,17 @@ std::string pluginGetLoginStatus() {
 }
 
 Plugin *pluginGetPlugin(std::string pluginSlug) {
-	for (Plugin *plugin : gPlugins) {
-		if (plugin->slug == pluginSlug) {
-			return plugin;
-		}
-	}
-	return NULL;
+	auto it = pluginIndex.find(pluginSlug);
+	if (it == pluginIndex.end())
+		return NULL;
+	return it->second;
 }
 
 Model *pluginGetModel(std::string pluginSlug, std::string modelSlug) {
-	Plugin *plugin = pluginGetPlugin(pluginSlug);
-	if (plugin) {
-		for (Model *model : plugin->models) {
-			if (model->slug == modelSlug) {
-				return model;
-			}
-		}
-	}
-	return NULL;
+	auto it = modelIndex.find(ModelKey(pluginSlug, modelSlug));
+	if (it == modelIndex.end())
+		return NULL;
+	return it->second;
 }
 
 
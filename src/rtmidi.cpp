@@ -36,6 +36,36 @@ RtMidiInputDevice::~RtMidiInputDevice() {
 }
 
 
+RtMidiOutputDevice::RtMidiOutputDevice(int driverId, int deviceId) {
+	rtMidiOut = new RtMidiOut((RtMidi::Api) driverId, "VCV Rack");
+	assert(rtMidiOut);
+	rtMidiOut->openPort(deviceId, "VCV Rack output");
+	bytes.reserve(3);
+}
+
+RtMidiOutputDevice::~RtMidiOutputDevice() {
+	rtMidiOut->closePort();
+	delete rtMidiOut;
+}
+
+void RtMidiOutputDevice::sendMessage(MidiMessage message) {
+	// Program change and channel pressure have one data byte, and most system messages have none
+	int size = 3;
+	if (message.status() == 0xc || message.status() == 0xd)
+		size = 2;
+	else if (message.status() == 0xf)
+		size = (message.cmd == 0xf2) ? 3 : (message.cmd == 0xf1 || message.cmd == 0xf3) ? 2 : 1;
+
+	bytes.clear();
+	bytes.push_back(message.cmd);
+	if (size >= 2)
+		bytes.push_back(message.data1);
+	if (size >= 3)
+		bytes.push_back(message.data2);
+	rtMidiOut->sendMessage(&bytes);
+}
+
+
 RtMidiDriver::RtMidiDriver(int driverId) {
 	this->driverId = driverId;
 	rtMidiIn = new RtMidiIn((RtMidi::Api) driverId);
@@ -103,6 +133,47 @@ void RtMidiDriver::unsubscribeInputDevice(int deviceId, MidiInput *midiInput) {
 	}
 }
 
+std::vector<int> RtMidiDriver::getOutputDeviceIds() {
+	int count = rtMidiOut->getPortCount();
+	std::vector<int> deviceIds;
+	for (int i = 0; i < count; i++)
+		deviceIds.push_back(i);
+	return deviceIds;
+}
+
+std::string RtMidiDriver::getOutputDeviceName(int deviceId) {
+	if (deviceId >= 0) {
+		return rtMidiOut->getPortName(deviceId);
+	}
+	return "";
+}
+
+MidiOutputDevice *RtMidiDriver::subscribeOutputDevice(int deviceId, MidiOutput *midiOutput) {
+	if (!(0 <= deviceId && deviceId < (int) rtMidiOut->getPortCount()))
+		return NULL;
+	RtMidiOutputDevice *device = outputDevices[deviceId];
+	if (!device) {
+		outputDevices[deviceId] = device = new RtMidiOutputDevice(driverId, deviceId);
+	}
+
+	device->subscribe(midiOutput);
+	return device;
+}
+
+void RtMidiDriver::unsubscribeOutputDevice(int deviceId, MidiOutput *midiOutput) {
+	auto it = outputDevices.find(deviceId);
+	if (it == outputDevices.end())
+		return;
+	RtMidiOutputDevice *device = it->second;
+	device->unsubscribe(midiOutput);
+
+	// Destroy device if nothing is subscribed anymore
+	if (device->subscribed.empty()) {
+		outputDevices.erase(it);
+		delete device;
+	}
+}
+
 
 void rtmidiInit() {
 	std::vector<RtMidi::Api> rtApis;
@@ -73,6 +73,15 @@ static json_t *settingsToJson() {
 	// checkVersion
 	json_object_set_new(rootJ, "checkVersion", json_boolean(gCheckVersion));
 
+	// framebufferBudget
+	json_object_set_new(rootJ, "framebufferBudget", json_integer(gFramebufferBudget >> 20));
+
+	// idleFrameRate
+	json_object_set_new(rootJ, "idleFrameRate", json_real(gIdleFrameRate));
+
+	// backgroundFrameRate
+	json_object_set_new(rootJ, "backgroundFrameRate", json_real(gBackgroundFrameRate));
+
 	return rootJ;
 }
 
@@ -151,21 +160,51 @@ static void settingsFromJson(json_t *rootJ) {
 	json_t *checkVersionJ = json_object_get(rootJ, "checkVersion");
 	if (checkVersionJ)
 		gCheckVersion = json_boolean_value(checkVersionJ);
+
+	// framebufferBudget, in MiB
+	json_t *framebufferBudgetJ = json_object_get(rootJ, "framebufferBudget");
+	if (framebufferBudgetJ)
+		gFramebufferBudget = (size_t) clamp((int) json_integer_value(framebufferBudgetJ), 16, 4096) << 20;
+
+	// idleFrameRate
+	json_t *idleFrameRateJ = json_object_get(rootJ, "idleFrameRate");
+	if (idleFrameRateJ)
+		gIdleFrameRate = json_number_value(idleFrameRateJ);
+
+	// backgroundFrameRate
+	json_t *backgroundFrameRateJ = json_object_get(rootJ, "backgroundFrameRate");
+	if (backgroundFrameRateJ)
+		gBackgroundFrameRate = json_number_value(backgroundFrameRateJ);
 }
 
 
 void settingsSave(std::string filename) {
-	info("Saving settings %s", filename.c_str());
 	json_t *rootJ = settingsToJson();
-	if (rootJ) {
-		FILE *file = fopen(filename.c_str(), "w");
-		if (!file)
-			return;
+	if (!rootJ)
+		return;
+	char *settings = json_dumps(rootJ, JSON_INDENT(2) | JSON_REAL_PRECISION(9));
+	json_decref(rootJ);
+	if (!settings)
+		return;
 
-		json_dumpf(rootJ, file, JSON_INDENT(2) | JSON_REAL_PRECISION(9));
-		json_decref(rootJ);
-		fclose(file);
+	// Autosave calls this periodically, so skip writing if nothing changed since the last save to the same file
+	static std::string lastFilename;
+	static std::string lastSettings;
+	if (filename == lastFilename && lastSettings == settings) {
+		free(settings);
+		return;
+	}
+
+	info("Saving settings %s", filename.c_str());
+	FILE *file = fopen(filename.c_str(), "w");
+	if (file) {
+		fputs(settings, file);
+		if (!fclose(file)) {
+			lastFilename = filename;
+			lastSettings = settings;
+		}
 	}
+	free(settings);
 }
 
 void settingsLoad(std::string filename) {
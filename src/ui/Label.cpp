@@ -1,9 +1,22 @@
 #include "ui.hpp"
+#include "window.hpp"
 
 
 namespace rack {
 
 
+// Metrics used by blendish for labels
+static const float labelFontSize = 13.0;
+static const float labelPadLeft = 8.0;
+static const float labelPadRight = 8.0;
+static const float labelPadDown = 7.0;
+
+
+float labelWidth(NVGcontext *vg, const std::string &text) {
+	return labelPadLeft + labelPadRight + TextLayout::get(vg, gGuiFont->handle, labelFontSize, text).width;
+}
+
+
 Label::Label() {
 	box.size.y = BND_WIDGET_HEIGHT;
 	fontSize = 13;
@@ -20,14 +33,21 @@ void Label::draw(NVGcontext *vg) {
 			x = 0.0;
 		} break;
 		case RIGHT_ALIGNMENT: {
-			x = box.size.x - bndLabelWidth(vg, -1, text.c_str());
+			x = box.size.x - labelWidth(vg, text);
 		} break;
 		case CENTER_ALIGNMENT: {
-			x = (box.size.x - bndLabelWidth(vg, -1, text.c_str())) / 2.0;
+			x = (box.size.x - labelWidth(vg, text)) / 2.0;
 		} break;
 	}
 
-	bndIconLabelValue(vg, x, 0.0, box.size.x, box.size.y, -1, color, BND_LEFT, fontSize, text.c_str(), NULL);
+	// Equivalent to bndIconLabelValue() without an icon or value, but the rows are only broken when the text or width changes
+	float breakWidth = box.size.x - labelPadRight - labelPadLeft;
+	const TextLayout &layout = TextLayout::get(vg, gGuiFont->handle, fontSize, text, breakWidth);
+	nvgFontFaceId(vg, gGuiFont->handle);
+	nvgFontSize(vg, fontSize);
+	nvgBeginPath(vg);
+	nvgFillColor(vg, color);
+	layout.draw(vg, text, Vec(x + labelPadLeft, BND_WIDGET_HEIGHT - labelPadDown));
 }
 
 
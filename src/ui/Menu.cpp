@@ -22,7 +22,17 @@ void Menu::setChildMenu(Menu *menu) {
 }
 
 void Menu::step() {
-	Widget::step();
+	// Long menus extend past the window, so only step the entries near the visible area.
+	// Entries added since the last frame are always stepped, since that measures their width.
+	Rect visible = VirtualList::getVisibleRect(this);
+	visible = visible.grow(Vec(0, visible.size.y));
+	int i = 0;
+	for (Widget *child : children) {
+		if (i >= measuredCount || visible.intersects(child->box))
+			child->step();
+		i++;
+	}
+	measuredCount = children.size();
 
 	// Set positions of children
 	box.size = Vec(0, 0);
@@ -46,7 +56,16 @@ void Menu::step() {
 
 void Menu::draw(NVGcontext *vg) {
 	bndMenuBackground(vg, 0.0, 0.0, box.size.x, box.size.y, BND_CORNER_NONE);
-	Widget::draw(vg);
+
+	Rect visible = VirtualList::getVisibleRect(this);
+	for (Widget *child : children) {
+		if (!child->visible || !visible.intersects(child->box))
+			continue;
+		nvgSave(vg);
+		nvgTranslate(vg, child->box.pos.x, child->box.pos.y);
+		child->draw(vg);
+		nvgRestore(vg);
+	}
 }
 
 
@@ -18,7 +18,7 @@ void MenuItem::draw(NVGcontext *vg) {
 
 	bndMenuItem(vg, 0.0, 0.0, box.size.x, box.size.y, state, -1, text.c_str());
 
-	float x = box.size.x - bndLabelWidth(vg, -1, rightText.c_str());
+	float x = box.size.x - labelWidth(vg, rightText);
 	NVGcolor rightColor = (state == BND_DEFAULT) ? bndGetTheme()->menuTheme.textColor : bndGetTheme()->menuTheme.textSelectedColor;
 	bndIconLabelValue(vg, x, 0.0, box.size.x, box.size.y, -1, rightColor, BND_LEFT, BND_LABEL_FONT_SIZE, rightText.c_str(), NULL);
 }
@@ -28,7 +28,7 @@ void MenuItem::step() {
 	const float rightPadding = 10.0;
 	// HACK use gVg from the window.
 	// All this does is inspect the font, so it shouldn't modify gVg and should work when called from a FramebufferWidget for example.
-	box.size.x = bndLabelWidth(gVg, -1, text.c_str()) + bndLabelWidth(gVg, -1, rightText.c_str()) + rightPadding;
+	box.size.x = labelWidth(gVg, text) + labelWidth(gVg, rightText) + rightPadding;
 	Widget::step();
 }
 
@@ -13,7 +13,7 @@ void MenuLabel::step() {
 	// Add 10 more pixels because Retina measurements are sometimes too small
 	const float rightPadding = 10.0;
 	// HACK use gVg from the window.
-	box.size.x = bndLabelWidth(gVg, -1, text.c_str()) + rightPadding;
+	box.size.x = labelWidth(gVg, text) + rightPadding;
 	Widget::step();
 }
 
@@ -66,9 +66,10 @@ void ScrollWidget::scrollTo(Rect r) {
 }
 
 void ScrollWidget::draw(NVGcontext *vg) {
-	nvgScissor(vg, 0, 0, box.size.x, box.size.y);
+	nvgSave(vg);
+	nvgIntersectScissor(vg, 0, 0, box.size.x, box.size.y);
 	Widget::draw(vg);
-	nvgResetScissor(vg);
+	nvgRestore(vg);
 }
 
 void ScrollWidget::step() {
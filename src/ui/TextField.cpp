@@ -9,7 +9,8 @@ namespace rack {
 
 
 void TextField::draw(NVGcontext *vg) {
-	nvgScissor(vg, 0, 0, box.size.x, box.size.y);
+	nvgSave(vg);
+	nvgIntersectScissor(vg, 0, 0, box.size.x, box.size.y);
 
 	BNDwidgetState state;
 	if (this == gFocusedWidget)
@@ -27,7 +28,7 @@ void TextField::draw(NVGcontext *vg) {
 		bndIconLabelCaret(vg, 0.0, 0.0, box.size.x, box.size.y, -1, bndGetTheme()->textFieldTheme.itemColor, 13, placeholder.c_str(), bndGetTheme()->textFieldTheme.itemColor, 0, -1);
 	}
 
-	nvgResetScissor(vg);
+	nvgRestore(vg);
 }
 
 void TextField::onMouseDown(EventMouseDown &e) {
@@ -10,7 +10,7 @@ Tooltip::Tooltip() {
 
 void Tooltip::draw(NVGcontext *vg) {
 	// Wrap size to contents
-	box.size.x = bndLabelWidth(vg, -1, text.c_str()) + 10.0;
+	box.size.x = labelWidth(vg, text) + 10.0;
 	box.size.y = bndLabelHeight(vg, -1, text.c_str(), INFINITY);
 
 	bndTooltipBackground(vg, 0.0, 0.0, box.size.x, box.size.y);
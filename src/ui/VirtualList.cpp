@@ -0,0 +1,127 @@
+#include "ui.hpp"
+#include <algorithm>
+
+
+namespace rack {
+
+
+VirtualList::~VirtualList() {
+	for (auto &pair : recycledWidgets) {
+		for (Widget *w : pair.second) {
+			delete w;
+		}
+	}
+}
+
+void VirtualList::recycleRowWidget(RowWidget rowWidget) {
+	// Stop hovering or dragging the widget, since it will represent a different row
+	rowWidget.widget->finalizeEvents();
+	removeChild(rowWidget.widget);
+	recycledWidgets[rowWidget.type].push_back(rowWidget.widget);
+}
+
+void VirtualList::refresh() {
+	for (auto &pair : rowWidgets) {
+		recycleRowWidget(pair.second);
+	}
+	rowWidgets.clear();
+
+	rowTops.clear();
+	float y = 0.0;
+	for (int row = 0; row < rowCount; row++) {
+		rowTops.push_back(y);
+		y += getRowHeight(row);
+	}
+	rowTops.push_back(y);
+	box.size.y = y;
+}
+
+Widget *VirtualList::getRowWidget(int row) {
+	assert(0 <= row && row < rowCount);
+	auto it = rowWidgets.find(row);
+	if (it != rowWidgets.end())
+		return it->second.widget;
+
+	int type = getRowType(row);
+	Widget *recycled = NULL;
+	std::vector<Widget*> &recycledOfType = recycledWidgets[type];
+	if (!recycledOfType.empty()) {
+		recycled = recycledOfType.back();
+		recycledOfType.pop_back();
+	}
+	Widget *w = createRow(row, recycled);
+	if (recycled && recycled != w)
+		delete recycled;
+	assert(w);
+
+	w->box.pos = Vec(0.0, rowTops[row]);
+	w->box.size.x = box.size.x;
+	addChild(w);
+	rowWidgets[row] = {w, type};
+	return w;
+}
+
+int VirtualList::getWidgetRow(Widget *w) {
+	for (auto &pair : rowWidgets) {
+		if (pair.second.widget == w)
+			return pair.first;
+	}
+	return -1;
+}
+
+Rect VirtualList::getRowBox(int row) {
+	return Rect(Vec(0.0, rowTops[row]), Vec(box.size.x, rowTops[row + 1] - rowTops[row]));
+}
+
+void VirtualList::scrollToRow(int row) {
+	ScrollWidget *parentScroll = dynamic_cast<ScrollWidget*>(parent ? parent->parent : NULL);
+	if (parentScroll)
+		parentScroll->scrollTo(getRowBox(row));
+}
+
+void VirtualList::step() {
+	if ((int) rowTops.size() != rowCount + 1)
+		refresh();
+
+	// Keep a screen of rows above and below the visible area so scrolling does not reveal missing rows
+	Rect visible = getVisibleRect(this);
+	visible = visible.grow(Vec(0, visible.size.y));
+	int begin = std::upper_bound(rowTops.begin(), rowTops.end() - 1, visible.pos.y) - rowTops.begin() - 1;
+	int end = std::lower_bound(rowTops.begin(), rowTops.end() - 1, visible.getBottomRight().y) - rowTops.begin();
+	begin = max(begin, 0);
+
+	// Recycle widgets of rows outside the range
+	for (auto it = rowWidgets.begin(); it != rowWidgets.end();) {
+		if (it->first < begin || it->first >= end) {
+			recycleRowWidget(it->second);
+			it = rowWidgets.erase(it);
+		}
+		else {
+			it++;
+		}
+	}
+	for (int row = begin; row < end; row++) {
+		getRowWidget(row);
+	}
+
+	for (Widget *child : children) {
+		child->box.size.x = box.size.x;
+	}
+	Widget::step();
+}
+
+Rect VirtualList::getVisibleRect(Widget *w) {
+	Rect visible = Rect(Vec(), w->box.size);
+	if (!w->parent)
+		return visible;
+	// The ScrollWidget's container is its first child, and the list is in the container
+	ScrollWidget *parentScroll = w->parent->parent ? dynamic_cast<ScrollWidget*>(w->parent->parent) : NULL;
+	if (parentScroll) {
+		Vec offset = w->box.pos.plus(w->parent->box.pos);
+		return visible.clamp(Rect(offset.neg(), parentScroll->box.size));
+	}
+	return visible.clamp(Rect(w->box.pos.neg(), w->parent->box.size));
+}
+
+
+} // namespace rack
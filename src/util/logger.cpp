@@ -1,6 +1,9 @@
 #include "util/common.hpp"
 #include "asset.hpp"
+#include "dsp/mpscqueue.hpp"
 #include <stdarg.h>
+#include <atomic>
+#include <thread>
 
 
 namespace rack {
@@ -9,23 +12,38 @@ namespace rack {
 static FILE *logFile = NULL;
 static std::chrono::high_resolution_clock::time_point startTime;
 
+/** Log calls are copied into a ring of fixed-size messages and written to the log file by a background thread, so logging from the engine or audio threads never waits for the disk.
+*/
+static const size_t LOG_RING_SIZE = 1024;
+static const size_t LOG_MESSAGE_SIZE = 512;
+
+struct LogMessage {
+	LoggerLevel level;
+	/** From __FILE__, so it outlives the message */
+	const char *file;
+	int line;
+	/** Seconds since loggerInit() when the message was logged */
+	double time;
+	/** Truncated to LOG_MESSAGE_SIZE */
+	char text[LOG_MESSAGE_SIZE];
+};
 
-void loggerInit(bool devMode) {
-	startTime = std::chrono::high_resolution_clock::now();
-	if (devMode) {
-		logFile = stderr;
-	}
-	else {
-		std::string logFilename = assetLocal("log.txt");
-		logFile = fopen(logFilename.c_str(), "w");
-	}
-}
+static MPSCQueue<LogMessage, LOG_RING_SIZE> logRing;
+/** Number of messages discarded because the ring was full, since the writer last reported it */
+static std::atomic<size_t> logDropped;
+
+enum LogState {
+	/** Before loggerInit() or after loggerDestroy(). Messages are written directly. */
+	LOG_STOPPED,
+	LOG_RUNNING,
+	/** loggerDestroy() is writing the remaining messages. New messages are written directly to stderr instead of claiming a slot. */
+	LOG_CLOSING,
+};
+static std::atomic<int> logState(LOG_STOPPED);
+/** Number of threads between checking logState and publishing their message */
+static std::atomic<int> logProducers(0);
+static std::thread logThread;
 
-void loggerDestroy() {
-	if (logFile != stderr) {
-		fclose(logFile);
-	}
-}
 
 static const char* const loggerText[] = {
 	"debug",
@@ -41,17 +59,123 @@ static const int loggerColor[] = {
 	31
 };
 
-static void loggerLogVa(LoggerLevel level, const char *file, int line, const char *format, va_list args) {
-	auto nowTime = std::chrono::high_resolution_clock::now();
-	int duration = std::chrono::duration_cast<std::chrono::milliseconds>(nowTime - startTime).count();
+static void loggerWrite(LoggerLevel level, const char *file, int line, double time, const char *text) {
 	if (logFile == stderr)
 		fprintf(logFile, "\x1B[%dm", loggerColor[level]);
-	fprintf(logFile, "[%.03f %s %s:%d] ", duration / 1000.0, loggerText[level], file, line);
+	fprintf(logFile, "[%.03f %s %s:%d] ", time, loggerText[level], file, line);
 	if (logFile == stderr)
 		fprintf(logFile, "\x1B[0m");
-	vfprintf(logFile, format, args);
-	fprintf(logFile, "\n");
-	fflush(logFile);
+	fprintf(logFile, "%s\n", text);
+}
+
+static double loggerTime() {
+	auto nowTime = std::chrono::high_resolution_clock::now();
+	int duration = std::chrono::duration_cast<std::chrono::milliseconds>(nowTime - startTime).count();
+	return duration / 1000.0;
+}
+
+/** Writes all ready messages. Only called by the writer thread, or after it has stopped. */
+static void loggerFlushRing() {
+	bool wrote = false;
+	while (LogMessage *message = logRing.front()) {
+		loggerWrite(message->level, message->file, message->line, message->time, message->text);
+		wrote = true;
+		logRing.pop();
+	}
+
+	size_t dropped = logDropped.exchange(0);
+	if (dropped > 0) {
+		char text[128];
+		snprintf(text, sizeof(text), "%zu log messages were dropped because the log was full", dropped);
+		loggerWrite(WARN_LEVEL, __FILE__, __LINE__, loggerTime(), text);
+		wrote = true;
+	}
+	if (wrote)
+		fflush(logFile);
+}
+
+static void loggerRun() {
+	while (true) {
+		bool running = (logState == LOG_RUNNING);
+		loggerFlushRing();
+		if (!running)
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+}
+
+void loggerInit(bool devMode) {
+	startTime = std::chrono::high_resolution_clock::now();
+	if (devMode) {
+		logFile = stderr;
+	}
+	else {
+		std::string logFilename = assetLocal("log.txt");
+		logFile = fopen(logFilename.c_str(), "w");
+	}
+
+	logRing.clear();
+	logDropped = 0;
+	logProducers = 0;
+	logState = LOG_RUNNING;
+	logThread = std::thread(loggerRun);
+}
+
+void loggerDestroy() {
+	// Reject new claims. The writer thread writes the remaining messages before stopping.
+	logState = LOG_CLOSING;
+	if (logThread.joinable())
+		logThread.join();
+	// A message claimed before closing may have been published after the writer's last pass
+	while (logProducers > 0) {
+		std::this_thread::yield();
+	}
+	loggerFlushRing();
+
+	if (logFile != stderr) {
+		fclose(logFile);
+	}
+	logFile = NULL;
+	logState = LOG_STOPPED;
+}
+
+static void loggerLogVa(LoggerLevel level, const char *file, int line, const char *format, va_list args) {
+	// Announce the claim before checking the state, so loggerDestroy() either waits for it or this thread sees LOG_CLOSING
+	logProducers++;
+	if (logState != LOG_RUNNING) {
+		logProducers--;
+		// The log file is closed or about to be
+		fprintf(stderr, "[%s %s:%d] ", loggerText[level], file, line);
+		vfprintf(stderr, format, args);
+		fprintf(stderr, "\n");
+		fflush(stderr);
+		return;
+	}
+
+	// Claim a free message without waiting
+	size_t pos;
+	LogMessage *message = logRing.claim(&pos);
+	if (!message) {
+		// The ring is full
+		logDropped++;
+		logProducers--;
+		return;
+	}
+
+	message->level = level;
+	message->file = file;
+	message->line = line;
+	message->time = loggerTime();
+	vsnprintf(message->text, LOG_MESSAGE_SIZE, format, args);
+	logRing.publish(pos);
+	logProducers--;
+
+	if (level == FATAL_LEVEL) {
+		// The program is likely about to exit, so wait for the message to reach the log file
+		for (int i = 0; i < 100 && !logRing.isPopped(pos); i++) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+	}
 }
 
 void loggerLog(LoggerLevel level, const char *file, int line, const char *format, ...) {
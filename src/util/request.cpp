@@ -3,6 +3,9 @@
 #define CURL_STATICLIB
 #include <curl/curl.h>
 #include <openssl/sha.h>
+#include <sys/stat.h>
+#include <thread>
+#include <atomic>
 
 
 namespace rack {
@@ -103,28 +106,47 @@ json_t *requestJson(RequestMethod method, std::string url, json_t *dataJ) {
 }
 
 
+struct XferInfo {
+	std::atomic<float> *progress;
+	/** Written instead of `progress` by the requestDownload() overload taking a plain float */
+	float *floatProgress;
+	const std::atomic<bool> *cancelled;
+	/** Bytes already on disk from a previous attempt */
+	curl_off_t offset;
+};
+
 static int xferInfoCallback(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
-	float *progress = (float*) clientp;
-	if (progress) {
-		if (dltotal <= 0)
-			*progress = 1.0;
-		else
-			*progress = (float)dlnow / dltotal;
-	}
+	XferInfo *xferInfo = (XferInfo*) clientp;
+	float progress = 1.0;
+	if (dltotal > 0)
+		progress = (float) (xferInfo->offset + dlnow) / (xferInfo->offset + dltotal);
+	if (xferInfo->progress)
+		*xferInfo->progress = progress;
+	if (xferInfo->floatProgress)
+		*xferInfo->floatProgress = progress;
+	// Returning nonzero aborts the transfer
+	if (xferInfo->cancelled && *xferInfo->cancelled)
+		return 1;
 	return 0;
 }
 
-bool requestDownload(std::string url, std::string filename, float *progress) {
-	if (progress)
-		*progress = 0.f;
-
+/** Downloads the part of `url` after `offset` bytes, appending it to `filename` */
+static CURLcode downloadRange(std::string url, std::string filename, curl_off_t offset, std::atomic<float> *progress, float *floatProgress, const std::atomic<bool> *cancelled) {
 	CURL *curl = curl_easy_init();
 	if (!curl)
-		return false;
+		return CURLE_FAILED_INIT;
 
-	FILE *file = fopen(filename.c_str(), "wb");
-	if (!file)
-		return false;
+	FILE *file = fopen(filename.c_str(), (offset > 0) ? "ab" : "wb");
+	if (!file) {
+		curl_easy_cleanup(curl);
+		return CURLE_WRITE_ERROR;
+	}
+
+	XferInfo xferInfo;
+	xferInfo.progress = progress;
+	xferInfo.floatProgress = floatProgress;
+	xferInfo.cancelled = cancelled;
+	xferInfo.offset = offset;
 
 	curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
 	curl_easy_setopt(curl, CURLOPT_VERBOSE, false);
@@ -132,21 +154,116 @@ bool requestDownload(std::string url, std::string filename, float *progress) {
 	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, NULL);
 	curl_easy_setopt(curl, CURLOPT_WRITEDATA, file);
 	curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, xferInfoCallback);
-	curl_easy_setopt(curl, CURLOPT_XFERINFODATA, progress);
+	curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &xferInfo);
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, true);
 	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, false);
 	// Fail on 4xx and 5xx HTTP codes
 	curl_easy_setopt(curl, CURLOPT_FAILONERROR, true);
+	// Sends a "Range: bytes=offset-" header
+	curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, offset);
 
 	CURLcode res = curl_easy_perform(curl);
+	curl_off_t contentLength = -1;
+	if (res == CURLE_OK)
+		curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &contentLength);
 	curl_easy_cleanup(curl);
 
-	fclose(file);
+	if (fclose(file) && res == CURLE_OK)
+		res = CURLE_WRITE_ERROR;
+
+	// The response body must exactly complete the bytes already on disk
+	if (res == CURLE_OK && contentLength >= 0) {
+		struct stat statbuf;
+		if (stat(filename.c_str(), &statbuf) || statbuf.st_size != offset + contentLength)
+			res = CURLE_BAD_DOWNLOAD_RESUME;
+	}
+	return res;
+}
 
-	if (res != CURLE_OK)
-		remove(filename.c_str());
+/** Returns whether a failed download means the bytes on disk can't be resumed, rather than that the transfer was interrupted */
+static bool isResumeError(CURLcode res) {
+	// An HTTP error is usually 416 Range Not Satisfiable, and a range error means the server ignored the range
+	return res == CURLE_HTTP_RETURNED_ERROR || res == CURLE_RANGE_ERROR || res == CURLE_BAD_DOWNLOAD_RESUME;
+}
 
-	return res == CURLE_OK;
+static bool downloadFile(std::string url, std::string filename, std::atomic<float> *progress, float *floatProgress, const std::atomic<bool> *cancelled) {
+	if (progress)
+		*progress = 0.f;
+	if (floatProgress)
+		*floatProgress = 0.f;
+
+	// The partial file is named after the SHA256 of the URL, so a partial file of another version of `filename` is never resumed against this URL.
+	std::string partPrefix = filename + ".";
+	std::string partFilename = partPrefix + requestSHA256String(url) + ".part";
+	// Remove partial files of other versions
+	for (std::string entry : systemListEntries(stringDirectory(filename))) {
+		if (entry != partFilename && entry.compare(0, partPrefix.size(), partPrefix) == 0 && stringExtension(entry) == "part")
+			remove(entry.c_str());
+	}
+
+	// Resume from a partial file left by an interrupted download
+	curl_off_t offset = 0;
+	struct stat statbuf;
+	if (!stat(partFilename.c_str(), &statbuf))
+		offset = statbuf.st_size;
+
+	CURLcode res = downloadRange(url, partFilename, offset, progress, floatProgress, cancelled);
+	if (offset > 0 && isResumeError(res)) {
+		// The server might not support byte ranges, or the resumed file might have the wrong size, so start over.
+		res = downloadRange(url, partFilename, 0, progress, floatProgress, cancelled);
+	}
+
+	if (res != CURLE_OK) {
+		// Keep the partial file of a cancelled or interrupted download so it can be resumed
+		if (isResumeError(res))
+			remove(partFilename.c_str());
+		return false;
+	}
+
+#if ARCH_WIN
+	// rename() does not replace existing files on Windows
+	remove(filename.c_str());
+#endif
+	if (rename(partFilename.c_str(), filename.c_str())) {
+		remove(partFilename.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool requestDownload(std::string url, std::string filename, std::atomic<float> *progress) {
+	return downloadFile(url, filename, progress, NULL, NULL);
+}
+
+bool requestDownload(std::string url, std::string filename, float *progress) {
+	return downloadFile(url, filename, NULL, progress, NULL);
+}
+
+void requestDownloads(const std::vector<RequestDownload*> &downloads, int maxTransfers) {
+	if (downloads.empty())
+		return;
+
+	std::atomic<size_t> nextIndex(0);
+	auto downloadWorker = [&]() {
+		while (1) {
+			size_t i = nextIndex++;
+			if (i >= downloads.size())
+				break;
+			RequestDownload *download = downloads[i];
+			if (download->cancelled)
+				continue;
+			download->success = downloadFile(download->url, download->filename, &download->progress, NULL, &download->cancelled);
+		}
+	};
+
+	int threadCount = clamp(maxTransfers, 1, (int) downloads.size());
+	std::vector<std::thread> threads;
+	for (int i = 0; i < threadCount; i++) {
+		threads.push_back(std::thread(downloadWorker));
+	}
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
 }
 
 std::string requestEscape(std::string s) {
@@ -159,6 +276,20 @@ std::string requestEscape(std::string s) {
 	return ret;
 }
 
+/** Converts a binary SHA256 hash to lowercase hex */
+static std::string sha256Hex(const uint8_t *hash) {
+	char hashHex[64];
+	const char hexTable[] = "0123456789abcdef";
+	for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
+		uint8_t h = hash[i];
+		hashHex[2*i + 0] = hexTable[h >> 4];
+		hashHex[2*i + 1] = hexTable[h & 0x0f];
+	}
+
+	std::string str(hashHex, sizeof(hashHex));
+	return str;
+}
+
 std::string requestSHA256File(std::string filename) {
 	FILE *f = fopen(filename.c_str(), "rb");
 	if (!f)
@@ -177,18 +308,13 @@ std::string requestSHA256File(std::string filename) {
 	delete[] buffer;
 	fclose(f);
 
-	// Convert binary hash to hex
-	char hashHex[64];
-	const char hexTable[] = "0123456789abcdef";
-	for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-		uint8_t h = hash[i];
-		hashHex[2*i + 0] = hexTable[h >> 4];
-		hashHex[2*i + 1] = hexTable[h & 0x0f];
-	}
-
-	std::string str(hashHex, sizeof(hashHex));
-	return str;
+	return sha256Hex(hash);
 }
 
+std::string requestSHA256String(std::string s) {
+	uint8_t hash[SHA256_DIGEST_LENGTH];
+	SHA256((const uint8_t*) s.data(), s.size(), hash);
+	return sha256Hex(hash);
+}
 
 } // namespace rack
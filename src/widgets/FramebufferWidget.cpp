@@ -2,105 +2,510 @@
 #include "window.hpp"
 #include "nanovg_gl.h"
 #include "nanovg_gl_utils.h"
+#include <algorithm>
+#include <map>
 
 
 namespace rack {
 
 
-struct FramebufferWidget::Internal {
-	NVGLUframebuffer *fb = NULL;
-	Rect box;
+size_t gFramebufferBudget = 256 << 20;
 
-	~Internal() {
-		setFramebuffer(NULL);
+/** Side length of shared atlas pages in pixels */
+static const int ATLAS_PAGE_SIZE = 1024;
+/** Framebuffers larger than this in either dimension get a page of their own */
+static const int ATLAS_MAX_SLOT_SIZE = 512;
+/** Dedicated page sizes are rounded up to a multiple of this, so released pages can be reused by framebuffers of similar sizes */
+static const int ATLAS_DEDICATED_ROUNDING = 256;
+/** Maximum number of released dedicated pages kept for reuse */
+static const int ATLAS_SPARE_PAGES_MAX = 4;
+/** Slot sizes are rounded up to a multiple of this, so slots can be reused by framebuffers of similar sizes */
+static const int ATLAS_SLOT_ROUNDING = 8;
+/** GPU memory per pixel of a page, for the RGBA texture and the stencil renderbuffer */
+static const size_t ATLAS_PIXEL_BYTES = 8;
+
+struct AtlasPage;
+
+/** A region of an atlas page holding one FramebufferWidget's image */
+struct AtlasSlot {
+	AtlasPage *page;
+	/** Pixel position from the top-left of the page, and size including a 1 pixel transparent border so neighbors don't bleed when sampled */
+	int x, y, w, h;
+	/** gGuiFrame when the slot was last drawn, for least-recently-used eviction */
+	int lastFrame = 0;
+	/** NULL if the slot is free */
+	FramebufferWidget::Internal *owner = NULL;
+};
+
+struct AtlasShelf {
+	int y, h;
+	/** Width used so far, or 0 if the shelf is empty and can be reused for slots of any height up to `h` */
+	int x;
+};
+
+struct AtlasPage {
+	NVGLUframebuffer *fb;
+	int w, h;
+	/** Slots are packed into rows of similar heights */
+	std::vector<AtlasShelf> shelves;
+	std::vector<AtlasSlot*> slots;
+	int liveSlots = 0;
+	/** Holds a single oversized slot, and is kept as a spare for the next oversized slot when it is released */
+	bool dedicated = false;
+
+	~AtlasPage() {
+		clear();
+		nvgluDeleteFramebuffer(fb);
+	}
+	/** Removes all slots, which must be released */
+	void clear() {
+		for (AtlasSlot *slot : slots)
+			delete slot;
+		slots.clear();
+		shelves.clear();
 	}
-	void setFramebuffer(NVGLUframebuffer *fb) {
-		if (this->fb)
-			nvgluDeleteFramebuffer(this->fb);
-		this->fb = fb;
+	bool isSpare() {
+		return dedicated && liveSlots == 0;
+	}
+	size_t getBytes() {
+		return (size_t) w * h * ATLAS_PIXEL_BYTES;
 	}
 };
 
+static std::vector<AtlasPage*> atlasPages;
 
-FramebufferWidget::FramebufferWidget() {
-	oversample = 1.0;
-	internal = new Internal();
+
+static size_t atlasGetBytes() {
+	size_t bytes = 0;
+	for (AtlasPage *page : atlasPages)
+		bytes += page->getBytes();
+	return bytes;
 }
 
-FramebufferWidget::~FramebufferWidget() {
-	delete internal;
+/** Returns the slot side length for an image side length, including the border */
+static int atlasSlotSize(int size) {
+	return (size + 2 + ATLAS_SLOT_ROUNDING - 1) / ATLAS_SLOT_ROUNDING * ATLAS_SLOT_ROUNDING;
 }
 
-void FramebufferWidget::draw(NVGcontext *vg) {
-	// Bypass framebuffer rendering entirely
-	// Widget::draw(vg);
-	// return;
+static AtlasPage *atlasCreatePage(int w, int h) {
+	NVGLUframebuffer *fb = nvgluCreateFramebuffer(gVg, w, h, 0);
+	if (!fb)
+		return NULL;
+	nvgluBindFramebuffer(fb);
+	glViewport(0, 0, w, h);
+	glClearColor(0.0, 0.0, 0.0, 0.0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	nvgluBindFramebuffer(NULL);
 
-	// Get world transform
-	float xform[6];
-	nvgCurrentTransform(vg, xform);
-	// Skew and rotate is not supported
-	assert(fabsf(xform[1]) < 1e-6);
-	assert(fabsf(xform[2]) < 1e-6);
-	Vec s = Vec(xform[0], xform[3]);
-	Vec b = Vec(xform[4], xform[5]);
-	Vec bi = b.floor();
-	Vec bf = b.minus(bi);
+	AtlasPage *page = new AtlasPage();
+	page->fb = fb;
+	page->w = w;
+	page->h = h;
+	atlasPages.push_back(page);
+	return page;
+}
 
-	// Render to framebuffer
-	if (dirty) {
-		dirty = false;
+static void atlasDeletePage(AtlasPage *page) {
+	atlasPages.erase(std::find(atlasPages.begin(), atlasPages.end(), page));
+	delete page;
+}
 
-		internal->box = getChildrenBoundingBox();
-		internal->box.pos = internal->box.pos.mult(s).floor();
-		internal->box.size = internal->box.size.mult(s).ceil().plus(Vec(1, 1));
+/** Frees the shelves of `page` which have no live slots, so their space can be reused by slots of any size
+Adjacent empty shelves are merged, and empty shelves at the bottom are returned to the unused part of the page.
+*/
+static void atlasReclaimShelves(AtlasPage *page) {
+	// Find the shelves with live slots
+	std::vector<bool> used(page->shelves.size(), false);
+	for (AtlasSlot *slot : page->slots) {
+		if (!slot->owner)
+			continue;
+		for (size_t i = 0; i < page->shelves.size(); i++) {
+			if (page->shelves[i].y == slot->y) {
+				used[i] = true;
+				break;
+			}
+		}
+	}
 
-		Vec fbSize = internal->box.size.mult(gPixelRatio * oversample);
+	// Delete the free slots of empty shelves
+	auto isInEmptyShelf = [&](AtlasSlot *slot) {
+		for (size_t i = 0; i < page->shelves.size(); i++) {
+			if (page->shelves[i].y == slot->y)
+				return !used[i];
+		}
+		return false;
+	};
+	for (auto it = page->slots.begin(); it != page->slots.end();) {
+		if (!(*it)->owner && isInEmptyShelf(*it)) {
+			delete *it;
+			it = page->slots.erase(it);
+		}
+		else {
+			it++;
+		}
+	}
 
-		if (!fbSize.isFinite())
-			return;
-		if (fbSize.isZero())
-			return;
+	// Merge runs of empty shelves
+	std::vector<AtlasShelf> shelves;
+	for (size_t i = 0; i < page->shelves.size(); i++) {
+		AtlasShelf shelf = page->shelves[i];
+		if (!used[i]) {
+			shelf.x = 0;
+			if (!shelves.empty() && shelves.back().x == 0) {
+				shelves.back().h += shelf.h;
+				continue;
+			}
+		}
+		shelves.push_back(shelf);
+	}
+	if (!shelves.empty() && shelves.back().x == 0)
+		shelves.pop_back();
+	page->shelves = shelves;
+}
 
-		// info("rendering framebuffer %f %f", fbSize.x, fbSize.y);
-		// Delete old one first to free up GPU memory
-		internal->setFramebuffer(NULL);
-		// Create a framebuffer from the main nanovg context. We will draw to this in the secondary nanovg context.
-		NVGLUframebuffer *fb = nvgluCreateFramebuffer(gVg, fbSize.x, fbSize.y, 0);
-		if (!fb)
+static void atlasRelease(AtlasSlot *slot) {
+	AtlasPage *page = slot->page;
+	slot->owner = NULL;
+	page->liveSlots--;
+	if (page->liveSlots > 0) {
+		if (!page->dedicated)
+			atlasReclaimShelves(page);
+		return;
+	}
+	// Keep a few dedicated pages, since oversized framebuffers are re-rendered at new sizes on every zoom
+	if (page->dedicated) {
+		int spares = std::count_if(atlasPages.begin(), atlasPages.end(), [](AtlasPage *p) { return p->isSpare(); });
+		if (spares <= ATLAS_SPARE_PAGES_MAX)
 			return;
-		internal->setFramebuffer(fb);
+	}
+	// Free the GPU memory of pages which are no longer used
+	atlasDeletePage(page);
+}
+
+/** Deletes a spare dedicated page
+Returns whether a page was deleted.
+*/
+static bool atlasDeleteSpare() {
+	for (AtlasPage *page : atlasPages) {
+		if (page->isSpare()) {
+			atlasDeletePage(page);
+			return true;
+		}
+	}
+	return false;
+}
+
+static AtlasSlot *atlasAllocateInPage(AtlasPage *page, int w, int h) {
+	// Reuse a released slot of the same size
+	for (AtlasSlot *slot : page->slots) {
+		if (!slot->owner && slot->w == w && slot->h == h)
+			return slot;
+	}
+
+	// Find a shelf which is tall enough but not much taller
+	AtlasShelf *shelf = NULL;
+	for (AtlasShelf &s : page->shelves) {
+		if (h <= s.h && s.h <= h * 3 / 2 && s.x + w <= page->w) {
+			shelf = &s;
+			break;
+		}
+	}
+	// Reuse an empty shelf, splitting off the part below the new slot as another empty shelf
+	if (!shelf && w <= page->w) {
+		for (size_t i = 0; i < page->shelves.size(); i++) {
+			AtlasShelf &s = page->shelves[i];
+			if (s.x == 0 && h <= s.h) {
+				if (s.h > h * 3 / 2) {
+					AtlasShelf rest = {s.y + h, s.h - h, 0};
+					s.h = h;
+					page->shelves.insert(page->shelves.begin() + i + 1, rest);
+				}
+				shelf = &page->shelves[i];
+				break;
+			}
+		}
+	}
+	// Start a new shelf
+	if (!shelf) {
+		int y = page->shelves.empty() ? 0 : page->shelves.back().y + page->shelves.back().h;
+		if (y + h > page->h || w > page->w)
+			return NULL;
+		page->shelves.push_back(AtlasShelf {y, h, 0});
+		shelf = &page->shelves.back();
+	}
+
+	AtlasSlot *slot = new AtlasSlot();
+	slot->page = page;
+	slot->x = shelf->x;
+	slot->y = shelf->y;
+	slot->w = w;
+	slot->h = h;
+	shelf->x += w;
+	page->slots.push_back(slot);
+	return slot;
+}
+
+/** Releases the least recently drawn slot which wasn't drawn on this frame
+Returns whether a slot was evicted.
+*/
+static bool atlasEvict();
+
+/** Returns a slot for an image of `w` by `h` pixels, not including the border */
+static AtlasSlot *atlasAllocate(FramebufferWidget::Internal *owner, int w, int h) {
+	w = atlasSlotSize(w);
+	h = atlasSlotSize(h);
+
+	AtlasSlot *slot = NULL;
+	if (w > ATLAS_MAX_SLOT_SIZE || h > ATLAS_MAX_SLOT_SIZE) {
+		int pageW = (w + ATLAS_DEDICATED_ROUNDING - 1) / ATLAS_DEDICATED_ROUNDING * ATLAS_DEDICATED_ROUNDING;
+		int pageH = (h + ATLAS_DEDICATED_ROUNDING - 1) / ATLAS_DEDICATED_ROUNDING * ATLAS_DEDICATED_ROUNDING;
+		// Reuse a spare page of the same size
+		AtlasPage *page = NULL;
+		for (AtlasPage *p : atlasPages) {
+			if (p->isSpare() && p->w == pageW && p->h == pageH) {
+				page = p;
+				page->clear();
+				break;
+			}
+		}
+		if (!page) {
+			while (atlasGetBytes() + (size_t) pageW * pageH * ATLAS_PIXEL_BYTES > gFramebufferBudget) {
+				if (!atlasDeleteSpare() && !atlasEvict())
+					break;
+			}
+			page = atlasCreatePage(pageW, pageH);
+			if (!page)
+				return NULL;
+			page->dedicated = true;
+		}
+		slot = atlasAllocateInPage(page, w, h);
+	}
+	else {
+		while (!slot) {
+			for (AtlasPage *page : atlasPages) {
+				if (page->dedicated)
+					continue;
+				slot = atlasAllocateInPage(page, w, h);
+				if (slot)
+					break;
+			}
+			if (slot)
+				break;
+			// Add a page if it fits in the budget, or if nothing can be evicted to make room
+			size_t pageBytes = (size_t) ATLAS_PAGE_SIZE * ATLAS_PAGE_SIZE * ATLAS_PIXEL_BYTES;
+			if (atlasGetBytes() + pageBytes <= gFramebufferBudget || (!atlasDeleteSpare() && !atlasEvict())) {
+				AtlasPage *page = atlasCreatePage(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE);
+				if (!page)
+					return NULL;
+				slot = atlasAllocateInPage(page, w, h);
+			}
+		}
+	}
+
+	slot->owner = owner;
+	slot->page->liveSlots++;
+	return slot;
+}
+
+
+/** Seconds after the last zoom event before cached zoom levels are replaced by exact renderings */
+static const double ZOOM_SETTLE_TIME = 0.25;
+/** Zoom levels are cached every half octave */
+static const float ZOOM_LEVELS_PER_OCTAVE = 2.f;
+/** Maximum number of zoom levels cached per widget, besides the exact rendering */
+static const size_t ZOOM_LEVELS_MAX = 2;
+
+static double lastZoomTime = -INFINITY;
+
 
-		nvgluBindFramebuffer(fb);
-		glViewport(0.0, 0.0, fbSize.x, fbSize.y);
-		glClearColor(0.0, 0.0, 0.0, 0.0);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+/** The children rendered at one scale */
+struct FramebufferImage {
+	AtlasSlot *slot = NULL;
+	/** Bounding box of the children at `scale`, relative to the integer part of the world translation */
+	Rect box;
+	/** Size of the rendered image in pixels */
+	Vec imageSize;
+	/** World scale the children were rendered at */
+	Vec scale;
+};
 
-		nvgBeginFrame(gFramebufferVg, fbSize.x, fbSize.y, gPixelRatio * oversample);
 
-		nvgScale(gFramebufferVg, gPixelRatio * oversample, gPixelRatio * oversample);
-		// Use local scaling
-		nvgTranslate(gFramebufferVg, bf.x, bf.y);
-		nvgTranslate(gFramebufferVg, -internal->box.pos.x, -internal->box.pos.y);
-		nvgScale(gFramebufferVg, s.x, s.y);
-		Widget::draw(gFramebufferVg);
+struct FramebufferWidget::Internal {
+	/** Rendered at the exact scale the widget was last drawn at */
+	FramebufferImage image;
+	/** Rendered at discrete scales, keyed by zoom level, shown while zooming */
+	std::map<int, FramebufferImage> levels;
+	/** Whether the last draw showed a zoom level instead of an exact rendering */
+	bool showingLevel = false;
+	/** Copy of `image` for getImageHandle(), created on its first call and updated whenever `image` is re-rendered */
+	NVGLUframebuffer *handleFb = NULL;
+	Vec handleSize;
 
-		nvgEndFrame(gFramebufferVg);
+	~Internal() {
+		clear();
+		if (handleFb)
+			nvgluDeleteFramebuffer(handleFb);
+	}
+	/** Copies `image` out of its atlas page into `handleFb`, resizing it if needed */
+	void updateHandle() {
+		if (!image.slot)
+			return;
+		int w = image.imageSize.x;
+		int h = image.imageSize.y;
+		if (handleFb && !handleSize.isEqual(image.imageSize)) {
+			nvgluDeleteFramebuffer(handleFb);
+			handleFb = NULL;
+		}
+		if (!handleFb) {
+			handleFb = nvgluCreateFramebuffer(gVg, w, h, 0);
+			if (!handleFb)
+				return;
+			handleSize = image.imageSize;
+		}
+		AtlasSlot *slot = image.slot;
+		// OpenGL's origin is the bottom-left of the page, and the image is inside the slot's border
+		int srcX = slot->x + 1;
+		int srcY = slot->page->h - slot->y - 1 - h;
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, slot->page->fb->fbo);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, handleFb->fbo);
+		glBlitFramebuffer(srcX, srcY, srcX + w, srcY + h, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
 		nvgluBindFramebuffer(NULL);
 	}
+	void clear() {
+		if (image.slot)
+			releaseSlot(image.slot);
+		while (!levels.empty())
+			eraseLevel(levels.begin());
+	}
+	void eraseLevel(std::map<int, FramebufferImage>::iterator it) {
+		if (it->second.slot)
+			atlasRelease(it->second.slot);
+		levels.erase(it);
+	}
+	/** Frees an image's atlas slot, so it will be re-rendered if needed */
+	void releaseSlot(AtlasSlot *slot) {
+		if (image.slot == slot) {
+			image.slot = NULL;
+			atlasRelease(slot);
+			return;
+		}
+		for (auto it = levels.begin(); it != levels.end(); it++) {
+			if (it->second.slot == slot) {
+				eraseLevel(it);
+				return;
+			}
+		}
+	}
+};
+
+
+static bool atlasEvict() {
+	AtlasSlot *lru = NULL;
+	for (AtlasPage *page : atlasPages) {
+		for (AtlasSlot *slot : page->slots) {
+			if (!slot->owner || slot->lastFrame >= gGuiFrame)
+				continue;
+			if (!lru || slot->lastFrame < lru->lastFrame)
+				lru = slot;
+		}
+	}
+	if (!lru)
+		return false;
+	// The owner re-renders its children the next time it is drawn
+	lru->owner->releaseSlot(lru);
+	return true;
+}
+
+static bool isZooming() {
+	return glfwGetTime() - lastZoomTime < ZOOM_SETTLE_TIME;
+}
 
-	if (!internal->fb) {
+
+FramebufferWidget::FramebufferWidget() {
+	oversample = 1.0;
+	internal = new Internal();
+}
+
+FramebufferWidget::~FramebufferWidget() {
+	delete internal;
+}
+
+/** Renders the children of `fw` into `image` at scale `s`, offset by the subpixel translation `bf` */
+static void renderImage(FramebufferWidget *fw, FramebufferImage &image, Vec s, Vec bf) {
+	FramebufferWidget::Internal *internal = fw->internal;
+	image.scale = s;
+	image.box = fw->getChildrenBoundingBox();
+	image.box.pos = image.box.pos.mult(s).floor();
+	image.box.size = image.box.size.mult(s).ceil().plus(Vec(1, 1));
+
+	Vec fbSize = image.box.size.mult(gPixelRatio * fw->oversample);
+
+	if (!fbSize.isFinite() || fbSize.isZero()) {
+		if (image.slot)
+			internal->releaseSlot(image.slot);
 		return;
 	}
+	int fbWidth = fbSize.x;
+	int fbHeight = fbSize.y;
+
+	// info("rendering framebuffer %f %f", fbSize.x, fbSize.y);
+	// Keep the current slot if the new image still fits in it exactly, otherwise release it first so its space can be reused
+	AtlasSlot *slot = image.slot;
+	if (!slot || slot->w != atlasSlotSize(fbWidth) || slot->h != atlasSlotSize(fbHeight)) {
+		if (slot)
+			internal->releaseSlot(slot);
+		// Allocate from the main nanovg context. We will draw to it in the secondary nanovg context.
+		slot = atlasAllocate(internal, fbWidth, fbHeight);
+		image.slot = slot;
+		if (!slot)
+			return;
+	}
+	AtlasPage *page = slot->page;
+	image.imageSize = Vec(fbWidth, fbHeight);
+
+	nvgluBindFramebuffer(page->fb);
+	// OpenGL's origin is the bottom-left of the page
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(slot->x, page->h - slot->y - slot->h, slot->w, slot->h);
+	glClearColor(0.0, 0.0, 0.0, 0.0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	glDisable(GL_SCISSOR_TEST);
+	// Render inside the border
+	glViewport(slot->x + 1, page->h - slot->y - 1 - fbHeight, fbWidth, fbHeight);
+
+	nvgBeginFrame(gFramebufferVg, fbWidth, fbHeight, gPixelRatio * fw->oversample);
+
+	nvgScale(gFramebufferVg, gPixelRatio * fw->oversample, gPixelRatio * fw->oversample);
+	// Use local scaling
+	nvgTranslate(gFramebufferVg, bf.x, bf.y);
+	nvgTranslate(gFramebufferVg, -image.box.pos.x, -image.box.pos.y);
+	nvgScale(gFramebufferVg, s.x, s.y);
+	fw->Widget::draw(gFramebufferVg);
+
+	nvgEndFrame(gFramebufferVg);
+	nvgluBindFramebuffer(NULL);
+}
+
+/** Draws `image` at the world scale `s` and integer translation `bi` */
+static void drawImage(NVGcontext *vg, FramebufferImage &image, Vec s, Vec bi) {
+	AtlasSlot *slot = image.slot;
+	slot->lastFrame = gGuiFrame;
 
 	// Draw framebuffer image, using world coordinates
 	nvgSave(vg);
 	nvgResetTransform(vg);
 	nvgTranslate(vg, bi.x, bi.y);
+	// Stretch images rendered at another zoom level
+	nvgScale(vg, s.x / image.scale.x, s.y / image.scale.y);
+
+	// Position the whole page so the slot's image lands on the box
+	Vec scale = image.box.size.div(image.imageSize);
+	Vec pagePos = image.box.pos.minus(Vec(slot->x + 1, slot->y + 1).mult(scale));
+	Vec pageSize = Vec(slot->page->w, slot->page->h).mult(scale);
 
 	nvgBeginPath(vg);
-	nvgRect(vg, internal->box.pos.x, internal->box.pos.y, internal->box.size.x, internal->box.size.y);
-	NVGpaint paint = nvgImagePattern(vg, internal->box.pos.x, internal->box.pos.y, internal->box.size.x, internal->box.size.y, 0.0, internal->fb->image, 1.0);
+	nvgRect(vg, image.box.pos.x, image.box.pos.y, image.box.size.x, image.box.size.y);
+	NVGpaint paint = nvgImagePattern(vg, pagePos.x, pagePos.y, pageSize.x, pageSize.y, 0.0, slot->page->fb->image, 1.0);
 	nvgFillPaint(vg, paint);
 	nvgFill(vg);
 
@@ -112,14 +517,80 @@ void FramebufferWidget::draw(NVGcontext *vg) {
 	nvgRestore(vg);
 }
 
+void FramebufferWidget::draw(NVGcontext *vg) {
+	// Bypass framebuffer rendering entirely
+	// Widget::draw(vg);
+	// return;
+
+	// Get world transform
+	float xform[6];
+	nvgCurrentTransform(vg, xform);
+	// Skew and rotate is not supported
+	assert(fabsf(xform[1]) < 1e-6);
+	assert(fabsf(xform[2]) < 1e-6);
+	Vec s = Vec(xform[0], xform[3]);
+	Vec b = Vec(xform[4], xform[5]);
+	Vec bi = b.floor();
+	Vec bf = b.minus(bi);
+
+	// The children changed, so every cached rendering is stale
+	if (dirty) {
+		dirty = false;
+		internal->clear();
+	}
+
+	FramebufferImage *image = &internal->image;
+	if (!image->slot || !image->scale.isEqual(s)) {
+		if (isZooming()) {
+			// Show the nearest zoom level, rendering it only if this is the first time the zoom passes through it
+			int level = (int) roundf(log2f(s.x) * ZOOM_LEVELS_PER_OCTAVE);
+			auto it = internal->levels.find(level);
+			if (it == internal->levels.end()) {
+				// Forget the level furthest from this one
+				if (internal->levels.size() >= ZOOM_LEVELS_MAX) {
+					auto first = internal->levels.begin();
+					auto last = std::prev(internal->levels.end());
+					internal->eraseLevel((abs(first->first - level) > abs(last->first - level)) ? first : last);
+				}
+				float levelScale = powf(2.f, level / ZOOM_LEVELS_PER_OCTAVE);
+				renderImage(this, internal->levels[level], Vec(levelScale, levelScale), Vec());
+				it = internal->levels.find(level);
+			}
+			// Otherwise stretch the stale exact rendering, if there is one
+			if (it != internal->levels.end() && it->second.slot)
+				image = &it->second;
+		}
+		else {
+			renderImage(this, *image, s, bf);
+			if (internal->handleFb)
+				internal->updateHandle();
+		}
+	}
+	internal->showingLevel = (image != &internal->image);
+
+	if (!image->slot) {
+		return;
+	}
+	drawImage(vg, *image, s, bi);
+}
+
+bool FramebufferWidget::isRenderPending() {
+	return dirty || (internal->showingLevel && !isZooming());
+}
+
 int FramebufferWidget::getImageHandle() {
-	if (!internal->fb)
+	if (!internal->image.slot)
+		return -1;
+	if (!internal->handleFb)
+		internal->updateHandle();
+	if (!internal->handleFb)
 		return -1;
-	return internal->fb->image;
+	return internal->handleFb->image;
 }
 
 void FramebufferWidget::onZoom(EventZoom &e) {
-	dirty = true;
+	// The current image is shown at the nearest cached zoom level until the zoom settles, then re-rendered
+	lastZoomTime = glfwGetTime();
 	Widget::onZoom(e);
 }
 
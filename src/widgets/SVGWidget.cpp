@@ -52,16 +52,59 @@ static float getLineCrossing(Vec p0, Vec p1, Vec p2, Vec p3) {
 	return -(d.x * b.y - d.y * b.x) / m;
 }
 
-static void drawSVG(NVGcontext *vg, NSVGimage *svg) {
-	DEBUG_ONLY(printf("new image: %g x %g px\n", svg->width, svg->height);)
+void SVG::computeWindings() {
+	windings.clear();
+	for (NSVGshape *shape = handle->shapes; shape; shape = shape->next) {
+		for (NSVGpath *path = shape->paths; path; path = path->next) {
+			// Compute whether this is a hole or a solid.
+			// Assume that no paths are crossing (usually true for normal SVG graphics).
+			// Also assume that the topology is the same if we use straight lines rather than Beziers (not always the case but usually true).
+			// Using the even-odd fill rule, if we draw a line from a point on the path to a point outside the boundary (e.g. top left) and count the number of times it crosses another path, the parity of this count determines whether the path is a hole (odd) or solid (even).
+			int crossings = 0;
+			Vec p0 = Vec(path->pts[0], path->pts[1]);
+			Vec p1 = Vec(path->bounds[0] - 1.0, path->bounds[1] - 1.0);
+			// Iterate all other paths
+			for (NSVGpath *path2 = shape->paths; path2; path2 = path2->next) {
+				if (path2 == path)
+					continue;
+
+				// Iterate all lines on the path
+				if (path2->npts < 4)
+					continue;
+				for (int i = 1; i < path2->npts + 3; i += 3) {
+					float *p = &path2->pts[2*i];
+					// The previous point
+					Vec p2 = Vec(p[-2], p[-1]);
+					// The current point
+					Vec p3 = (i < path2->npts) ? Vec(p[4], p[5]) : Vec(path2->pts[0], path2->pts[1]);
+					float crossing = getLineCrossing(p0, p1, p2, p3);
+					float crossing2 = getLineCrossing(p2, p3, p0, p1);
+					if (0.0 <= crossing && crossing < 1.0 && 0.0 <= crossing2) {
+						crossings++;
+					}
+				}
+			}
+
+			windings.push_back((crossings % 2 == 0) ? NVG_SOLID : NVG_HOLE);
+		}
+	}
+}
+
+static void drawSVG(NVGcontext *vg, SVG *svg) {
+	NSVGimage *image = svg->handle;
+	DEBUG_ONLY(printf("new image: %g x %g px\n", image->width, image->height);)
 	int shapeIndex = 0;
+	size_t pathIndex = 0;
 	// Iterate shape linked list
-	for (NSVGshape *shape = svg->shapes; shape; shape = shape->next, shapeIndex++) {
+	for (NSVGshape *shape = image->shapes; shape; shape = shape->next, shapeIndex++) {
 		DEBUG_ONLY(printf("	new shape: %d id \"%s\", fillrule %d, from (%f, %f) to (%f, %f)\n", shapeIndex, shape->id, shape->fillRule, shape->bounds[0], shape->bounds[1], shape->bounds[2], shape->bounds[3]);)
 
 		// Visibility
-		if (!(shape->flags & NSVG_FLAGS_VISIBLE))
+		if (!(shape->flags & NSVG_FLAGS_VISIBLE)) {
+			for (NSVGpath *path = shape->paths; path; path = path->next)
+				pathIndex++;
 			continue;
+		}
 
 		nvgSave(vg);
 
@@ -88,39 +131,7 @@ static void drawSVG(NVGcontext *vg, NSVGimage *svg) {
 			if (path->closed)
 				nvgClosePath(vg);
 
-			// Compute whether this is a hole or a solid.
-			// Assume that no paths are crossing (usually true for normal SVG graphics).
-			// Also assume that the topology is the same if we use straight lines rather than Beziers (not always the case but usually true).
-			// Using the even-odd fill rule, if we draw a line from a point on the path to a point outside the boundary (e.g. top left) and count the number of times it crosses another path, the parity of this count determines whether the path is a hole (odd) or solid (even).
-			int crossings = 0;
-			Vec p0 = Vec(path->pts[0], path->pts[1]);
-			Vec p1 = Vec(path->bounds[0] - 1.0, path->bounds[1] - 1.0);
-			// Iterate all other paths
-			for (NSVGpath *path2 = shape->paths; path2; path2 = path2->next) {
-				if (path2 == path)
-					continue;
-
-				// Iterate all lines on the path
-				if (path2->npts < 4)
-					continue;
-				for (int i = 1; i < path2->npts + 3; i += 3) {
-					float *p = &path2->pts[2*i];
-					// The previous point
-					Vec p2 = Vec(p[-2], p[-1]);
-					// The current point
-					Vec p3 = (i < path2->npts) ? Vec(p[4], p[5]) : Vec(path2->pts[0], path2->pts[1]);
-					float crossing = getLineCrossing(p0, p1, p2, p3);
-					float crossing2 = getLineCrossing(p2, p3, p0, p1);
-					if (0.0 <= crossing && crossing < 1.0 && 0.0 <= crossing2) {
-						crossings++;
-					}
-				}
-			}
-
-			if (crossings % 2 == 0)
-				nvgPathWinding(vg, NVG_SOLID);
-			else
-				nvgPathWinding(vg, NVG_HOLE);
+			nvgPathWinding(vg, svg->windings[pathIndex++]);
 
 /*
 			// Shoelace algorithm for computing the area, and thus the winding direction
@@ -212,7 +223,7 @@ void SVGWidget::setSVG(std::shared_ptr<SVG> svg) {
 void SVGWidget::draw(NVGcontext *vg) {
 	if (svg && svg->handle) {
 		// printf("drawing svg %f %f\n", box.size.x, box.size.y);
-		drawSVG(vg, svg->handle);
+		drawSVG(vg, svg.get());
 	}
 }
 
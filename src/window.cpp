@@ -3,11 +3,20 @@
 #include "asset.hpp"
 #include "gamepad.hpp"
 #include "keyboard.hpp"
+#include "engine.hpp"
+#include "plugin.hpp"
 #include "util/color.hpp"
 
 #include <map>
+#include <set>
 #include <queue>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+#include <typeindex>
 
 #include "osdialog.h"
 
@@ -43,14 +52,32 @@ float gWindowRatio = 1.0;
 bool gAllowCursorLock = true;
 int gGuiFrame;
 Vec gMousePos;
+int gInputGeneration = 0;
+float gFrameTime = 0.f;
+float gIdleFrameRate = 30.f;
+float gBackgroundFrameRate = 10.f;
+Rect gDamageRect;
 
 std::string lastWindowTitle;
 
+/** The scene is rendered to this framebuffer, which keeps its contents between frames so only damaged areas need to be redrawn */
+static NVGLUframebuffer *sceneFb = NULL;
+static int sceneFbWidth = 0;
+static int sceneFbHeight = 0;
+static bool fullRedraw = true;
+/** State which causes a full redraw when changed */
+static int lastInputGeneration = -1;
+static Vec lastRedrawMousePos;
+static Vec lastScrollOffset;
+static float lastZoom = 0.f;
+
 
 void windowSizeCallback(GLFWwindow* window, int width, int height) {
+	gInputGeneration++;
 }
 
 void mouseButtonCallback(GLFWwindow *window, int button, int action, int mods) {
+	gInputGeneration++;
 #ifdef ARCH_MAC
 	// Ctrl-left click --> right click
 	if (button == GLFW_MOUSE_BUTTON_LEFT) {
@@ -154,6 +181,9 @@ void mouseButtonStickyCallback(GLFWwindow *window, int button, int action, int m
 void cursorPosCallback(GLFWwindow* window, double xpos, double ypos) {
 	Vec mousePos = Vec(xpos, ypos).div(gPixelRatio / gWindowRatio).round();
 	Vec mouseRel = mousePos.minus(gMousePos);
+	// Called every frame, so only count actual movement as input
+	if (!mouseRel.isZero())
+		gInputGeneration++;
 
 	int cursorMode = glfwGetInputMode(gWindow, GLFW_CURSOR);
 	(void) cursorMode;
@@ -241,6 +271,7 @@ void cursorEnterCallback(GLFWwindow* window, int entered) {
 }
 
 void scrollCallback(GLFWwindow *window, double x, double y) {
+	gInputGeneration++;
 	Vec scrollRel = Vec(x, y);
 #if ARCH_LIN || ARCH_WIN
 	if (windowIsShiftPressed())
@@ -254,6 +285,7 @@ void scrollCallback(GLFWwindow *window, double x, double y) {
 }
 
 void charCallback(GLFWwindow *window, unsigned int codepoint) {
+	gInputGeneration++;
 	if (gFocusedWidget) {
 		// onText
 		EventText e;
@@ -263,6 +295,7 @@ void charCallback(GLFWwindow *window, unsigned int codepoint) {
 }
 
 void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods) {
+	gInputGeneration++;
 	if (action == GLFW_PRESS || action == GLFW_REPEAT) {
 		if (gFocusedWidget) {
 			// onKey
@@ -291,6 +324,7 @@ void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods
 }
 
 void dropCallback(GLFWwindow *window, int count, const char **paths) {
+	gInputGeneration++;
 	// onPathDrop
 	EventPathDrop e;
 	e.pos = gMousePos;
@@ -304,24 +338,422 @@ void errorCallback(int error, const char *description) {
 	warn("GLFW error %d: %s", error, description);
 }
 
+/** Draws common glyphs of the GUI font invisibly, so they are rasterized into the font atlas before the first menu or module browser needs them */
+static void prewarmGlyphs() {
+	std::string glyphs;
+	for (char c = ' '; c <= '~'; c++) {
+		glyphs += c;
+	}
+	glyphs += "★";
+	nvgSave(gVg);
+	nvgGlobalAlpha(gVg, 0.0);
+	nvgFontFaceId(gVg, gGuiFont->handle);
+	nvgTextAlign(gVg, NVG_ALIGN_LEFT | NVG_ALIGN_BASELINE);
+	// Sizes used by Label, menus, the module browser, and LedDisplay
+	for (float size : {12.f, 13.f, 20.f}) {
+		nvgFontSize(gVg, size);
+		nvgText(gVg, 0, 0, glyphs.c_str(), NULL);
+	}
+	nvgRestore(gVg);
+}
+
+/** How a widget's area is damaged, besides changes to its box, its visibility, or its drawn state */
+enum DamageClass {
+	/** Draws only its children, or draws something which only changes with its tracked state */
+	DAMAGE_STATIC,
+	/** A FramebufferWidget, damaged when it is dirty */
+	DAMAGE_FRAMEBUFFER,
+	/** A LightWidget, whose halo extends past its box */
+	DAMAGE_LIGHT,
+	/** The WireContainer, damaged when a plug light changes */
+	DAMAGE_WIRES,
+};
+
+/** Which fields of a widget determine what it draws, besides its box */
+enum DamageState {
+	STATE_NONE,
+	STATE_MODULE,
+	STATE_LIGHT,
+	STATE_LABEL,
+	STATE_LED_DISPLAY_CHOICE,
+	STATE_TEXT_FIELD,
+	STATE_BUTTON,
+	STATE_QUANTITY,
+};
+
+struct DamageType {
+	DamageClass damageClass;
+	DamageState state;
+};
+
+static DamageType getDamageType(Widget *w) {
+	// Classes can't change, so cache the result for each class
+	static std::unordered_map<std::type_index, DamageType> cache;
+	std::type_index type = typeid(*w);
+	auto it = cache.find(type);
+	if (it != cache.end())
+		return it->second;
+
+	// Subclasses are assumed to draw the same as their base class, unless they set `alwaysDirty`.
+	// Order matters, since some classes inherit from more than one of these.
+	DamageType damageType = {DAMAGE_STATIC, STATE_NONE};
+	if (dynamic_cast<FramebufferWidget*>(w))
+		damageType.damageClass = DAMAGE_FRAMEBUFFER;
+	else if (dynamic_cast<LightWidget*>(w))
+		damageType = {DAMAGE_LIGHT, STATE_LIGHT};
+	else if (dynamic_cast<WireContainer*>(w))
+		damageType.damageClass = DAMAGE_WIRES;
+	else if (dynamic_cast<ModuleWidget*>(w))
+		damageType.state = STATE_MODULE;
+	else if (dynamic_cast<Label*>(w))
+		damageType.state = STATE_LABEL;
+	else if (dynamic_cast<LedDisplayChoice*>(w))
+		damageType.state = STATE_LED_DISPLAY_CHOICE;
+	else if (dynamic_cast<TextField*>(w))
+		damageType.state = STATE_TEXT_FIELD;
+	else if (dynamic_cast<Button*>(w))
+		damageType.state = STATE_BUTTON;
+	else if (dynamic_cast<QuantityWidget*>(w))
+		damageType.state = STATE_QUANTITY;
+	cache[type] = damageType;
+	return damageType;
+}
+
+static size_t hashCombine(size_t seed, size_t value) {
+	return seed ^ (value + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
+static size_t hashColor(NVGcolor c) {
+	std::hash<float> h;
+	return hashCombine(hashCombine(hashCombine(h(c.r), h(c.g)), h(c.b)), h(c.a));
+}
+
+/** Returns a hash of the fields which determine what `w` draws */
+static size_t getStateHash(Widget *w, DamageState state) {
+	std::hash<std::string> hashString;
+	switch (state) {
+		case STATE_NONE: return 0;
+		case STATE_MODULE: {
+			Module *module = dynamic_cast<ModuleWidget*>(w)->module;
+			if (!module)
+				return 0;
+			size_t h = module->bypassed;
+			if (gPowerMeter) {
+				float cpuTime = 0.f;
+				module->snapshot.read(module->snapshot.cpuTimeOffset(), &cpuTime, 1);
+				h = hashCombine(h, std::hash<float>()(cpuTime));
+			}
+			return h;
+		}
+		case STATE_LIGHT: {
+			return hashColor(dynamic_cast<LightWidget*>(w)->color);
+		}
+		case STATE_LABEL: {
+			Label *label = dynamic_cast<Label*>(w);
+			return hashCombine(hashString(label->text), hashColor(label->color));
+		}
+		case STATE_LED_DISPLAY_CHOICE: {
+			LedDisplayChoice *choice = dynamic_cast<LedDisplayChoice*>(w);
+			return hashCombine(hashString(choice->text), hashColor(choice->color));
+		}
+		case STATE_TEXT_FIELD: {
+			TextField *field = dynamic_cast<TextField*>(w);
+			return hashCombine(hashString(field->text), hashCombine(field->cursor, field->selection));
+		}
+		case STATE_BUTTON: {
+			Button *button = dynamic_cast<Button*>(w);
+			return hashCombine(hashString(button->text), button->state);
+		}
+		case STATE_QUANTITY: {
+			QuantityWidget *quantity = dynamic_cast<QuantityWidget*>(w);
+			return hashCombine(std::hash<float>()(quantity->value), hashString(quantity->label));
+		}
+	}
+	return 0;
+}
+
+
+/** What a widget drew on the last frame */
+struct WidgetDamageState {
+	/** Area in scene coordinates */
+	Rect rect;
+	bool visible = true;
+	size_t stateHash = 0;
+	/** gGuiFrame when the widget was last visited, so deleted widgets can be found */
+	int frame = -1;
+};
+
+static std::unordered_map<Widget*, WidgetDamageState> widgetStates;
+/** Plug light colors, which are drawn by the WireContainer rather than their Ports */
+static std::unordered_map<Widget*, NVGcolor> plugLightColors;
+
+/** Maximum number of separately redrawn areas. Each one draws the scene once. */
+static const size_t DAMAGE_RECTS_MAX = 8;
+
+static float getRectArea(Rect r) {
+	return r.size.x * r.size.y;
+}
+
+/** Adds `r` to a list of disjoint rects, merging it with the rects it overlaps, so no area is drawn twice */
+static void addDamageRect(std::vector<Rect> &rects, Rect r) {
+	for (size_t i = 0; i < rects.size();) {
+		if (rects[i].intersects(r)) {
+			r = r.expand(rects[i]);
+			rects.erase(rects.begin() + i);
+			// The union might overlap rects which were already checked
+			i = 0;
+		}
+		else {
+			i++;
+		}
+	}
+	if (rects.size() < DAMAGE_RECTS_MAX) {
+		rects.push_back(r);
+		return;
+	}
+	// Too many rects, so merge with the one whose union wastes the least area
+	size_t best = 0;
+	float bestWaste = INFINITY;
+	for (size_t i = 0; i < rects.size(); i++) {
+		float waste = getRectArea(rects[i].expand(r)) - getRectArea(rects[i]) - getRectArea(r);
+		if (waste < bestWaste) {
+			best = i;
+			bestWaste = waste;
+		}
+	}
+	Rect merged = rects[best].expand(r);
+	rects.erase(rects.begin() + best);
+	addDamageRect(rects, merged);
+}
+
+struct DamageCollector {
+	/** The window, in scene coordinates */
+	Rect viewport;
+	std::vector<Rect> rects;
+	/** Boxes of the modules on screen, in scene coordinates */
+	std::vector<Rect> moduleRects;
+
+	void add(Rect sceneRect) {
+		if (!sceneRect.intersects(viewport))
+			return;
+		sceneRect = sceneRect.clamp(viewport);
+		// Snap to pixels, so the rects are still disjoint after the GL scissor rounds them
+		sceneRect = Rect::fromMinMax(sceneRect.pos.mult(gPixelRatio).floor().div(gPixelRatio), sceneRect.getBottomRight().mult(gPixelRatio).ceil().div(gPixelRatio));
+		addDamageRect(rects, sceneRect);
+	}
+};
+
+/** Adds the damaged areas of `w` and its descendants to `collector`
+`origin` is the position of `w` in scene coordinates and `scale` is the scale of its box.
+*/
+static void collectDamage(Widget *w, Vec origin, float scale, DamageCollector &collector) {
+	DamageType type = getDamageType(w);
+	Rect rect = Rect(origin, w->box.size.mult(scale));
+	if (type.damageClass == DAMAGE_LIGHT) {
+		// Include the halo
+		rect = rect.grow(Vec(16, 16).mult(scale));
+	}
+
+	// Damage the old and new areas if anything the widget draws has changed since the last frame
+	WidgetDamageState &state = widgetStates[w];
+	size_t stateHash = w->visible ? getStateHash(w, type.state) : 0;
+	bool isNew = (state.frame < 0);
+	if (isNew || !state.rect.isEqual(rect) || state.visible != w->visible || state.stateHash != stateHash) {
+		if (!isNew && state.visible)
+			collector.add(state.rect);
+		if (w->visible)
+			collector.add(rect);
+	}
+	state.rect = rect;
+	state.visible = w->visible;
+	state.stateHash = stateHash;
+	state.frame = gGuiFrame;
+	if (!w->visible)
+		return;
+
+	if (w->alwaysDirty)
+		collector.add(rect);
+
+	switch (type.damageClass) {
+		case DAMAGE_STATIC: break;
+		case DAMAGE_LIGHT: break;
+		case DAMAGE_FRAMEBUFFER: {
+			FramebufferWidget *fw = dynamic_cast<FramebufferWidget*>(w);
+			if (fw->isRenderPending()) {
+				Rect childrenBox = fw->getChildrenBoundingBox().grow(Vec(1, 1));
+				collector.add(Rect(origin.plus(childrenBox.pos.mult(scale)), childrenBox.size.mult(scale)));
+			}
+			// Children are drawn into the framebuffer, so they can't damage the scene directly
+			return;
+		} break;
+		case DAMAGE_WIRES: {
+			for (Widget *child : w->children) {
+				WireWidget *wire = dynamic_cast<WireWidget*>(child);
+				Port *ports[2] = {wire->outputPort, wire->inputPort};
+				Vec positions[2] = {wire->getOutputPos(), wire->getInputPos()};
+				for (int i = 0; i < 2; i++) {
+					if (!ports[i])
+						continue;
+					LightWidget *plugLight = ports[i]->plugLight;
+					auto it = plugLightColors.find(plugLight);
+					if (it == plugLightColors.end() || !colorIsEqual(it->second, plugLight->color)) {
+						plugLightColors[plugLight] = plugLight->color;
+						collector.add(Rect(origin.plus(positions[i].minus(w->box.pos).mult(scale)), Vec()).grow(Vec(24, 24).mult(scale)));
+					}
+				}
+			}
+			// Wires themselves only change with input
+			return;
+		} break;
+	}
+
+	float childScale = scale;
+	ZoomWidget *zoomWidget = dynamic_cast<ZoomWidget*>(w);
+	if (zoomWidget)
+		childScale *= zoomWidget->zoom;
+	bool isModuleContainer = (w == gRackWidget->moduleContainer);
+	for (Widget *child : w->children) {
+		Vec childOrigin = origin.plus(child->box.pos.mult(childScale));
+		if (isModuleContainer) {
+			Rect childRect = Rect(childOrigin, child->box.size.mult(childScale));
+			// Skip off-screen modules entirely, like RackWidget does when drawing them. Grow by the size of a light halo.
+			if (!childRect.grow(Vec(16, 16).mult(childScale)).intersects(collector.viewport))
+				continue;
+			if (child->visible)
+				collector.moduleRects.push_back(childRect);
+		}
+		collectDamage(child, childOrigin, childScale, collector);
+	}
+}
+
+/** Returns the areas of the window to redraw, in scene coordinates */
+static std::vector<Rect> getDamageRects(Rect screen) {
+	DamageCollector collector;
+	collector.viewport = screen;
+	collectDamage(gScene, gScene->box.pos, 1.f, collector);
+
+	// Forget deleted widgets, and widgets which were not visited because they moved off screen, damaging where they were
+	for (auto it = widgetStates.begin(); it != widgetStates.end();) {
+		if (it->second.frame != gGuiFrame) {
+			if (it->second.visible)
+				collector.add(it->second.rect);
+			it = widgetStates.erase(it);
+		}
+		else {
+			it++;
+		}
+	}
+
+	// Plugin widgets may reset the scissor and draw anywhere in their module, so a damaged module is redrawn whole.
+	// Otherwise translucent content outside of the damage would be drawn again on top of the last frame.
+	bool expanded = true;
+	while (expanded) {
+		expanded = false;
+		for (Rect moduleRect : collector.moduleRects) {
+			for (Rect damage : collector.rects) {
+				if (damage.intersects(moduleRect) && !damage.contains(moduleRect.clamp(screen))) {
+					collector.add(moduleRect);
+					expanded = true;
+					break;
+				}
+			}
+		}
+	}
+	return collector.rects;
+}
+
 void renderGui() {
 	int width, height;
 	glfwGetFramebufferSize(gWindow, &width, &height);
 
+	// (Re)create the scene framebuffer
+	if (!sceneFb || width != sceneFbWidth || height != sceneFbHeight) {
+		if (sceneFb)
+			nvgluDeleteFramebuffer(sceneFb);
+		sceneFb = nvgluCreateFramebuffer(gVg, width, height, 0);
+		sceneFbWidth = width;
+		sceneFbHeight = height;
+		fullRedraw = true;
+	}
+
+	// Input, scrolling, and zooming can change anything in the window
+	if (gInputGeneration != lastInputGeneration || !gMousePos.isEqual(lastRedrawMousePos)) {
+		fullRedraw = true;
+	}
+	Vec scrollOffset = gRackScene->scrollWidget->offset;
+	float zoom = gRackScene->zoomWidget->zoom;
+	if (!scrollOffset.isEqual(lastScrollOffset) || zoom != lastZoom) {
+		fullRedraw = true;
+	}
+	lastInputGeneration = gInputGeneration;
+	lastRedrawMousePos = gMousePos;
+	lastScrollOffset = scrollOffset;
+	lastZoom = zoom;
+
+	// Always collect the damage, so the tracked state of every widget is current after a full redraw
+	Rect screen = Rect(Vec(), gScene->box.size);
+	std::vector<Rect> damageRects = getDamageRects(screen);
+	if (fullRedraw || !sceneFb) {
+		damageRects = {screen};
+	}
+	// Nothing changed, so the last frame is still on screen
+	if (damageRects.empty())
+		return;
+	fullRedraw = false;
+
 	// Update and render
 	nvgBeginFrame(gVg, width, height, gPixelRatio);
+	static bool glyphsPrewarmed = false;
+	if (!glyphsPrewarmed) {
+		nvgReset(gVg);
+		nvgScale(gVg, gPixelRatio, gPixelRatio);
+		prewarmGlyphs();
+		glyphsPrewarmed = true;
+	}
+	// Draw the scene once for each damaged area. The areas are disjoint, so nothing is drawn twice.
+	for (Rect damage : damageRects) {
+		gDamageRect = damage;
+		nvgReset(gVg);
+		nvgScale(gVg, gPixelRatio, gPixelRatio);
+		nvgScissor(gVg, damage.pos.x, damage.pos.y, damage.size.x, damage.size.y);
+		gScene->draw(gVg);
+	}
 
-	nvgReset(gVg);
-	nvgScale(gVg, gPixelRatio, gPixelRatio);
-	gScene->draw(gVg);
-
+	if (sceneFb)
+		nvgluBindFramebuffer(sceneFb);
 	glViewport(0, 0, width, height);
+	// Clear only the damaged areas. OpenGL's origin is the bottom-left.
+	glEnable(GL_SCISSOR_TEST);
 	glClearColor(0.0, 0.0, 0.0, 1.0);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	for (Rect damage : damageRects) {
+		glScissor(roundf(damage.pos.x * gPixelRatio), roundf(height - (damage.pos.y + damage.size.y) * gPixelRatio), roundf(damage.size.x * gPixelRatio), roundf(damage.size.y * gPixelRatio));
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	}
+	glDisable(GL_SCISSOR_TEST);
 	nvgEndFrame(gVg);
+	gDamageRect = screen;
+
+	if (sceneFb) {
+		// Copy the scene framebuffer to the window
+		nvgluBindFramebuffer(NULL);
+		glViewport(0, 0, width, height);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+		nvgBeginFrame(gVg, width, height, 1.0);
+		nvgBeginPath(gVg);
+		nvgRect(gVg, 0, 0, width, height);
+		nvgFillPaint(gVg, nvgImagePattern(gVg, 0, 0, width, height, 0.0, sceneFb->image, 1.0));
+		nvgFill(gVg);
+		nvgEndFrame(gVg);
+	}
 	glfwSwapBuffers(gWindow);
 }
 
+Rect windowGetDamageRect(Widget *widget) {
+	Vec origin = widget->getRelativeOffset(Vec(0, 0), gScene);
+	Vec scale = widget->getRelativeOffset(Vec(1, 1), gScene).minus(origin);
+	return Rect(gDamageRect.pos.minus(origin).div(scale), gDamageRect.size.div(scale));
+}
+
 void windowInit() {
 	int err;
 
@@ -410,6 +842,11 @@ void windowInit() {
 void windowDestroy() {
 	gGuiFont.reset();
 
+	if (sceneFb) {
+		nvgluDeleteFramebuffer(sceneFb);
+		sceneFb = NULL;
+	}
+
 #if defined NANOVG_GL2
 	nvgDeleteGL2(gVg);
 #elif defined NANOVG_GL3
@@ -430,9 +867,16 @@ void windowDestroy() {
 	glfwTerminate();
 }
 
+static void svgPrefetchStep();
+
 void windowRun() {
 	assert(gWindow);
 	gGuiFrame = 0;
+	// Seconds without input before the frame rate drops to gIdleFrameRate
+	const double idleDelay = 2.0;
+	double lastActiveTime = glfwGetTime();
+	int lastActiveInputGeneration = gInputGeneration;
+	Vec lastActiveMousePos = gMousePos;
 	while(!glfwWindowShouldClose(gWindow)) {
 		double startTime = glfwGetTime();
 		gGuiFrame++;
@@ -447,6 +891,8 @@ void windowRun() {
 		}
 		mouseButtonStickyPop();
 		gamepadStep();
+		pluginStep();
+		svgPrefetchStep();
 
 		// Set window title
 		std::string windowTitle;
@@ -470,6 +916,7 @@ void windowRun() {
 			EventZoom eZoom;
 			gScene->onZoom(eZoom);
 			gPixelRatio = pixelRatio;
+			fullRedraw = true;
 		}
 
 		// Get framebuffer/window ratio
@@ -489,16 +936,51 @@ void windowRun() {
 		if (visible) {
 			renderGui();
 		}
+		else {
+			fullRedraw = true;
+		}
 
-		// Limit framerate manually if vsync isn't working
 		double endTime = glfwGetTime();
 		double frameTime = endTime - startTime;
-		double minTime = 1.0 / 90.0;
-		if (frameTime < minTime) {
-			std::this_thread::sleep_for(std::chrono::duration<double>(minTime - frameTime));
+		// Smooth over roughly one second of frames
+		gFrameTime += (frameTime - gFrameTime) * 0.02f;
+
+		// Run at the full frame rate for a while after the user does anything, otherwise throttle
+		if (gInputGeneration != lastActiveInputGeneration || !gMousePos.isEqual(lastActiveMousePos)) {
+			lastActiveInputGeneration = gInputGeneration;
+			lastActiveMousePos = gMousePos;
+			lastActiveTime = endTime;
+		}
+		float frameRate = 90.f;
+		bool throttled = false;
+		if (!visible || !glfwGetWindowAttrib(gWindow, GLFW_FOCUSED)) {
+			frameRate = gBackgroundFrameRate;
+			throttled = true;
+		}
+		else if (endTime - lastActiveTime > idleDelay) {
+			frameRate = gIdleFrameRate;
+			throttled = true;
+		}
+
+		// Wait for the next frame while handling events, which also limits the frame rate if vsync isn't working
+		double deadline = startTime + 1.0 / clamp(frameRate, 1.f, 90.f);
+		int inputGeneration = gInputGeneration;
+		while (true) {
+			double remaining = deadline - glfwGetTime();
+			if (remaining <= 0.0)
+				break;
+			glfwWaitEventsTimeout(remaining);
+			// Respond to input immediately rather than at the throttled frame rate
+			if (throttled) {
+				// The cursor position is polled rather than delivered by a GLFW callback, so check it here to wake up when the mouse moves
+				double xpos, ypos;
+				glfwGetCursorPos(gWindow, &xpos, &ypos);
+				cursorPosCallback(gWindow, xpos, ypos);
+				if (gInputGeneration != inputGeneration)
+					break;
+			}
 		}
-		endTime = glfwGetTime();
-		// info("%lf fps", 1.0 / (endTime - startTime));
+		// info("%lf fps", 1.0 / (glfwGetTime() - startTime));
 	}
 }
 
@@ -658,6 +1140,74 @@ std::shared_ptr<Font> Font::load(const std::string &filename) {
 	return sp;
 }
 
+////////////////////
+// TextLayout
+////////////////////
+
+struct TextLayoutKey {
+	int font;
+	float size;
+	float breakWidth;
+	std::string text;
+
+	bool operator==(const TextLayoutKey &other) const {
+		return font == other.font && size == other.size && breakWidth == other.breakWidth && text == other.text;
+	}
+};
+
+struct TextLayoutKeyHash {
+	size_t operator()(const TextLayoutKey &key) const {
+		size_t hash = std::hash<std::string>()(key.text);
+		hash = hash * 31 + std::hash<int>()(key.font);
+		hash = hash * 31 + std::hash<float>()(key.size);
+		hash = hash * 31 + std::hash<float>()(key.breakWidth);
+		return hash;
+	}
+};
+
+const TextLayout &TextLayout::get(NVGcontext *vg, int font, float size, const std::string &text, float breakWidth) {
+	static std::unordered_map<TextLayoutKey, TextLayout, TextLayoutKeyHash> cache;
+	TextLayoutKey key = {font, size, breakWidth, text};
+	auto it = cache.find(key);
+	if (it != cache.end())
+		return it->second;
+
+	// Layouts aren't used by anything after the next call, so this only costs re-measuring strings which are still on screen
+	if (cache.size() >= 4096)
+		cache.clear();
+
+	TextLayout &layout = cache[key];
+	nvgFontFaceId(vg, font);
+	nvgFontSize(vg, size);
+	nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_BASELINE);
+	nvgTextMetrics(vg, NULL, NULL, &layout.lineHeight);
+	const char *begin = text.c_str();
+	const char *end = begin + text.size();
+	layout.width = nvgTextBounds(vg, 0, 0, begin, end, NULL);
+
+	NVGtextRow rows[8];
+	const char *start = begin;
+	while (true) {
+		int n = nvgTextBreakLines(vg, start, end, breakWidth, rows, LENGTHOF(rows));
+		if (n <= 0)
+			break;
+		for (int i = 0; i < n; i++) {
+			layout.rows.push_back(Row {(int) (rows[i].start - begin), (int) (rows[i].end - begin), rows[i].width});
+		}
+		start = rows[n - 1].next;
+	}
+	return layout;
+}
+
+void TextLayout::draw(NVGcontext *vg, const std::string &text, Vec pos) const {
+	const char *begin = text.c_str();
+	nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_BASELINE);
+	for (const Row &row : rows) {
+		nvgText(vg, pos.x, pos.y, begin + row.begin, begin + row.end);
+		pos.y += lineHeight;
+	}
+}
+
 ////////////////////
 // Image
 ////////////////////
@@ -692,6 +1242,7 @@ std::shared_ptr<Image> Image::load(const std::string &filename) {
 SVG::SVG(const std::string &filename) {
 	handle = nsvgParseFromFile(filename.c_str(), "px", SVG_DPI);
 	if (handle) {
+		computeWindings();
 		info("Loaded SVG %s", filename.c_str());
 	}
 	else {
@@ -703,13 +1254,127 @@ SVG::~SVG() {
 	nsvgDelete(handle);
 }
 
-std::shared_ptr<SVG> SVG::load(const std::string &filename) {
-	static std::map<std::string, std::weak_ptr<SVG>> cache;
-	auto sp = cache[filename].lock();
+static std::mutex svgCacheMutex;
+/** Notified when a file is removed from svgParsing */
+static std::condition_variable svgCacheCv;
+static std::map<std::string, std::weak_ptr<SVG>> svgCache;
+/** SVGs parsed by SVG::prefetch() which haven't been loaded yet, held so they aren't freed */
+static std::map<std::string, std::shared_ptr<SVG>> svgPrefetched;
+/** Prefetched SVGs which aren't loaded within this many seconds after prefetching finishes are freed, so modules which are never used don't hold memory for the whole session */
+static const double SVG_PREFETCH_HOLD_TIME = 60.0;
+/** Number of prefetch threads which haven't finished */
+static std::atomic<int> svgPrefetchRunning(0);
+/** Time at which the last prefetch was seen to have finished, or negative if it hasn't. Only used by the UI thread. */
+static double svgPrefetchDoneTime = -1.0;
+/** Files being parsed on some thread */
+static std::set<std::string> svgParsing;
+static std::vector<std::thread> svgPrefetchThreads;
+static std::atomic<bool> svgPrefetchCancelled(false);
+
+/** Returns the cached SVG, or NULL after marking the file as being parsed by the caller
+Must be called with the lock held.
+*/
+static std::shared_ptr<SVG> svgCacheGet(std::unique_lock<std::mutex> &lock, const std::string &filename) {
+	// Wait for another thread which is already parsing this file
+	svgCacheCv.wait(lock, [&]() {
+		return svgParsing.find(filename) == svgParsing.end();
+	});
+	auto it = svgPrefetched.find(filename);
+	if (it != svgPrefetched.end())
+		return it->second;
+	auto sp = svgCache[filename].lock();
 	if (!sp)
-		cache[filename] = sp = std::make_shared<SVG>(filename);
+		svgParsing.insert(filename);
+	return sp;
+}
+
+static void svgCacheSet(std::unique_lock<std::mutex> &lock, const std::string &filename, std::shared_ptr<SVG> sp) {
+	svgCache[filename] = sp;
+	svgParsing.erase(filename);
+	svgCacheCv.notify_all();
+}
+
+std::shared_ptr<SVG> SVG::load(const std::string &filename) {
+	std::unique_lock<std::mutex> lock(svgCacheMutex);
+	auto sp = svgCacheGet(lock, filename);
+	if (sp) {
+		// From now on the SVG is only held by its users, like any other loaded SVG
+		svgPrefetched.erase(filename);
+		return sp;
+	}
+
+	lock.unlock();
+	sp = std::make_shared<SVG>(filename);
+	lock.lock();
+	svgCacheSet(lock, filename, sp);
 	return sp;
 }
 
+void SVG::prefetch(const std::vector<std::string> &filenames) {
+	stopPrefetch();
+	svgPrefetchCancelled = false;
+
+	// Leave a core free for the UI and engine threads
+	int threadCount = max((int) std::thread::hardware_concurrency() - 1, 1);
+	svgPrefetchRunning = threadCount;
+	svgPrefetchDoneTime = -1.0;
+	auto nextIndex = std::make_shared<std::atomic<size_t>>(0);
+	// The filenames are shared by the workers and outlive this call
+	auto sharedFilenames = std::make_shared<std::vector<std::string>>(filenames);
+	for (int i = 0; i < threadCount; i++) {
+		svgPrefetchThreads.emplace_back([=]() {
+			while (!svgPrefetchCancelled) {
+				size_t index = (*nextIndex)++;
+				if (index >= sharedFilenames->size())
+					break;
+				const std::string &filename = (*sharedFilenames)[index];
+
+				std::unique_lock<std::mutex> lock(svgCacheMutex);
+				if (svgCacheGet(lock, filename))
+					continue;
+				lock.unlock();
+				auto sp = std::make_shared<SVG>(filename);
+				lock.lock();
+				svgCacheSet(lock, filename, sp);
+				svgPrefetched[filename] = sp;
+			}
+			svgPrefetchRunning--;
+		});
+	}
+	info("Prefetching %d SVGs on %d threads", (int) filenames.size(), threadCount);
+}
+
+void SVG::stopPrefetch() {
+	svgPrefetchCancelled = true;
+	for (std::thread &thread : svgPrefetchThreads) {
+		thread.join();
+	}
+	svgPrefetchThreads.clear();
+}
+
+/** Frees the prefetched SVGs which weren't loaded within SVG_PREFETCH_HOLD_TIME after prefetching finished */
+static void svgPrefetchStep() {
+	if (svgPrefetchThreads.empty() || svgPrefetchRunning > 0)
+		return;
+	double time = glfwGetTime();
+	if (svgPrefetchDoneTime < 0.0) {
+		svgPrefetchDoneTime = time;
+		return;
+	}
+	if (time - svgPrefetchDoneTime < SVG_PREFETCH_HOLD_TIME)
+		return;
+
+	// The threads have finished, so joining them doesn't block
+	SVG::stopPrefetch();
+	// Loaded SVGs are still held by their users and stay in svgCache
+	std::map<std::string, std::shared_ptr<SVG>> expired;
+	{
+		std::lock_guard<std::mutex> lock(svgCacheMutex);
+		expired.swap(svgPrefetched);
+	}
+	if (!expired.empty())
+		info("Freeing %d prefetched SVGs which were not loaded", (int) expired.size());
+}
+
 
 } // namespace rack
@@ -0,0 +1,147 @@
+/** Tests of MidiClock with a synthetic MIDI clock
+
+Sends jittered clock ticks at a steady tempo, delivers them at the start of each audio block like the MIDI-1 module does, and checks that the regenerated ticks follow the true tick times at a steady delay.
+Exits with a nonzero status if any check fails.
+*/
+
+#include "midi.hpp"
+#include <vector>
+#include <random>
+
+
+using namespace rack;
+
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+
+static const double SAMPLE_RATE = 44100.0;
+static const int BLOCK_SIZE = 256;
+
+static MidiMessage clockMessage(uint8_t channel, double timestamp) {
+	MidiMessage message;
+	message.cmd = 0xf0 | channel;
+	message.timestamp = timestamp;
+	return message;
+}
+
+/** Plays a clock at `bpm` for `duration` seconds and returns the times of the regenerated ticks
+Each tick is timestamped with up to `jitter` seconds of random error, and processed at the start of the next block.
+The times at which the ticks were processed are appended to `receivedTimes`.
+The clock is stopped after `duration`, and the clock runs for one more second.
+*/
+static std::vector<double> runClock(MidiClock &clock, double bpm, double jitter, double duration, std::vector<double> &receivedTimes) {
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<double> jitterDist(-jitter, jitter);
+	double tickPeriod = 60.0 / (24.0 * bpm);
+	double blockDuration = BLOCK_SIZE / SAMPLE_RATE;
+
+	std::vector<double> outputTimes;
+	// Start at a large time like the steady clock, so rounding errors would show up
+	double startTime = 10000.0;
+	clock.processMessage(clockMessage(0xa, startTime), startTime);
+
+	int64_t sentTicks = 0;
+	for (double blockTime = startTime; blockTime < startTime + duration + 1.0; blockTime += blockDuration) {
+		// Deliver the ticks which arrived during the last block
+		while (true) {
+			double tickTime = startTime + sentTicks * tickPeriod;
+			if (tickTime > blockTime || tickTime > startTime + duration)
+				break;
+			clock.processMessage(clockMessage(0x8, tickTime + jitterDist(rng)), blockTime);
+			receivedTimes.push_back(blockTime - startTime);
+			sentTicks++;
+		}
+
+		for (int i = 0; i < BLOCK_SIZE; i++) {
+			if (clock.process(1.0 / SAMPLE_RATE))
+				outputTimes.push_back(blockTime + i / SAMPLE_RATE - startTime);
+		}
+	}
+	return outputTimes;
+}
+
+/** Regenerated ticks should follow the true tick times at a steady delay, with much less jitter than block-quantized ticks */
+static void testSteadyClock() {
+	MidiClock clock;
+	double bpm = 120.0;
+	double duration = 20.0;
+	std::vector<double> receivedTimes;
+	std::vector<double> outputTimes = runClock(clock, bpm, 0.0015, duration, receivedTimes);
+	double tickPeriod = 60.0 / (24.0 * bpm);
+	double blockDuration = BLOCK_SIZE / SAMPLE_RATE;
+
+	// The first tick is at time 0, and no ticks are lost or added
+	CHECK(outputTimes.size() == receivedTimes.size());
+
+	// No tick is regenerated before it is received
+	for (size_t n = 0; n < std::min(outputTimes.size(), receivedTimes.size()); n++) {
+		CHECK(outputTimes[n] >= receivedTimes[n]);
+	}
+
+	// Compare the ticks after the loop has settled to the true tick times
+	double sumOffset = 0.0;
+	double minOffset = INFINITY;
+	double maxOffset = -INFINITY;
+	int count = 0;
+	for (size_t n = 0; n < outputTimes.size(); n++) {
+		double trueTime = n * tickPeriod;
+		if (trueTime < 5.0 || trueTime > duration)
+			continue;
+		double offset = outputTimes[n] - trueTime;
+		sumOffset += offset;
+		minOffset = std::min(minOffset, offset);
+		maxOffset = std::max(maxOffset, offset);
+		count++;
+	}
+	CHECK(count > 0);
+	double meanOffset = sumOffset / count;
+	if (meanOffset >= blockDuration + 0.002 || maxOffset - minOffset >= 0.0015)
+		fprintf(stderr, "mean offset %f ms, offsets from %f to %f ms\n", meanOffset * 1000.0, minOffset * 1000.0, maxOffset * 1000.0);
+	// The delay covers the block and the jitter, but not much more
+	CHECK(meanOffset < blockDuration + 0.002);
+	// Block quantization alone would vary by up to 5.8 ms
+	CHECK(maxOffset - minOffset < 0.0015);
+}
+
+/** The estimated tempo should match the sent tempo */
+static void testTempo() {
+	MidiClock clock;
+	std::vector<double> receivedTimes;
+	runClock(clock, 140.0, 0.0015, 10.0, receivedTimes);
+	CHECK(std::fabs(clock.getTempo() - 140.0) < 0.5);
+}
+
+/** Ticks should stop shortly after the clock stops */
+static void testStop() {
+	MidiClock clock;
+	double duration = 5.0;
+	std::vector<double> receivedTimes;
+	std::vector<double> outputTimes = runClock(clock, 120.0, 0.0015, duration, receivedTimes);
+	CHECK(!outputTimes.empty() && !receivedTimes.empty());
+	// No tick is regenerated beyond the last received one
+	CHECK(outputTimes.size() <= receivedTimes.size());
+	double blockDuration = BLOCK_SIZE / SAMPLE_RATE;
+	CHECK(outputTimes.back() < receivedTimes.back() + blockDuration + 0.002);
+}
+
+
+int main() {
+	testSteadyClock();
+	testTempo();
+	testStop();
+
+	if (failures > 0) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	printf("All MIDI clock tests passed\n");
+	return 0;
+}
@@ -0,0 +1,310 @@
+/** Tests of requestDownload() and requestDownloads() against a local HTTP server
+
+The server runs on a thread of this program and serves two versions of a file with byte range support.
+It can drop the connection partway through a response, or send slowly so a download can be cancelled.
+Exits with a nonzero status if any check fails.
+*/
+
+#include "util/common.hpp"
+#include "util/request.hpp"
+#include <thread>
+#include <random>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+
+using namespace rack;
+
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+
+static const size_t FILE_SIZE = 200000;
+
+static std::string randomData(unsigned seed) {
+	std::mt19937 rng(seed);
+	std::string data(FILE_SIZE, '\0');
+	for (char &c : data) {
+		c = (char) rng();
+	}
+	return data;
+}
+
+/** Serves "/v1" and "/v2", one connection at a time */
+struct Server {
+	std::string versions[2] = {randomData(1), randomData(2)};
+	int listenFd = -1;
+	int port = 0;
+	std::thread thread;
+	std::atomic<bool> running{false};
+
+	/** If nonzero, the next response is cut off after this many body bytes */
+	std::atomic<size_t> dropAfter{0};
+	/** Sends the body in small chunks with a pause between them */
+	std::atomic<bool> slow{false};
+	/** The start of the Range header of the last request, or -1 if it had none */
+	std::atomic<long> lastRangeStart{-1};
+
+	void start() {
+		listenFd = socket(AF_INET, SOCK_STREAM, 0);
+		assert(listenFd >= 0);
+		sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = 0;
+		int err = bind(listenFd, (sockaddr*) &addr, sizeof(addr));
+		assert(!err);
+		err = listen(listenFd, 4);
+		assert(!err);
+		socklen_t addrLen = sizeof(addr);
+		getsockname(listenFd, (sockaddr*) &addr, &addrLen);
+		port = ntohs(addr.sin_port);
+
+		running = true;
+		thread = std::thread([this]() {
+			while (running) {
+				int fd = accept(listenFd, NULL, NULL);
+				if (fd < 0)
+					continue;
+				handle(fd);
+				close(fd);
+			}
+		});
+	}
+
+	void stop() {
+		running = false;
+		// Unblock accept()
+		shutdown(listenFd, SHUT_RDWR);
+		close(listenFd);
+		thread.join();
+	}
+
+	std::string url(int version) {
+		return stringf("http://127.0.0.1:%d/v%d", port, version);
+	}
+
+	void handle(int fd) {
+		// Read the request head
+		std::string request;
+		char buffer[1024];
+		while (request.find("\r\n\r\n") == std::string::npos) {
+			ssize_t len = recv(fd, buffer, sizeof(buffer), 0);
+			if (len <= 0)
+				return;
+			request.append(buffer, len);
+		}
+
+		int version = 0;
+		sscanf(request.c_str(), "GET /v%d", &version);
+		if (version != 1 && version != 2) {
+			sendAll(fd, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+			return;
+		}
+		const std::string &data = versions[version - 1];
+
+		long rangeStart = -1;
+		size_t rangePos = request.find("Range: bytes=");
+		if (rangePos != std::string::npos)
+			rangeStart = atol(request.c_str() + rangePos + strlen("Range: bytes="));
+
+		lastRangeStart = rangeStart;
+		size_t dropAfter = this->dropAfter.exchange(0);
+		bool slow = this->slow;
+
+		size_t start = 0;
+		if (rangeStart >= (long) data.size()) {
+			sendAll(fd, stringf("HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%d\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", (int) data.size()));
+			return;
+		}
+		else if (rangeStart >= 0) {
+			start = rangeStart;
+			sendAll(fd, stringf("HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %d-%d/%d\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", (int) start, (int) data.size() - 1, (int) data.size(), (int) (data.size() - start)));
+		}
+		else {
+			sendAll(fd, stringf("HTTP/1.1 200 OK\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", (int) data.size()));
+		}
+
+		size_t end = data.size();
+		if (dropAfter > 0)
+			end = std::min(end, start + dropAfter);
+		const size_t chunkSize = slow ? 1024 : 65536;
+		for (size_t pos = start; pos < end; pos += chunkSize) {
+			if (!sendAll(fd, data.substr(pos, std::min(chunkSize, end - pos))))
+				return;
+			if (slow)
+				std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		}
+	}
+
+	bool sendAll(int fd, std::string s) {
+		size_t pos = 0;
+		while (pos < s.size()) {
+			ssize_t len = send(fd, s.data() + pos, s.size() - pos, 0);
+			if (len <= 0)
+				return false;
+			pos += len;
+		}
+		return true;
+	}
+};
+
+static Server server;
+static std::string directory;
+static std::string filename;
+
+
+static std::string readFile(std::string path) {
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file)
+		return "";
+	std::string data;
+	char buffer[65536];
+	size_t len;
+	while ((len = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		data.append(buffer, len);
+	}
+	fclose(file);
+	return data;
+}
+
+static void writeFile(std::string path, std::string data) {
+	FILE *file = fopen(path.c_str(), "wb");
+	assert(file);
+	fwrite(data.data(), 1, data.size(), file);
+	fclose(file);
+}
+
+static std::vector<std::string> partFiles() {
+	std::vector<std::string> parts;
+	for (std::string entry : systemListEntries(directory)) {
+		if (stringExtension(entry) == "part")
+			parts.push_back(entry);
+	}
+	return parts;
+}
+
+static void removeFiles() {
+	for (std::string entry : systemListEntries(directory)) {
+		remove(entry.c_str());
+	}
+}
+
+
+/** An interrupted download should keep its partial file and continue from it with a range request */
+static void testResume() {
+	removeFiles();
+	server.dropAfter = 100000;
+	float progress = 0.f;
+	CHECK(!requestDownload(server.url(1), filename, &progress));
+	CHECK(!systemIsFile(filename));
+	std::vector<std::string> parts = partFiles();
+	CHECK(parts.size() == 1);
+	if (parts.size() == 1)
+		CHECK(readFile(parts[0]) == server.versions[0].substr(0, 100000));
+
+	CHECK(requestDownload(server.url(1), filename, &progress));
+	CHECK(server.lastRangeStart == 100000);
+	CHECK(readFile(filename) == server.versions[0]);
+	CHECK(partFiles().empty());
+	CHECK(progress == 1.f);
+}
+
+/** A cancelled download should stop early, and be resumed by the next attempt */
+static void testCancel() {
+	removeFiles();
+	server.slow = true;
+	RequestDownload download;
+	download.url = server.url(1);
+	download.filename = filename;
+	std::thread thread([&]() {
+		requestDownloads({&download}, 1);
+	});
+	while (download.progress < 0.1f) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	download.cancelled = true;
+	thread.join();
+	server.slow = false;
+
+	CHECK(!download.success);
+	CHECK(!systemIsFile(filename));
+	std::vector<std::string> parts = partFiles();
+	CHECK(parts.size() == 1);
+	size_t partSize = 0;
+	if (parts.size() == 1)
+		partSize = readFile(parts[0]).size();
+	CHECK(partSize > 0 && partSize < FILE_SIZE);
+
+	RequestDownload download2;
+	download2.url = server.url(1);
+	download2.filename = filename;
+	requestDownloads({&download2}, 1);
+	CHECK(download2.success);
+	CHECK(server.lastRangeStart == (long) partSize);
+	CHECK(readFile(filename) == server.versions[0]);
+	CHECK(partFiles().empty());
+}
+
+/** A partial file of another version must not be resumed against a new URL for the same filename */
+static void testVersionMismatch() {
+	removeFiles();
+	server.dropAfter = 100000;
+	std::atomic<float> progress(0.f);
+	CHECK(!requestDownload(server.url(1), filename, &progress));
+	CHECK(partFiles().size() == 1);
+
+	CHECK(requestDownload(server.url(2), filename, &progress));
+	CHECK(server.lastRangeStart == -1);
+	CHECK(readFile(filename) == server.versions[1]);
+	// The partial file of version 1 is removed
+	CHECK(partFiles().empty());
+}
+
+/** A partial file longer than the resource should be discarded and downloaded again */
+static void testOversizedPart() {
+	removeFiles();
+	writeFile(filename + "." + requestSHA256String(server.url(2)) + ".part", server.versions[1] + "garbage");
+	std::atomic<float> progress(0.f);
+	CHECK(requestDownload(server.url(2), filename, &progress));
+	CHECK(server.lastRangeStart == -1);
+	CHECK(readFile(filename) == server.versions[1]);
+	CHECK(partFiles().empty());
+}
+
+
+int main() {
+	// The server writes to sockets which the client may have closed
+	signal(SIGPIPE, SIG_IGN);
+	char directoryTemplate[] = "/tmp/rack-request-test-XXXXXX";
+	directory = mkdtemp(directoryTemplate);
+	filename = directory + "/plugin.zip";
+	server.start();
+
+	testResume();
+	testCancel();
+	testVersionMismatch();
+	testOversizedPart();
+
+	server.stop();
+	removeFiles();
+	rmdir(directory.c_str());
+
+	if (failures > 0) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	printf("All request tests passed\n");
+	return 0;
+}
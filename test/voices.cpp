@@ -0,0 +1,403 @@
+/** Tests of the Core MIDI modules' voice allocation
+
+Checks each poly mode of VoiceAllocator and the sustain pedal, and compares random note sequences against the std::vector implementation VoiceAllocator replaced.
+Exits with a nonzero status if any check fails.
+*/
+
+#include "../src/Core/VoiceAllocator.hpp"
+#include <vector>
+#include <algorithm>
+#include <random>
+
+
+/** QuadMIDIToCVInterface's voice allocation before VoiceAllocator, with the held notes in a std::vector */
+struct ReferenceAllocator {
+	VoiceAllocator::PolyMode polyMode;
+	std::vector<uint8_t> cachedNotes;
+	uint8_t notes[4];
+	bool gates[4];
+	bool pedalgates[4];
+	bool pedal;
+	int rotateIndex;
+	int stealIndex;
+
+	ReferenceAllocator(VoiceAllocator::PolyMode polyMode) {
+		this->polyMode = polyMode;
+		for (int i = 0; i < 4; i++) {
+			notes[i] = 60;
+			gates[i] = false;
+			pedalgates[i] = false;
+		}
+		pedal = false;
+		rotateIndex = -1;
+		stealIndex = 0;
+	}
+
+	int getPolyIndex(int nowIndex) {
+		for (int i = 0; i < 4; i++) {
+			nowIndex++;
+			if (nowIndex > 3)
+				nowIndex = 0;
+			if (!(gates[nowIndex] || pedalgates[nowIndex])) {
+				stealIndex = nowIndex;
+				return nowIndex;
+			}
+		}
+		stealIndex++;
+		if (stealIndex > 3)
+			stealIndex = 0;
+		if ((polyMode < VoiceAllocator::REASSIGN_MODE) && (gates[stealIndex]))
+			cachedNotes.push_back(notes[stealIndex]);
+		return stealIndex;
+	}
+
+	void pressNote(uint8_t note) {
+		switch (polyMode) {
+			case VoiceAllocator::ROTATE_MODE: {
+				rotateIndex = getPolyIndex(rotateIndex);
+			} break;
+			case VoiceAllocator::REUSE_MODE: {
+				bool reuse = false;
+				for (int i = 0; i < 4; i++) {
+					if (notes[i] == note) {
+						rotateIndex = i;
+						reuse = true;
+						break;
+					}
+				}
+				if (!reuse)
+					rotateIndex = getPolyIndex(rotateIndex);
+			} break;
+			case VoiceAllocator::RESET_MODE: {
+				rotateIndex = getPolyIndex(-1);
+			} break;
+			case VoiceAllocator::REASSIGN_MODE: {
+				cachedNotes.push_back(note);
+				rotateIndex = getPolyIndex(-1);
+			} break;
+			case VoiceAllocator::UNISON_MODE: {
+				cachedNotes.push_back(note);
+				for (int i = 0; i < 4; i++) {
+					notes[i] = note;
+					gates[i] = true;
+					pedalgates[i] = pedal;
+				}
+				return;
+			} break;
+			default: break;
+		}
+		notes[rotateIndex] = note;
+		gates[rotateIndex] = true;
+		pedalgates[rotateIndex] = pedal;
+	}
+
+	void releaseNote(uint8_t note) {
+		auto it = std::find(cachedNotes.begin(), cachedNotes.end(), note);
+		if (it != cachedNotes.end())
+			cachedNotes.erase(it);
+
+		switch (polyMode) {
+			case VoiceAllocator::REASSIGN_MODE: {
+				for (int i = 0; i < 4; i++) {
+					if (i < (int) cachedNotes.size()) {
+						if (!pedalgates[i])
+							notes[i] = cachedNotes[i];
+						pedalgates[i] = pedal;
+					}
+					else {
+						gates[i] = false;
+					}
+				}
+			} break;
+			case VoiceAllocator::UNISON_MODE: {
+				if (!cachedNotes.empty()) {
+					uint8_t backnote = cachedNotes.back();
+					for (int i = 0; i < 4; i++) {
+						notes[i] = backnote;
+						gates[i] = true;
+					}
+				}
+				else {
+					for (int i = 0; i < 4; i++) {
+						gates[i] = false;
+					}
+				}
+			} break;
+			default: {
+				for (int i = 0; i < 4; i++) {
+					if (notes[i] == note) {
+						if (pedalgates[i]) {
+							gates[i] = false;
+						}
+						else if (!cachedNotes.empty()) {
+							notes[i] = cachedNotes.back();
+							cachedNotes.pop_back();
+						}
+						else {
+							gates[i] = false;
+						}
+					}
+				}
+			} break;
+		}
+	}
+
+	void pressPedal() {
+		pedal = true;
+		for (int i = 0; i < 4; i++) {
+			pedalgates[i] = gates[i];
+		}
+	}
+
+	void releasePedal() {
+		pedal = false;
+		for (int i = 0; i < 4; i++) {
+			pedalgates[i] = false;
+			if (!cachedNotes.empty()) {
+				if (polyMode < VoiceAllocator::REASSIGN_MODE) {
+					notes[i] = cachedNotes.back();
+					cachedNotes.pop_back();
+					gates[i] = true;
+				}
+			}
+		}
+		if (polyMode == VoiceAllocator::REASSIGN_MODE) {
+			for (int i = 0; i < 4; i++) {
+				if (i < (int) cachedNotes.size()) {
+					notes[i] = cachedNotes[i];
+					gates[i] = true;
+				}
+				else {
+					gates[i] = false;
+				}
+			}
+		}
+	}
+};
+
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+/** Checks the note and gate of every voice, where a note of -1 means the gate is off */
+static void checkVoices(VoiceAllocator &voices, std::vector<int> expected, int line) {
+	for (int i = 0; i < voices.channels; i++) {
+		bool gate = voices.getGate(i);
+		bool ok = (expected[i] < 0) ? !gate : (gate && voices.notes[i] == expected[i]);
+		if (!ok) {
+			fprintf(stderr, "%s:%d: voice %d is %d (gate %d), expected %d\n", __FILE__, line, i, voices.notes[i], gate, expected[i]);
+			failures++;
+		}
+	}
+}
+#define CHECK_VOICES(voices, ...) checkVoices(voices, __VA_ARGS__, __LINE__)
+
+static VoiceAllocator createVoices(VoiceAllocator::PolyMode polyMode) {
+	VoiceAllocator voices(4);
+	voices.polyMode = polyMode;
+	return voices;
+}
+
+
+static void testNoteList() {
+	NoteList list;
+	CHECK(list.empty());
+	list.push_back(60);
+	list.push_back(64);
+	list.push_back(67);
+	CHECK(list.size() == 3);
+	CHECK(list.back() == 67);
+	// Pushing a held note moves it to the back, like MIDIToCVInterface's old vector did by erasing it first
+	list.push_back(60);
+	CHECK(list.size() == 3);
+	CHECK(list.first == 64);
+	CHECK(list.back() == 60);
+	list.remove(64);
+	CHECK(list.first == 67);
+	CHECK(list.getNext(67) == 60);
+	list.pop_back();
+	CHECK(list.back() == 67);
+	list.remove(67);
+	CHECK(list.empty());
+	CHECK(list.first == NoteList::NONE && list.last == NoteList::NONE);
+	// Out of range notes are ignored
+	list.push_back(-1);
+	list.push_back(128);
+	CHECK(list.empty());
+}
+
+static void testRotate() {
+	VoiceAllocator voices = createVoices(VoiceAllocator::ROTATE_MODE);
+	voices.pressNote(60);
+	voices.pressNote(62);
+	CHECK_VOICES(voices, {60, 62, -1, -1});
+	voices.releaseNote(60);
+	// Continues after the last voice rather than reusing the first free one
+	voices.pressNote(64);
+	CHECK_VOICES(voices, {-1, 62, 64, -1});
+	voices.pressNote(65);
+	voices.pressNote(67);
+	CHECK_VOICES(voices, {67, 62, 64, 65});
+	// Steals a voice and caches its note
+	voices.pressNote(69);
+	CHECK_VOICES(voices, {67, 69, 64, 65});
+	// The stolen note returns when a voice is released
+	voices.releaseNote(65);
+	CHECK_VOICES(voices, {67, 69, 64, 62});
+}
+
+static void testReuse() {
+	VoiceAllocator voices = createVoices(VoiceAllocator::REUSE_MODE);
+	voices.pressNote(60);
+	voices.pressNote(62);
+	voices.releaseNote(60);
+	// A note is played on the voice which last played it
+	voices.pressNote(60);
+	CHECK_VOICES(voices, {60, 62, -1, -1});
+	voices.pressNote(64);
+	CHECK_VOICES(voices, {60, 62, 64, -1});
+}
+
+static void testReset() {
+	VoiceAllocator voices = createVoices(VoiceAllocator::RESET_MODE);
+	voices.pressNote(60);
+	voices.pressNote(62);
+	voices.pressNote(64);
+	voices.releaseNote(60);
+	// Always takes the first free voice
+	voices.pressNote(65);
+	CHECK_VOICES(voices, {65, 62, 64, -1});
+	voices.pressNote(67);
+	voices.pressNote(69);
+	CHECK_VOICES(voices, {69, 62, 64, 67});
+	voices.releaseNote(69);
+	CHECK_VOICES(voices, {65, 62, 64, 67});
+}
+
+static void testReassign() {
+	VoiceAllocator voices = createVoices(VoiceAllocator::REASSIGN_MODE);
+	voices.pressNote(60);
+	voices.pressNote(62);
+	voices.pressNote(64);
+	CHECK_VOICES(voices, {60, 62, 64, -1});
+	// Releasing a note moves the remaining held notes down to the first voices in the order they were pressed
+	voices.releaseNote(60);
+	CHECK_VOICES(voices, {62, 64, -1, -1});
+	voices.pressNote(65);
+	voices.pressNote(67);
+	voices.pressNote(69);
+	voices.releaseNote(62);
+	CHECK_VOICES(voices, {64, 65, 67, 69});
+}
+
+static void testUnison() {
+	VoiceAllocator voices = createVoices(VoiceAllocator::UNISON_MODE);
+	voices.pressNote(60);
+	CHECK_VOICES(voices, {60, 60, 60, 60});
+	voices.pressNote(64);
+	CHECK_VOICES(voices, {64, 64, 64, 64});
+	// Returns to the last held note
+	voices.releaseNote(64);
+	CHECK_VOICES(voices, {60, 60, 60, 60});
+	voices.releaseNote(60);
+	CHECK_VOICES(voices, {-1, -1, -1, -1});
+}
+
+static void testPedal() {
+	for (int mode = 0; mode < VoiceAllocator::NUM_MODES; mode++) {
+		VoiceAllocator voices = createVoices((VoiceAllocator::PolyMode) mode);
+		voices.pressNote(60);
+		voices.pressPedal();
+		voices.releaseNote(60);
+		// Held by the pedal
+		CHECK(voices.getGate(0));
+		CHECK(voices.notes[0] == 60);
+		voices.releasePedal();
+		for (int i = 0; i < voices.channels; i++) {
+			CHECK(!voices.getGate(i));
+		}
+	}
+
+	// Notes pressed while the pedal is held are also sustained
+	VoiceAllocator voices = createVoices(VoiceAllocator::RESET_MODE);
+	voices.pressPedal();
+	voices.pressNote(60);
+	voices.pressNote(62);
+	voices.releaseNote(60);
+	voices.releaseNote(62);
+	CHECK_VOICES(voices, {60, 62, -1, -1});
+	// A held key keeps its voice after the pedal is released
+	voices.pressNote(64);
+	voices.releasePedal();
+	CHECK_VOICES(voices, {-1, -1, 64, -1});
+}
+
+/** Plays the same random notes and pedal changes into both implementations and checks that the voices always match */
+static void testMatchesReference() {
+	std::mt19937 rng(1);
+	for (int mode = 0; mode < VoiceAllocator::NUM_MODES; mode++) {
+		for (int run = 0; run < 200; run++) {
+			VoiceAllocator voices = createVoices((VoiceAllocator::PolyMode) mode);
+			ReferenceAllocator reference((VoiceAllocator::PolyMode) mode);
+			// A small range of notes, so notes are often pressed again while held, as a keyboard driver sending repeated note-ons would
+			int range = (run % 2) ? 8 : 24;
+			for (int event = 0; event < 200; event++) {
+				int r = rng() % 100;
+				uint8_t note = 60 + rng() % range;
+				if (r < 45) {
+					voices.pressNote(note);
+					reference.pressNote(note);
+				}
+				else if (r < 90) {
+					voices.releaseNote(note);
+					reference.releaseNote(note);
+				}
+				else if (r < 95) {
+					voices.pressPedal();
+					reference.pressPedal();
+				}
+				else {
+					voices.releasePedal();
+					reference.releasePedal();
+				}
+
+				bool match = true;
+				for (int i = 0; i < 4; i++) {
+					bool gate = reference.gates[i] || reference.pedalgates[i];
+					if (voices.getGate(i) != gate || (gate && voices.notes[i] != reference.notes[i]))
+						match = false;
+				}
+				if (!match) {
+					fprintf(stderr, "%s:%d: mode %d run %d event %d differs from the reference\n", __FILE__, __LINE__, mode, run, event);
+					failures++;
+					break;
+				}
+			}
+		}
+	}
+}
+
+
+int main() {
+	testNoteList();
+	testRotate();
+	testReuse();
+	testReset();
+	testReassign();
+	testUnison();
+	testPedal();
+	testMatchesReference();
+
+	if (failures > 0) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	printf("All voice allocation tests passed\n");
+	return 0;
+}